@@ -0,0 +1,107 @@
+#include <benchmark/benchmark.h>
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "AfCoroutineFrame.hpp"
+
+// Chain of lazily started coroutines, each one awaiting the next one. Every level creates and destroys one frame,
+// so the whole chain is a burst of frame allocations of the same size, same as a request going through
+// the layers of an async service.
+
+namespace {
+struct DefaultFrame {};
+
+template <typename FrameBase>
+class Task {
+  public:
+    struct promise_type : FrameBase {
+      Task get_return_object() {
+        return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+      }
+
+      std::suspend_always initial_suspend() noexcept {
+        return {};
+      }
+
+      struct FinalAwaiter {
+        bool await_ready() noexcept {
+          return false;
+        }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+          return handle.promise().continuation;
+        }
+
+        void await_resume() noexcept {}
+      };
+
+      FinalAwaiter final_suspend() noexcept {
+        return {};
+      }
+
+      void return_value(const std::size_t value) {
+        result = value;
+      }
+
+      void unhandled_exception() {
+        std::terminate();
+      }
+
+      std::size_t result{0};
+      std::coroutine_handle<> continuation{std::noop_coroutine()};
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+    ~Task() {
+      if(handle_) {
+        handle_.destroy();
+      }
+    }
+
+    bool await_ready() noexcept {
+      return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> continuation) noexcept {
+      handle_.promise().continuation = continuation;
+      return handle_;
+    }
+
+    std::size_t await_resume() noexcept {
+      return handle_.promise().result;
+    }
+
+    // runs the outermost task to the end
+    std::size_t run() {
+      handle_.resume();
+      return handle_.promise().result;
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename FrameBase>
+Task<FrameBase> chain(const std::size_t depth) {
+    if(depth == 0) {
+        co_return 1;
+    }
+    co_return co_await chain<FrameBase>(depth - 1) + 1;
+}
+
+template <typename FrameBase>
+void BM_AwaitChain(benchmark::State &state) {
+    const auto depth = static_cast<std::size_t>(state.range(0));
+    for(auto _: state) {
+        benchmark::DoNotOptimize(chain<FrameBase>(depth).run());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * (depth + 1)));
+}
+}
+
+BENCHMARK(BM_AwaitChain<DefaultFrame>)->Name("AwaitChain/GlobalNew")->RangeMultiplier(4)->Range(1, 256)->ThreadRange(1, 8);
+BENCHMARK(BM_AwaitChain<AfPooledFrame>)->Name("AwaitChain/AfPooledFrame")->RangeMultiplier(4)->Range(1, 256)->ThreadRange(1, 8);
@@ -0,0 +1,51 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <vector>
+
+#include "AfMalloc.hpp"
+
+// Thread affine against per CPU arenas. Each benchmark thread allocates a batch of small objects and
+// frees them again, like a connection thread handling one request. With many threads, thread affine arenas
+// end up with one heap per arena, while per CPU arenas stay bounded by the number of cores.
+
+namespace {
+std::unique_ptr<AfMalloc> af_malloc{};
+
+void setUpThreadAffine(const benchmark::State &) {
+    af_malloc = std::make_unique<AfMalloc>(ArenaSelection::THREAD);
+}
+
+void setUpPerCpu(const benchmark::State &) {
+    af_malloc = std::make_unique<AfMalloc>(ArenaSelection::CPU);
+}
+
+void tearDown(const benchmark::State &) {
+    af_malloc.reset();
+}
+
+void BM_MallocFree(benchmark::State &state) {
+    std::vector<void *> ptrs(64);
+    for(auto _: state) {
+        for(auto &ptr: ptrs) {
+            ptr = af_malloc->malloc(100);
+            benchmark::DoNotOptimize(ptr);
+        }
+        for(auto *ptr: ptrs) {
+            af_malloc->free(ptr);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * ptrs.size()));
+    if(state.thread_index() == 0) {
+        state.counters["heap_bytes"] = static_cast<double>(af_malloc->getTotalAllocatedSize());
+        const AfLockStats lock_stats = af_malloc->getLockStats();
+        state.counters["try_lock_failures"] = static_cast<double>(lock_stats.try_lock_failures);
+        state.counters["arena_switches"] = static_cast<double>(lock_stats.arena_switches);
+        state.counters["lock_wait_ms"] = static_cast<double>(lock_stats.wait_ns) / 1e6;
+    }
+}
+}
+
+BENCHMARK(BM_MallocFree)->Name("ThreadAffine")->Setup(setUpThreadAffine)->Teardown(tearDown)
+    ->ThreadRange(1, 512)->UseRealTime();
+BENCHMARK(BM_MallocFree)->Name("PerCpu")->Setup(setUpPerCpu)->Teardown(tearDown)
+    ->ThreadRange(1, 512)->UseRealTime();
@@ -0,0 +1,55 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "AfMalloc.hpp"
+
+// Every arena gets its first heap when its thread allocates the first object, so all the objects are at the same
+// offset of HEAP_MAX_SIZE aligned heaps. Without colouring they fall into the same few sets of L1 and L2,
+// and walking over them evicts the lines of the other arenas. With colouring they are spread over the sets.
+// Misses themselves are not counted, the time per touched line shows them.
+
+namespace {
+constexpr std::size_t ARENAS = 64;
+constexpr std::size_t OBJECT_SIZE = 4 * CACHE_LINE_SIZE;
+
+std::unique_ptr<AfMalloc> af_malloc{};
+std::vector<void *> objects{};
+
+void setUp(const benchmark::State &state) {
+    afMallopt(AfMallocParam::HEAP_COLOURS, static_cast<std::size_t>(state.range(0)));
+    af_malloc = std::make_unique<AfMalloc>(ArenaSelection::THREAD, ARENAS);
+    objects.resize(ARENAS);
+    // threads are started one after the other, so each one takes the next thread affine arena
+    for(auto &object: objects) {
+        std::thread{[&object]() { object = af_malloc->malloc(OBJECT_SIZE - HEAD_OF_CHUNK_SIZE); }}.join();
+    }
+}
+
+void tearDown(const benchmark::State &) {
+    for(void *object: objects) {
+        af_malloc->free(object);
+    }
+    af_malloc.reset();
+    afMallopt(AfMallocParam::HEAP_COLOURS, DEFAULT_HEAP_COLOURS);
+}
+
+void BM_SameOffsetAcrossArenas(benchmark::State &state) {
+    for(auto _: state) {
+        for(void *object: objects) {
+            auto *lines = static_cast<std::size_t *>(object);
+            for(std::size_t line{0}; line < OBJECT_SIZE - HEAD_OF_CHUNK_SIZE; line += CACHE_LINE_SIZE) {
+                lines[line / sizeof(std::size_t)]++;
+            }
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * ARENAS * (OBJECT_SIZE / CACHE_LINE_SIZE)));
+}
+}
+
+BENCHMARK(BM_SameOffsetAcrossArenas)->Name("SameOffsetAcrossArenas/NoColouring")->Arg(1)
+    ->Setup(setUp)->Teardown(tearDown);
+BENCHMARK(BM_SameOffsetAcrossArenas)->Name("SameOffsetAcrossArenas/Colouring")->Arg(DEFAULT_HEAP_COLOURS)
+    ->Setup(setUp)->Teardown(tearDown);
@@ -0,0 +1,64 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <vector>
+
+#include "AfMalloc.hpp"
+
+// Cost of the allocation hooks. With no hooks installed every malloc and free only loads the hooks pointer and
+// takes a branch which is never taken, HookCheck is that load and branch on their own. Installed hooks which
+// only count show what a profiler pays on top of its own work.
+
+namespace {
+constexpr std::size_t OBJECTS = 256;
+constexpr std::size_t OBJECT_SIZE = 64;
+
+std::atomic<std::size_t> hook_calls{0};
+
+void countAlloc(void *, void *, std::size_t) {
+    hook_calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void countFree(void *, void *) {
+    hook_calls.fetch_add(1, std::memory_order_relaxed);
+}
+
+void installCountingHooks(const benchmark::State &) {
+    AfMallocHooks hooks{};
+    hooks.on_alloc = &countAlloc;
+    hooks.on_free = &countFree;
+    setAfMallocHooks(hooks);
+}
+
+void removeHooks(const benchmark::State &) {
+    clearAfMallocHooks();
+}
+
+void BM_MallocFree(benchmark::State &state) {
+    AfMalloc af_malloc{};
+    std::vector<void *> ptrs(OBJECTS);
+    for(auto _: state) {
+        for(void *&ptr: ptrs) {
+            ptr = af_malloc.malloc(OBJECT_SIZE);
+        }
+        for(void *ptr: ptrs) {
+            af_malloc.free(ptr);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * OBJECTS));
+}
+
+void BM_HookCheck(benchmark::State &state) {
+    std::size_t taken{0};
+    for(auto _: state) {
+        if(const AfMallocHooks *hooks = getAfMallocHooks(); hooks != nullptr) [[unlikely]] {
+            taken++;
+        }
+        benchmark::DoNotOptimize(taken);
+    }
+}
+}
+
+BENCHMARK(BM_MallocFree)->Name("MallocFree/NoHooks");
+BENCHMARK(BM_MallocFree)->Name("MallocFree/CountingHooks")->Setup(installCountingHooks)->Teardown(removeHooks);
+BENCHMARK(BM_HookCheck)->Name("HookCheck");
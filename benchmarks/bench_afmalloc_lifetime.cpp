@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "AfMalloc.hpp"
+
+// Mixed lifetime workload: every round allocates a burst of short lived objects of random sizes and frees them
+// again, but every tenth allocation is a long lived object which is kept until the end. Without the hints the long
+// lived objects are spread over the heaps the short ones come from, and the holes between them don't fit the
+// following bursts. With the hints the long lived objects are packed in heaps of their own.
+// Workload runs in a child process, so the peak RSS of the child is the peak of this workload alone.
+
+namespace {
+constexpr std::size_t ROUNDS = 200;
+constexpr std::size_t BURST = 256;
+constexpr std::size_t LONG_LIVED_EVERY = 10;
+
+std::size_t runMixedLifetimeWorkload(const bool use_hints) {
+    AfMalloc af_malloc{};
+    std::mt19937 generator{42};
+    std::uniform_int_distribution<std::size_t> short_size{16, 1024};
+    const AfLifetime long_lifetime = use_hints ? AfLifetime::LONG : AfLifetime::SHORT;
+
+    std::vector<void *> long_lived;
+    std::vector<void *> short_lived;
+    std::size_t peak_heap_bytes{0};
+    for(std::size_t round{0}; round < ROUNDS; round++) {
+        for(std::size_t i{0}; i < BURST; i++) {
+            if(i % LONG_LIVED_EVERY == 0) {
+                long_lived.push_back(af_malloc.malloc(32, long_lifetime));
+            } else {
+                short_lived.push_back(af_malloc.malloc(short_size(generator)));
+            }
+        }
+        peak_heap_bytes = std::max(peak_heap_bytes, af_malloc.getTotalAllocatedSize());
+        for(void *ptr: short_lived) {
+            af_malloc.free(ptr);
+        }
+        short_lived.clear();
+    }
+    for(void *ptr: long_lived) {
+        af_malloc.free(ptr);
+    }
+    return peak_heap_bytes;
+}
+
+void BM_MixedLifetime(benchmark::State &state) {
+    const bool use_hints = state.range(0) != 0;
+    long peak_rss_kb{0};
+    std::size_t peak_heap_bytes{0};
+    for(auto _: state) {
+        int pipe_fds[2];
+        if(pipe(pipe_fds) != 0) {
+            state.SkipWithError("pipe failed");
+            return;
+        }
+        const pid_t pid = fork();
+        if(pid == 0) {
+            close(pipe_fds[0]);
+            const std::size_t child_peak = runMixedLifetimeWorkload(use_hints);
+            [[maybe_unused]] auto written = write(pipe_fds[1], &child_peak, sizeof(child_peak));
+            _exit(0);
+        }
+        close(pipe_fds[1]);
+        [[maybe_unused]] auto read_bytes = read(pipe_fds[0], &peak_heap_bytes, sizeof(peak_heap_bytes));
+        close(pipe_fds[0]);
+        int status{0};
+        rusage usage{};
+        wait4(pid, &status, 0, &usage);
+        peak_rss_kb = usage.ru_maxrss;
+    }
+    state.counters["peak_rss_kb"] = static_cast<double>(peak_rss_kb);
+    state.counters["peak_heap_bytes"] = static_cast<double>(peak_heap_bytes);
+}
+}
+
+BENCHMARK(BM_MixedLifetime)->Name("MixedLifetime/NoHints")->Arg(0)->Iterations(10)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MixedLifetime)->Name("MixedLifetime/Hints")->Arg(1)->Iterations(10)->Unit(benchmark::kMillisecond);
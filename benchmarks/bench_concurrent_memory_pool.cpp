@@ -0,0 +1,78 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "concurrent_memory_pool_allocator.hpp"
+#include "memory_pool_allocator.hpp"
+#include "page_size_allocator.hpp"
+
+// MemoryPoolAllocator behind one mutex against the magazines of ConcurrentMemoryPoolAllocator. Each benchmark
+// thread allocates a batch of small blocks and frees them again. With the mutex every block is a lock acquisition
+// on a shared line, with magazines only every magazine that goes to or comes from the depot is.
+
+namespace {
+constexpr std::size_t BATCH_SIZE = 64;
+constexpr std::size_t BLOCK_SIZE = 64;
+
+std::unique_ptr<memory::PageSizeAllocator> page_size_allocator{};
+std::unique_ptr<memory::MemoryPoolAllocator> locked_pool{};
+std::mutex locked_pool_lock{};
+std::unique_ptr<memory::ConcurrentMemoryPoolAllocator> concurrent_pool{};
+
+void setUpLocked(const benchmark::State &) {
+    page_size_allocator = std::make_unique<memory::PageSizeAllocator>();
+    locked_pool = std::make_unique<memory::MemoryPoolAllocator>(*page_size_allocator);
+}
+
+void tearDownLocked(const benchmark::State &) {
+    locked_pool.reset();
+    page_size_allocator.reset();
+}
+
+void setUpMagazines(const benchmark::State &) {
+    page_size_allocator = std::make_unique<memory::PageSizeAllocator>();
+    concurrent_pool = std::make_unique<memory::ConcurrentMemoryPoolAllocator>(*page_size_allocator);
+}
+
+void tearDownMagazines(const benchmark::State &) {
+    concurrent_pool.reset();
+    page_size_allocator.reset();
+}
+
+void BM_LockedPool(benchmark::State &state) {
+    std::vector<void *> ptrs(BATCH_SIZE);
+    for(auto _: state) {
+        for(auto &ptr: ptrs) {
+            std::lock_guard lock{locked_pool_lock};
+            ptr = locked_pool->allocate(8, BLOCK_SIZE);
+        }
+        benchmark::DoNotOptimize(ptrs.data());
+        for(auto *ptr: ptrs) {
+            std::lock_guard lock{locked_pool_lock};
+            locked_pool->deallocate(ptr);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * ptrs.size()));
+}
+
+void BM_Magazines(benchmark::State &state) {
+    std::vector<void *> ptrs(BATCH_SIZE);
+    for(auto _: state) {
+        for(auto &ptr: ptrs) {
+            ptr = concurrent_pool->allocate(8, BLOCK_SIZE);
+        }
+        benchmark::DoNotOptimize(ptrs.data());
+        for(auto *ptr: ptrs) {
+            concurrent_pool->deallocate(ptr, 8, BLOCK_SIZE);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * ptrs.size()));
+    if(state.thread_index() == 0) {
+        state.counters["depot_exchanges"] = static_cast<double>(concurrent_pool->getNumDepotExchanges());
+    }
+}
+}
+
+BENCHMARK(BM_LockedPool)->Setup(setUpLocked)->Teardown(tearDownLocked)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_Magazines)->Setup(setUpMagazines)->Teardown(tearDownMagazines)->ThreadRange(1, 64)->UseRealTime();
@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "lock_free_pool_allocator.hpp"
+#include "memory_pool_allocator.hpp"
+#include "page_size_allocator.hpp"
+
+// Contention on one shared pool of 64 byte blocks from 1 to N threads: the Treiber stack of LockFreePoolAllocator
+// against MemoryPoolAllocator behind one mutex. Each benchmark thread allocates a few blocks and frees them again,
+// so every operation goes to the shared free list, as it does when objects are handed between threads.
+
+namespace {
+constexpr std::size_t BATCH_SIZE = 16;
+constexpr std::size_t BLOCK_SIZE = 64;
+
+std::unique_ptr<memory::PageSizeAllocator> page_size_allocator{};
+std::unique_ptr<memory::MemoryPoolAllocator> locked_pool{};
+std::mutex locked_pool_lock{};
+std::unique_ptr<memory::LockFreePoolAllocator> lock_free_pool{};
+
+void setUpLocked(const benchmark::State &) {
+    page_size_allocator = std::make_unique<memory::PageSizeAllocator>();
+    locked_pool = std::make_unique<memory::MemoryPoolAllocator>(*page_size_allocator);
+}
+
+void tearDownLocked(const benchmark::State &) {
+    locked_pool.reset();
+    page_size_allocator.reset();
+}
+
+void setUpLockFree(const benchmark::State &state) {
+    page_size_allocator = std::make_unique<memory::PageSizeAllocator>();
+    lock_free_pool = std::make_unique<memory::LockFreePoolAllocator>(*page_size_allocator, BLOCK_SIZE, 8);
+    // no thread takes the refill lock while it is measured
+    lock_free_pool->reserve(static_cast<std::size_t>(state.threads()) * BATCH_SIZE);
+}
+
+void tearDownLockFree(const benchmark::State &) {
+    lock_free_pool.reset();
+    page_size_allocator.reset();
+}
+
+void BM_LockedPool(benchmark::State &state) {
+    std::vector<void *> ptrs(BATCH_SIZE);
+    for(auto _: state) {
+        for(auto &ptr: ptrs) {
+            std::lock_guard lock{locked_pool_lock};
+            ptr = locked_pool->allocate(8, BLOCK_SIZE);
+        }
+        benchmark::DoNotOptimize(ptrs.data());
+        for(auto *ptr: ptrs) {
+            std::lock_guard lock{locked_pool_lock};
+            locked_pool->deallocate(ptr);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * ptrs.size()));
+}
+
+void BM_LockFreePool(benchmark::State &state) {
+    std::vector<void *> ptrs(BATCH_SIZE);
+    for(auto _: state) {
+        for(auto &ptr: ptrs) {
+            ptr = lock_free_pool->allocate();
+        }
+        benchmark::DoNotOptimize(ptrs.data());
+        for(auto *ptr: ptrs) {
+            lock_free_pool->deallocate(ptr);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * ptrs.size()));
+}
+}
+
+BENCHMARK(BM_LockedPool)->Setup(setUpLocked)->Teardown(tearDownLocked)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK(BM_LockFreePool)->Setup(setUpLockFree)->Teardown(tearDownLockFree)->ThreadRange(1, 64)->UseRealTime();
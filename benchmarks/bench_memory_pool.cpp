@@ -0,0 +1,111 @@
+#include <benchmark/benchmark.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "memory_pool_allocator.hpp"
+#include "object_pool.hpp"
+#include "page_size_allocator.hpp"
+
+// Free and allocate of one block while the pool has many live blocks. The cost of deallocate
+// must not depend on the number of live blocks.
+
+namespace {
+void BM_FreeWithLiveBlocks(benchmark::State &state) {
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+    const auto num_live = static_cast<std::size_t>(state.range(0));
+    std::vector<void *> ptrs(num_live);
+    for(void *&ptr: ptrs) {
+        ptr = memory_pool_allocator.allocate(1, 1);
+    }
+    std::size_t next{0};
+    for(auto _: state) {
+        // blocks are freed all over the pool, not only the last allocated ones
+        memory_pool_allocator.deallocate(ptrs[next]);
+        ptrs[next] = memory_pool_allocator.allocate(1, 1);
+        benchmark::DoNotOptimize(ptrs[next]);
+        next = (next + 7919) % num_live;
+    }
+    for(void *ptr: ptrs) {
+        memory_pool_allocator.deallocate(ptr);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+}
+
+BENCHMARK(BM_FreeWithLiveBlocks)->Arg(1'000)->Arg(100'000);
+
+
+// Fills an empty pool with a burst of blocks and frees them again, with slabs of at most range(0) pages.
+// Every refill goes to the page allocator, bigger slabs need fewer of them.
+namespace {
+void BM_FillPool(benchmark::State &state) {
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+    constexpr std::size_t num_blocks = 10'000;
+    std::vector<void *> ptrs(num_blocks);
+    for(auto _: state) {
+        // slabs start small again after every burst
+        memory_pool_allocator.setEmptyPageMarks(0, 0);
+        memory_pool_allocator.setSlabPages(1, static_cast<std::size_t>(state.range(0)));
+        for(void *&ptr: ptrs) {
+            ptr = memory_pool_allocator.allocate(1, 64);
+        }
+        benchmark::DoNotOptimize(ptrs.data());
+        for(void *ptr: ptrs) {
+            memory_pool_allocator.deallocate(ptr);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * num_blocks));
+}
+}
+
+BENCHMARK(BM_FillPool)->Arg(1)->Arg(16);
+
+
+// Objects the size of a small session record, created and destroyed in batches: ObjectPool against new and delete.
+namespace {
+struct Session {
+    std::uint64_t id;
+    std::uint64_t last_seen;
+    std::array<char, 48> peer;
+};
+
+constexpr std::size_t NUM_SESSIONS = 64;
+
+void BM_ObjectPoolCreateDestroy(benchmark::State &state) {
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::ObjectPool<Session> pool{page_size_allocator};
+    std::vector<memory::ObjectPool<Session>::Handle> sessions(NUM_SESSIONS);
+    for(auto _: state) {
+        for(std::size_t i{0}; i < NUM_SESSIONS; ++i) {
+            sessions[i] = pool.create(Session{i, 0, {}});
+        }
+        benchmark::DoNotOptimize(sessions.data());
+        for(auto &session: sessions) {
+            session.reset();
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * NUM_SESSIONS));
+}
+
+void BM_NewDelete(benchmark::State &state) {
+    std::vector<std::unique_ptr<Session>> sessions(NUM_SESSIONS);
+    for(auto _: state) {
+        for(std::size_t i{0}; i < NUM_SESSIONS; ++i) {
+            sessions[i] = std::make_unique<Session>(Session{i, 0, {}});
+        }
+        benchmark::DoNotOptimize(sessions.data());
+        for(auto &session: sessions) {
+            session.reset();
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * NUM_SESSIONS));
+}
+}
+
+BENCHMARK(BM_ObjectPoolCreateDestroy);
+BENCHMARK(BM_NewDelete);
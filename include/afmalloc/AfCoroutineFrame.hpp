@@ -0,0 +1,59 @@
+#pragma once
+#include <cstddef>
+
+// Frames up to this size, header included, are pooled by exact size. Bigger ones come from AfMalloc on every call.
+constexpr std::size_t MAX_POOLED_FRAME_SIZE = 2048;
+
+// Frame sizes are rounded up to this, so they are aligned as the chunks are
+constexpr std::size_t FRAME_SIZE_SPACING = 16;
+
+constexpr std::size_t NUM_FRAME_SIZES = MAX_POOLED_FRAME_SIZE / FRAME_SIZE_SPACING + 1;
+
+// Most free frames of one size one pool keeps, the rest goes back to AfMalloc
+constexpr std::size_t MAX_CACHED_FRAMES = 256;
+
+// Frames taken from AfMalloc with one mallocBatch when the pool has none of the size
+constexpr std::size_t FRAME_REFILL_COUNT = 16;
+
+/**
+ * Counters of the pool of the calling thread
+ */
+struct AfCoroutineFrameStats {
+  // frames handed out from the pool, without going to AfMalloc
+  std::size_t reused{0};
+  // mallocBatch calls made since the pool had no frame of the size
+  std::size_t refills{0};
+  // frames other threads freed, which came back to this pool
+  std::size_t remote_frees{0};
+};
+
+/**
+ * Allocates a coroutine frame from the pool of the calling thread. Every thread has its own pool, so there is no
+ * locking unless the pool is empty and has to be refilled from AfMalloc.
+ */
+void *allocateCoroutineFrame(std::size_t size);
+
+/**
+ * Gives the frame back to the pool it came from. On the thread which allocated the frame it goes to the
+ * free list of its size, from any other thread it is pushed to the lock free list of remote frees of the pool,
+ * which the owner takes over when it runs out of frames of some size.
+ * @param size same size the frame was allocated with
+ */
+void freeCoroutineFrame(void *frame, std::size_t size);
+
+AfCoroutineFrameStats getCoroutineFrameStats();
+
+/**
+ * Mixin for the promise_type of a coroutine, so its frames are allocated by the pools instead of the global new:
+ *
+ * struct promise_type : AfPooledFrame { ... };
+ */
+struct AfPooledFrame {
+  static void *operator new(const std::size_t size) {
+    return allocateCoroutineFrame(size);
+  }
+
+  static void operator delete(void *frame, const std::size_t size) {
+    freeCoroutineFrame(frame, size);
+  }
+};
@@ -1,11 +1,24 @@
 #pragma once
+#include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <bit>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bitset>
+#include <chrono>
+#include <condition_variable>
 #include <format>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "AfStatsSegment.hpp"
+
 // original malloc implementation has fastBins from 32 to 160 bytes
 // fast bins are 16 bytes apart
 
@@ -189,14 +202,336 @@ std::optional<std::pair<std::size_t, std::size_t>> findBinIndex(std::size_t allo
 
 struct AfArena;
 
+constexpr std::size_t OS_PAGE_SIZE = 4096;
+
 constexpr std::size_t HEAP_MAX_SIZE = 4096 * 32;
+
+// Every heap is mapped so that its memory starts on HEAP_MAX_SIZE boundary, and the page
+// right before it holds AfHeap. That way the heap of any chunk is found by masking the chunk address.
+constexpr std::size_t HEAP_HEADER_SIZE = 4096;
+
+/**
+ * Header of one mmapped heap. Heaps of the same arena are linked from the newest one,
+ * which is the one top_ of the arena lives in.
+ */
 struct AfHeap {
   AfArena *arena_ptr;
   void *memory_start{};
+  AfHeap *prev_heap{nullptr};
+  // heap is cut into slab pages instead of chunks
+  bool is_slab_heap{false};
+  // not 0 if the heap is a single chunk mapped for one large allocation, then this is the size of the mapping
+  std::size_t mmapped_size{0};
+  // first chunk starts this many bytes after memory_start, see heap_colours in AfMallocOptions
+  std::size_t colour_offset{0};
+  // large mappings of the REGION mode are linked into AfArena::region_large_heaps_ through prev_heap and next_heap
+  AfHeap *next_heap{nullptr};
+};
+
+/**
+ * @return where the first chunk of the heap starts
+ */
+inline void *getFirstChunk(const AfHeap *heap) {
+  return static_cast<std::byte *>(heap->memory_start) + heap->colour_offset;
+}
+
+/**
+ * @param ptr chunk or user pointer which lives inside some heap
+ * @return header of the heap that owns ptr
+ */
+AfHeap *getHeapForChunk(const void *ptr);
+
+
+
+
+/**
+ * Counters of the arena lock, updated without holding the lock so they are atomics
+ */
+struct AfArenaLockCounters {
+  // every time the lock is taken
+  std::atomic<std::size_t> acquisitions{0};
+
+  // try_lock found the lock taken by some other thread
+  std::atomic<std::size_t> try_lock_failures{0};
+
+  // total nanoseconds spent blocked on the lock
+  std::atomic<std::size_t> wait_ns{0};
+};
+
+/**
+ * Snapshot of the lock counters summed over the arenas
+ */
+struct AfLockStats {
+  std::size_t acquisitions{0};
+  std::size_t try_lock_failures{0};
+  // malloc found its arena locked and took some other free arena instead
+  std::size_t arena_switches{0};
+  // malloc or free had to block, since no arena could be taken with try_lock
+  std::size_t blocking_waits{0};
+  std::size_t wait_ns{0};
+};
+
+///////// Slab tier for tiny allocations
+
+// Allocations up to this size go to slab pages, when the allocator uses Slabs
+constexpr std::size_t SLAB_MAX_SIZE = 64;
+constexpr std::size_t SLAB_PAGE_SIZE = 4096;
+// Table generated by af_size_class_profiler --alignment 16 --max-size 64 --name AF_SLAB_SIZE_CLASSES replaces
+// the default classes, when its path is given with the AFMALLOC_SLAB_CLASSES_HEADER cache variable of CMake
+#ifdef AFMALLOC_SLAB_CLASSES_HEADER
+#include AFMALLOC_SLAB_CLASSES_HEADER
+constexpr auto SLAB_SIZE_CLASSES = AF_SLAB_SIZE_CLASSES;
+#else
+constexpr std::array<std::size_t, 5> SLAB_SIZE_CLASSES{8, 16, 32, 48, 64};
+#endif
+constexpr std::size_t NUM_SLAB_CLASSES = SLAB_SIZE_CLASSES.size();
+
+static_assert(SLAB_SIZE_CLASSES.back() == SLAB_MAX_SIZE, "biggest slab class must take every size up to SLAB_MAX_SIZE");
+static_assert(std::ranges::is_sorted(SLAB_SIZE_CLASSES) && std::ranges::all_of(SLAB_SIZE_CLASSES, [](std::size_t size) {
+  // free object holds the pointer to the next one, and objects of ALIGNMENT or more keep the alignment malloc promises
+  return size >= sizeof(void *) && size % sizeof(void *) == 0 && (size < ALIGNMENT || size % ALIGNMENT == 0);
+}), "slab classes must be multiples of ALIGNMENT from ALIGNMENT on, generate the table with --alignment 16");
+
+/**
+ * Header at the start of every slab page, found from an object by masking its address with SLAB_PAGE_SIZE.
+ * Objects of the page have no header at all, a free object holds only the pointer to the next free object.
+ * Objects are carved lazily from bump_, so a fresh page is not touched past its header.
+ */
+struct AfSlabPage {
+  AfArena *arena;
+  // free list of objects which were already handed out once
+  void *free_list{nullptr};
+  // next never used object
+  void *bump{nullptr};
+  std::uint32_t object_size{0};
+  std::uint32_t size_class{0};
+  std::uint32_t used{0};
+  std::uint32_t capacity{0};
+  // pages of the same size class which have free objects
+  AfSlabPage *prev{nullptr};
+  AfSlabPage *next{nullptr};
+};
+
+// Objects start after the header, aligned as the chunks are
+constexpr std::size_t SLAB_PAGE_HEADER_SIZE = (sizeof(AfSlabPage) + ALIGNMENT - 1) & ~ALIGNMENT_MASK;
+
+/**
+ * How much work malloc did on the unsorted list
+ */
+struct AfUnsortedStats {
+  // the longest walk of a single malloc, in chunks
+  std::size_t max_walk{0};
+  // mallocs which stopped since they sorted the limit of chunks
+  std::size_t capped_walks{0};
+};
+
+// Free pages untouched for this long are given back to the OS by the purger
+constexpr std::chrono::milliseconds DEFAULT_DECAY_TIME{10'000};
+
+// How often the publisher thread writes the counters to the stats segment
+constexpr std::chrono::milliseconds DEFAULT_STATS_PUBLISH_INTERVAL{100};
+
+// Default of the maximum number of chunks one malloc moves from the unsorted list to the bins
+constexpr std::size_t DEFAULT_UNSORTED_SORT_LIMIT = 64;
+
+// Allocations which need more than this get their own mapping, by default only the ones which don't fit
+// a heap next to the header of the top chunk
+constexpr std::size_t DEFAULT_MMAP_THRESHOLD = MAX_HEAP_SIZE - 2 * SIZE_OF_SIZE;
+
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// Heaps are HEAP_MAX_SIZE aligned, so the first chunks of all the heaps would fall into the same cache sets.
+// First chunk of every new heap is moved by one more cache line, rotating over this many colours.
+constexpr std::size_t DEFAULT_HEAP_COLOURS = 32;
+
+// colours span at most a page, which covers all the sets of the L1 cache
+constexpr std::size_t MAX_HEAP_COLOURS = OS_PAGE_SIZE / CACHE_LINE_SIZE;
+
+/**
+ * Runtime tuning, read once from the AFMALLOC_OPTIONS environment variable and changed with afMallopt.
+ * Allocators take the options when they are constructed, except scrub and stats which are process wide switches.
+ *
+ * AFMALLOC_OPTIONS="arena_count:4,mmap_threshold:64k,trim_threshold:1m,unsorted_limit:32,decay_ms:1000,heap_colours:16,
+ *                   scrub:0,stats:1"
+ */
+struct AfMallocOptions {
+  // 0 picks the default for the arena selection
+  std::size_t arena_count{0};
+  std::size_t mmap_threshold{DEFAULT_MMAP_THRESHOLD};
+  // purger releases the pages after the top only if there are at least that many bytes of them
+  std::size_t trim_threshold{0};
+  std::size_t unsorted_sort_limit{DEFAULT_UNSORTED_SORT_LIMIT};
+  std::chrono::milliseconds decay_time{DEFAULT_DECAY_TIME};
+  // number of cache line offsets the first chunks of the new heaps rotate over, 0 or 1 turns colouring off
+  std::size_t heap_colours{DEFAULT_HEAP_COLOURS};
+  // only for the RuntimeScrub policy
+  bool scrub{true};
+  bool stats{true};
+};
+
+enum class AfMallocParam {
+  ARENA_COUNT,
+  MMAP_THRESHOLD,
+  TRIM_THRESHOLD,
+  UNSORTED_SORT_LIMIT,
+  DECAY_TIME_MS,
+  HEAP_COLOURS,
+  SCRUB,
+  STATS
+};
+
+/**
+ * Parses "key:value,key:value" options, values are decimal with an optional k, m or g suffix. Nothing is allocated,
+ * so this can run before the allocator is usable.
+ * @param options string to parse
+ * @param out options to update, stays as it was if the string is not valid
+ * @return false if some key is unknown or some value is not a number
+ */
+bool parseAfMallocOptions(const char *options, AfMallocOptions &out);
+
+/**
+ * @return false if the value is not valid for the parameter
+ */
+bool setAfMallocOption(AfMallocOptions &options, AfMallocParam param, std::size_t value);
+
+/**
+ * @return the process wide options, AFMALLOC_OPTIONS is parsed on the first call
+ */
+AfMallocOptions getAfMallocOptions();
+
+/**
+ * mallopt style tuning of the process wide options. Allocators constructed afterwards use the new value,
+ * scrub and stats switch right away.
+ * @return false if the value is not valid for the parameter
+ */
+bool afMallopt(AfMallocParam param, std::size_t value);
+
+bool isScrubEnabled();
+
+/**
+ * @return size of the mapping, header page included, for the chunk of needed_size mapped on its own
+ */
+std::size_t getLargeMappingSize(std::size_t needed_size);
+
+bool isStatsEnabled();
+
+/**
+ * How long the caller expects the allocation to live. Every lifetime gets heaps of its own, so a few long lived
+ * chunks don't stay in the middle of the short lived ones, where they would keep the top from coming back
+ * and the free space around them from coalescing.
+ */
+enum class AfLifetime {
+  // the default, allocations which are freed soon after
+  SHORT,
+  // outlive many of the short allocations made around them
+  LONG,
+  // freed only at the shutdown, if ever
+  PERMANENT,
+};
+
+// SHORT allocations use the arena itself, the other lifetimes have an arena each
+constexpr std::size_t NUM_LIFETIME_ARENAS = 2;
+
+inline thread_local AfLifetime thread_lifetime_hint{AfLifetime::SHORT};
+
+/**
+ * @return lifetime malloc uses when the caller does not pass one
+ */
+inline AfLifetime getLifetimeHint() {
+  return thread_lifetime_hint;
+}
+
+/**
+ * Sets the lifetime hint of the calling thread for its scope, the previous hint is restored at the end of the scope
+ */
+class AfLifetimeScope {
+  public:
+    explicit AfLifetimeScope(const AfLifetime lifetime) : previous_(thread_lifetime_hint) {
+      thread_lifetime_hint = lifetime;
+    }
+
+    AfLifetimeScope(const AfLifetimeScope &) = delete;
+    AfLifetimeScope &operator=(const AfLifetimeScope &) = delete;
+
+    ~AfLifetimeScope() {
+      thread_lifetime_hint = previous_;
+    }
+
+  private:
+    AfLifetime previous_;
+};
+
+/**
+ * Callbacks for the profilers and the accounting layer, shared by all the allocators of the process. A callback
+ * left null is not called. Hooks run on the allocating thread, so they must be thread safe and must not throw.
+ * Allocations made by the hook itself are not reported, so it may use the allocator it observes.
+ */
+struct AfMallocHooks {
+  // ptr of at least size bytes was handed out
+  void (*on_alloc)(void *context, void *ptr, std::size_t size){nullptr};
+  // ptr is about to be freed
+  void (*on_free)(void *context, void *ptr){nullptr};
+  // old_ptr was moved to new_ptr of at least size bytes, realloc reports only this, not its malloc and free
+  void (*on_realloc)(void *context, void *old_ptr, void *new_ptr, std::size_t size){nullptr};
+  void *context{nullptr};
+};
+
+// null while no hooks are installed. That is the only thing the allocation paths read when hooks are off,
+// and it is written only when hooks are installed or removed
+inline std::atomic<const AfMallocHooks *> installed_hooks{nullptr};
+
+inline thread_local bool thread_in_hook{false};
+
+/**
+ * Installs the hooks, replacing the previous ones. The hooks are copied to memory which is never freed,
+ * so a thread still calling the previous hooks does not read freed memory.
+ */
+void setAfMallocHooks(const AfMallocHooks &hooks);
+
+/**
+ * Removes the hooks, allocations which are already in a hook still finish it
+ */
+void clearAfMallocHooks();
+
+/**
+ * @return installed hooks, or null if there are none
+ */
+inline const AfMallocHooks *getAfMallocHooks() {
+  return installed_hooks.load(std::memory_order_acquire);
+}
+
+/**
+ * Hooks are not called on this thread while the outermost scope lives
+ */
+class AfHookScope {
+  public:
+    AfHookScope() : outermost_(!thread_in_hook) {
+      thread_in_hook = true;
+    }
+
+    AfHookScope(const AfHookScope &) = delete;
+    AfHookScope &operator=(const AfHookScope &) = delete;
+
+    ~AfHookScope() {
+      if(outermost_) {
+        thread_in_hook = false;
+      }
+    }
+
+    [[nodiscard]] bool isOutermost() const {
+      return outermost_;
+    }
+
+  private:
+    bool outermost_;
 };
 
+// called only when hooks are installed, kept out of line so the allocation paths stay small
+void reportAlloc(const AfMallocHooks &hooks, void *ptr, std::size_t size);
 
+void reportFree(const AfMallocHooks &hooks, void *ptr);
 
+void reportRealloc(const AfMallocHooks &hooks, void *old_ptr, void *new_ptr, std::size_t size);
 
 /**
  * Basic struct with arena. It contains free_size_ of the top chunk,
@@ -206,19 +541,37 @@ struct AfHeap {
  * Other structs include pointer to unsorted chunks, which in the first case when chunk is freed it is put
  * to that list of the unsorted_chunks, which speeds up free, and gives them the chance to be reused quickly.
  *
- * For the unsorted_chunks_ I am doing LIFO, whereas malloc does FIFO.
+ * For the unsorted_chunks_ the default is LIFO, whereas malloc does FIFO (see LIFO and FIFO policies).
  * FIFO should give the equal opportunity to each chunk to be reused, and then consolidated, thus reducing
  * fragmentation. LIFO is done only since I don't care here about fragmentation and such long lived programs.
  */
 struct AfArena{
 
-  explicit AfArena();
+  /**
+   * @param with_lifetime_arenas false for the lifetime arenas themselves
+   */
+  explicit AfArena(bool with_lifetime_arenas = true);
+
+  /**
+   * Makes all the bins, unsorted lists and bin indexes empty again
+   */
+  void clearBins();
 
   std::mutex arena_lock{};
 
+  AfArenaLockCounters lock_counters_{};
+
+  // malloc came here since the arena it picked was locked
+  std::atomic<std::size_t> arena_switches_{0};
+
+  std::atomic<std::size_t> blocking_waits_{0};
+
   // begin of arena
   void *begin_{nullptr};
 
+  // heap in which top_ currently lives, older heaps are reachable through prev_heap
+  AfHeap *heap_{nullptr};
+
   // beginning of the rest of the memory region
   // here the free region starts
   void *top_{nullptr};
@@ -233,11 +586,14 @@ struct AfArena{
 
   /**
    * Contains the list of unsorted chunks. List is populated on the free, and then on the malloc
-   * we put the chunk in the corresponding bin. We traverse this double linked list in LIFO order, which is
-   * different from what malloc does (FIFO). FIFO is better for giving chunks a chance to be reused.
+   * we put the chunk in the corresponding bin. The list is always traversed from the head, the unsorted order
+   * policy decides on which end freed chunks are inserted.
    */
   Chunk unsorted_chunks_{0, 0, nullptr, nullptr};
 
+  std::size_t max_unsorted_walk_{0};
+  std::size_t unsorted_capped_walks_{0};
+
   /**
    * Index list to help find if there are some free chunks there or not
    */
@@ -258,9 +614,57 @@ struct AfArena{
    */
   Chunk unsorted_large_chunks_{0, 0, nullptr, nullptr};
 
+  /**
+   * Slab tier: for every size class pages which have a free object, empty pages which can be taken by any class,
+   * and the heap from which new pages are cut
+   */
+  std::array<AfSlabPage *, NUM_SLAB_CLASSES> slab_partial_pages_{};
+  AfSlabPage *slab_empty_pages_{nullptr};
+  AfHeap *slab_heap_{nullptr};
+  void *slab_top_{nullptr};
+  std::size_t slab_allocated_size_{0};
+
+  /**
+   * Large mappings made in the REGION mode, arena_ptr of their heaps points here so reset can unmap them
+   */
+  AfHeap *region_large_heaps_{nullptr};
+
+  /**
+   * State of the purger: top_ and heap_ seen on the last pass, since when top_ did not move,
+   * and the address from which the pages after the top are already released (nullptr if none are)
+   */
+  AfHeap *purge_heap_{nullptr};
+  void *purge_top_{nullptr};
+  std::chrono::steady_clock::time_point purge_top_since_{};
+  void *purged_from_{nullptr};
 
+  /**
+   * Arenas for the LONG and PERMANENT allocations made through this arena. They have their own lock and heaps,
+   * and their chunks are freed to them through AfHeap::arena_ptr as any other chunk.
+   */
+  std::array<std::unique_ptr<AfArena>, NUM_LIFETIME_ARENAS> lifetime_arenas_{};
 };
 
+/**
+ * @return arena of the lifetime, the arena itself for SHORT
+ */
+inline AfArena &getLifetimeArena(AfArena &arena, const AfLifetime lifetime) {
+  return lifetime == AfLifetime::SHORT ? arena : *arena.lifetime_arenas_[static_cast<std::size_t>(lifetime) - 1];
+}
+
+/**
+ * Calls f for the arena and then for each of its lifetime arenas
+ */
+template <typename F>
+void forArenaAndLifetimeArenas(AfArena &arena, F &&f) {
+  f(arena);
+  for(auto &lifetime_arena: arena.lifetime_arenas_) {
+    if(lifetime_arena != nullptr) {
+      f(*lifetime_arena);
+    }
+  }
+}
+
 // Strong type for Chunk*
 struct ListHead {
   //explicit ListHead(Chunk *list_head) : list_head_(list_head) {}
@@ -291,16 +695,518 @@ bool hasElementsInList(const Chunk &list_head);
 
 void unlinkChunk(Chunk* chunk);
 
+std::size_t getAlignmentSize(void* ptr, std::size_t alignment);
+
+std::size_t getMaxFastBinBitIndex();
+
+std::size_t getMaxSmallBinBitIndex();
+
+/**
+ * Zeroes the user data of the chunk, header is left as it is
+ */
+void clearUpDataSpaceOfChunk(Chunk *chunk);
+
+/**
+ * Chunk is handed out to the user, so the chunk after it must not think any more that we are free
+ * @param chunk chunk which is already unlinked from the free lists
+ */
+void markChunkInUse(Chunk *chunk);
+
+
+/**
+ * GENERAL is the usual malloc behaviour.
+ * In the REGION mode all the allocations die together on AfMalloc::reset. Free only makes the chunk
+ * reusable, chunks are neither coalesced nor scrubbed.
+ */
+enum class AfMallocMode {
+  GENERAL,
+  REGION,
+};
+
+/**
+ * How malloc picks the arena to allocate from.
+ * THREAD gives each thread its own arena, threads share arenas round-robin once there are more threads than arenas.
+ * CPU picks the arena of the CPU thread is running on, so memory is bounded by the number of cores
+ * instead of the number of threads.
+ */
+enum class ArenaSelection {
+  THREAD,
+  CPU,
+};
+
+// Default number of thread affine arenas, same as glibc on 64-bit systems
+constexpr std::size_t ARENAS_PER_CORE = 8;
+
+/**
+ * @return CPU the calling thread runs on. Read from rseq area if the kernel supports it, otherwise from sched_getcpu.
+ */
+std::size_t getCurrentCpu();
+
+/**
+ * @return true if the allocation of size bytes is served from the slab pages
+ */
+inline bool isSlabSize(std::size_t size) {
+  return size <= SLAB_MAX_SIZE;
+}
+
+inline AfSlabPage *getSlabPage(const void *ptr) {
+  return reinterpret_cast<AfSlabPage *>(reinterpret_cast<uintptr_t>(ptr) & ~(SLAB_PAGE_SIZE - 1));
+}
+
+/**
+ * Takes an object of the size class of size from the slab pages of the arena, caller holds the arena lock
+ * @param map_heap maps a new heap when the slab heap of the arena has no more pages
+ * @return nullptr if there is no more memory
+ */
+void *mallocFromSlab(AfArena &arena, std::size_t size, void *(*map_heap)());
+
+/**
+ * Gives the object back to its page, caller holds the lock of the arena of the page
+ */
+void freeToSlab(void *ptr);
+
+/**
+ * Unmaps all the slab heaps of the arena and forgets all the slab pages
+ */
+void releaseSlabHeaps(AfArena &arena, void (*unmap_heap)(AfHeap *));
+
+/**
+ * Puts the large mapping on the list of the arena and makes arena_ptr of the heap point to the arena,
+ * caller holds the lock of the arena
+ */
+void linkRegionLargeHeap(AfArena &arena, AfHeap *heap);
+
+/**
+ * Takes the large mapping off the list of its arena, caller holds the lock of the arena
+ */
+void unlinkRegionLargeHeap(AfArena &arena, AfHeap *heap);
+
+/**
+ * Takes the arena lock, blocking only if try_lock fails, and updates the lock counters of the arena
+ */
+std::unique_lock<std::mutex> lockArenaCounted(AfArena &arena);
+
+/**
+ * Takes the lock only if it is free right now, a failure is counted in the lock counters of the arena
+ */
+std::unique_lock<std::mutex> tryLockArenaCounted(AfArena &arena);
 
 
 
-class AfMalloc{
+///////// Deferred free
+
+// Pointers one thread can have waiting for the drain, power of two
+constexpr std::size_t DEFERRED_FREE_BUFFER_SIZE = 1024;
+
+// Pointers handed to freeBatch at once by the drain
+constexpr std::size_t DEFERRED_FREE_DRAIN_BATCH = 64;
+
+// How often the drainer thread looks for deferred frees when it found none the last time
+constexpr std::chrono::microseconds DEFAULT_DEFERRED_FREE_INTERVAL{100};
+
+/**
+ * Single producer single consumer ring of pointers waiting to be freed. Only the owning thread pushes,
+ * and only the one drain which holds the drain lock pops.
+ */
+class AfDeferredFreeBuffer {
+  public:
+    /**
+     * @return false if the buffer is full
+     */
+    bool push(void *ptr) {
+      const std::size_t head = head_.load(std::memory_order_relaxed);
+      if(head - tail_.load(std::memory_order_acquire) == DEFERRED_FREE_BUFFER_SIZE) {
+        return false;
+      }
+      ptrs_[head & (DEFERRED_FREE_BUFFER_SIZE - 1)] = ptr;
+      head_.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @return number of pointers moved to out, at most max
+     */
+    std::size_t pop(void **out, std::size_t max) {
+      const std::size_t tail = tail_.load(std::memory_order_relaxed);
+      const std::size_t count = std::min(head_.load(std::memory_order_acquire) - tail, max);
+      for(std::size_t i{0}; i < count; i++) {
+        out[i] = ptrs_[(tail + i) & (DEFERRED_FREE_BUFFER_SIZE - 1)];
+      }
+      tail_.store(tail + count, std::memory_order_release);
+      return count;
+    }
+
+  private:
+    static_assert(std::has_single_bit(DEFERRED_FREE_BUFFER_SIZE));
+
+    std::array<void *, DEFERRED_FREE_BUFFER_SIZE> ptrs_{};
+    // owner and drain write on separate cache lines
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+};
+
+/**
+ * Deferred free buffers of one allocator, one for every thread which ever deferred a free
+ */
+class AfDeferredFrees {
+  public:
+    AfDeferredFrees();
+
+    /**
+     * Puts the pointer into the buffer of the calling thread, the first call of a thread registers its buffer
+     * @return false if the buffer is full
+     */
+    bool push(void *ptr);
+
+    /**
+     * Pops every buffer and hands the pointers to free_batch, in batches of DEFERRED_FREE_DRAIN_BATCH
+     * @param free_batch callable taking (void **ptrs, std::size_t count)
+     * @return number of pointers freed
+     */
+    template <typename F>
+    std::size_t drain(F &&free_batch) {
+      std::lock_guard drain_lock{drain_lock_};
+      {
+        // buffers are never removed, so those registered later are simply drained the next time
+        std::lock_guard lock{buffers_lock_};
+        drain_snapshot_.assign(buffers_.begin(), buffers_.end());
+      }
+      std::array<void *, DEFERRED_FREE_DRAIN_BATCH> batch{};
+      std::size_t drained{0};
+      for(AfDeferredFreeBuffer *buffer: drain_snapshot_) {
+        while(const std::size_t count = buffer->pop(batch.data(), batch.size())) {
+          free_batch(batch.data(), count);
+          drained += count;
+        }
+      }
+      return drained;
+    }
+
+    /**
+     * @return number of pushes which found the buffer full
+     */
+    [[nodiscard]] std::size_t getOverflows() const {
+      return overflows_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    AfDeferredFreeBuffer *getThreadBuffer();
+
+    // distinguishes instances in the thread local cache of the buffer
+    std::size_t instance_id_{0};
+    std::atomic<std::size_t> overflows_{0};
+
+    std::mutex buffers_lock_{};
+    std::unordered_map<std::thread::id, AfDeferredFreeBuffer *> thread_buffers_{};
+    std::vector<AfDeferredFreeBuffer *> buffers_{};
+    std::vector<std::unique_ptr<AfDeferredFreeBuffer>> owned_buffers_{};
+
+    std::mutex drain_lock_{};
+    std::vector<AfDeferredFreeBuffer *> drain_snapshot_{};
+};
+
+///////// Policies of BasicAfMalloc
+
+///// Threading policies: own the arenas, pick the arena for the calling thread and lock it
+
+/**
+ * Lock which does nothing, for the single threaded use
+ */
+struct NullLock {};
+
+/**
+ * Only one thread ever uses the allocator. There is only the main arena and it is never locked,
+ * so no locking cost is paid anywhere.
+ */
+class SingleThreaded {
+  public:
+    using Lock = NullLock;
+
+    [[nodiscard]] std::size_t getArenaCount() const {
+      return 1;
+    }
+
+  protected:
+    static Lock lockArena(AfArena &) {
+      return {};
+    }
+
+    void initArenas(AfArena *main_arena, ArenaSelection, std::size_t) {
+      main_arena_ = main_arena;
+    }
+
+    AfArena *lockSelectedArena(Lock &) {
+      return main_arena_;
+    }
+
+    template <typename F>
+    void forEachArena(F &&f) {
+      forArenaAndLifetimeArenas(*main_arena_, f);
+    }
+
+    ~SingleThreaded() = default;
+
+  private:
+    AfArena *main_arena_{nullptr};
+};
+
+/**
+ * Fixed number of arenas, each one behind its own mutex. Arenas are picked according to the ArenaSelection,
+ * and all of them are created upfront so picking one is only an index.
+ */
+class ArenaLocked {
+  public:
+    using Lock = std::unique_lock<std::mutex>;
+
+    [[nodiscard]] std::size_t getArenaCount() const {
+      return arenas_.size();
+    }
+
+  protected:
+    static Lock lockArena(AfArena &arena) {
+      return lockArenaCounted(arena);
+    }
+
+    /**
+     * @param arena_count number of arenas, 0 picks the default for the arena selection
+     */
+    void initArenas(AfArena *main_arena, ArenaSelection arena_selection, std::size_t arena_count);
+
+    /**
+     * Picks the arena of the calling thread and locks it. If the arena is locked by some other thread, the
+     * following arenas are tried with try_lock, same as glibc arena_get2 does, and only if all of them
+     * are locked we block on the picked one.
+     * @param lock receives the lock of the returned arena
+     */
+    AfArena *lockSelectedArena(Lock &lock);
+
+    template <typename F>
+    void forEachArena(F &&f) {
+      for(AfArena *arena: arenas_) {
+        forArenaAndLifetimeArenas(*arena, f);
+      }
+    }
+
+    ~ArenaLocked() = default;
+
+  private:
+    std::size_t selectArenaIndex() const;
+
+    ArenaSelection arena_selection_{ArenaSelection::THREAD};
+
+    // all the arenas including the main one, never changes after the construction
+    std::vector<AfArena *> arenas_{};
+    std::vector<std::unique_ptr<AfArena>> owned_arenas_{};
+};
+
+/**
+ * Every thread gets an arena of its own on its first allocation, arenas are never shared between threads.
+ * Arena is still locked, since a chunk can be freed from some other thread, but the lock is uncontended otherwise.
+ */
+class PerThread {
+  public:
+    using Lock = std::unique_lock<std::mutex>;
+
+    [[nodiscard]] std::size_t getArenaCount() const;
+
+  protected:
+    static Lock lockArena(AfArena &arena) {
+      return lockArenaCounted(arena);
+    }
+
+    void initArenas(AfArena *main_arena, ArenaSelection, std::size_t);
+
+    /**
+     * Thread always stays on its own arena, the lock can only be contended by frees from other threads
+     */
+    AfArena *lockSelectedArena(Lock &lock) {
+      AfArena *arena = selectArena();
+      lock = lockArena(*arena);
+      return arena;
+    }
+
+    template <typename F>
+    void forEachArena(F &&f) {
+      std::lock_guard lock{arenas_lock_};
+      for(AfArena *arena: arenas_) {
+        forArenaAndLifetimeArenas(*arena, f);
+      }
+    }
+
+    ~PerThread() = default;
+
+  private:
+    AfArena *selectArena();
+
+    // distinguishes instances in the thread local cache of the arena
+    std::size_t instance_id_{0};
+
+    mutable std::mutex arenas_lock_{};
+    std::unordered_map<std::thread::id, AfArena *> thread_arenas_{};
+    std::vector<AfArena *> arenas_{};
+    std::vector<std::unique_ptr<AfArena>> owned_arenas_{};
+};
+
+///// Unsorted order policies: where the freed chunk goes into the unsorted list, which is traversed from the head
+
+/**
+ * Freed chunk goes to the head of the list, so the most recently freed chunk is reused first
+ */
+struct LIFO {
+  protected:
+    static void insertUnsorted(Chunk &head, Chunk *free_chunk);
+};
+
+/**
+ * Freed chunk goes to the tail of the list, so every chunk gets the same chance to be reused, same as malloc does
+ */
+struct FIFO {
+  protected:
+    static void insertUnsorted(Chunk &head, Chunk *free_chunk);
+};
+
+///// Scrub policies: what is done with the memory of the freed chunk
+
+/**
+ * Data of the freed chunk is zeroed, so memory handed out is always zeroed too
+ */
+struct ZeroScrub {
+  protected:
+    static void scrubChunk(Chunk *chunk) {
+      clearUpDataSpaceOfChunk(chunk);
+    }
+
+    // freed memory is already zero, so the header of the top is clean
+    static void scrubTopHeader(void *) {}
+
+    static void scrubObject(void *ptr, std::size_t size) {
+      memset(ptr, 0, size);
+    }
+};
+
+/**
+ * Freed chunk is left as it is. Only the header of the top chunk is cleared when top moves, as
+ * coalescing with the top reads it.
+ */
+struct NoScrub {
+  protected:
+    static void scrubChunk(Chunk *) {}
+
+    static void scrubTopHeader(void *top);
+
+    static void scrubObject(void *, std::size_t) {}
+};
+
+/**
+ * ZeroScrub or NoScrub, switched at runtime with the scrub option
+ */
+struct RuntimeScrub : NoScrub {
+  protected:
+    static void scrubChunk(Chunk *chunk) {
+      if(isScrubEnabled()) {
+        clearUpDataSpaceOfChunk(chunk);
+      }
+    }
+
+    // freed memory may not be zero, so the header of the top is cleared always as NoScrub does
+
+    static void scrubObject(void *ptr, std::size_t size) {
+      if(isScrubEnabled()) {
+        memset(ptr, 0, size);
+      }
+    }
+};
+
+///// Tiny allocation policies: whether the allocations up to SLAB_MAX_SIZE go to the headerless slab pages
+
+/**
+ * Every allocation is a chunk with its header
+ */
+struct NoSlabs {
+  protected:
+    static constexpr bool USES_SLABS = false;
+};
+
+/**
+ * Allocations up to SLAB_MAX_SIZE come from slab pages, without the chunk header and the CHUNK_SIZE minimum
+ */
+struct Slabs {
+  protected:
+    static constexpr bool USES_SLABS = true;
+};
+
+///// Page source policies: where the memory of the heaps comes from
+
+/**
+ * Heaps are mmapped and populated right away
+ */
+struct MmapPageSource {
+  protected:
+    /**
+     * @return HEAP_HEADER_SIZE + HEAP_MAX_SIZE bytes, where memory after the header page is HEAP_MAX_SIZE aligned,
+     * or nullptr if there is no memory
+     */
+    static void *mapHeap();
+
+    static void unmapHeap(AfHeap *heap);
+
+    static void releasePages(void *start, std::size_t size);
+
+    /**
+     * Maps one large chunk in the same layout as the heap, so the header is found by masking the address
+     * @param size size of the chunk
+     * @return start of the header page, or nullptr if there is no memory
+     */
+    static void *mapLarge(std::size_t size);
+
+    static void unmapLarge(AfHeap *heap);
+};
+
+/**
+ * Same as MmapPageSource, but pages are faulted in on the first touch only
+ */
+struct LazyMmapPageSource : MmapPageSource {
+  protected:
+    static void *mapHeap();
+};
+
+
+/**
+ * Allocator, configured with policies:
+ *  - ThreadingPolicy: SingleThreaded, ArenaLocked or PerThread
+ *  - UnsortedOrderPolicy: LIFO or FIFO
+ *  - ScrubPolicy: ZeroScrub, NoScrub or RuntimeScrub
+ *  - PageSourcePolicy: MmapPageSource or LazyMmapPageSource
+ *  - TinyAllocationPolicy: NoSlabs or Slabs
+ */
+template <typename ThreadingPolicy = ArenaLocked,
+          typename UnsortedOrderPolicy = LIFO,
+          typename ScrubPolicy = RuntimeScrub,
+          typename PageSourcePolicy = MmapPageSource,
+          typename TinyAllocationPolicy = NoSlabs
+          >
+class BasicAfMalloc : public ThreadingPolicy, public UnsortedOrderPolicy, public ScrubPolicy, public PageSourcePolicy,
+                      public TinyAllocationPolicy {
+
+    using TP = ThreadingPolicy;
+    using OP = UnsortedOrderPolicy;
+    using SP = ScrubPolicy;
+    using PP = PageSourcePolicy;
+    using TA = TinyAllocationPolicy;
 
   // struct which holds arena
   public:
-    explicit AfMalloc();
+    explicit BasicAfMalloc();
+
+    /**
+     * @param arena_count number of arenas, 0 picks the default for the arena selection
+     */
+    explicit BasicAfMalloc(bool track_pointers, AfMallocMode mode = AfMallocMode::GENERAL,
+                           ArenaSelection arena_selection = ArenaSelection::THREAD, std::size_t arena_count = 0);
+
+    explicit BasicAfMalloc(AfMallocMode mode);
 
-    explicit AfMalloc(bool track_pointers) ;
+    explicit BasicAfMalloc(ArenaSelection arena_selection, std::size_t arena_count = 0);
 
 
     /**
@@ -310,6 +1216,11 @@ class AfMalloc{
     */
     void *malloc(std::size_t size);
 
+    /**
+     * malloc from the heaps of the lifetime, instead of the lifetime hint of the calling thread
+     */
+    void *malloc(std::size_t size, AfLifetime lifetime);
+
   /**
    * Allocate with the user requested alignment, of at least size bytes
    * @param alignment
@@ -324,6 +1235,76 @@ class AfMalloc{
     */
     void free(void *p);
 
+    /**
+     * Resizes the allocation to size bytes. The chunk is kept if it is already big enough, otherwise the data
+     * is copied to a new allocation and the old one is freed.
+     * @param p pointer from this allocator, null behaves as malloc
+     * @param size 0 frees p and returns null
+     * @return null if there was no memory, p stays allocated then
+     */
+    void *realloc(void *p, std::size_t size);
+
+    /**
+     * @return number of bytes the user can use at p, at least the size it was allocated with
+     */
+    std::size_t getUsableSize(void *p);
+
+    /**
+     * Allocates `count` chunks of the same size while holding the arena lock only once.
+     * Chunks are first taken from the exact bin of the needed size, and the rest is carved
+     * from the top chunk in one pass.
+     * @param size size user needs for each of the pointers
+     * @param count number of pointers to allocate
+     * @param out_ptrs array of at least `count` elements which receives the pointers
+     * @return number of pointers allocated, less than `count` only if we ran out of memory
+     */
+    std::size_t mallocBatch(std::size_t size, std::size_t count, void **out_ptrs);
+
+    /**
+     * Frees `count` pointers. Pointers are sorted by address so that chunks of the same heap
+     * are freed together, and the lock of the owning arena is taken once per group.
+     * @param ptrs pointers to free, the array gets reordered
+     * @param count number of pointers in ptrs
+     */
+    void freeBatch(void **ptrs, std::size_t count);
+
+    /**
+     * Free for the latency critical threads: the pointer is only put into the lock free buffer of the calling
+     * thread, and freed later by drainDeferredFrees, either from the drainer thread or at a point the application
+     * picks. Only if the buffer is full, the pointer is freed right away.
+     */
+    void freeDeferred(void *p);
+
+    /**
+     * Frees everything deferred so far by all the threads, with freeBatch
+     * @return number of pointers freed
+     */
+    std::size_t drainDeferredFrees();
+
+    /**
+     * Starts the thread which drains the deferred frees, it sleeps for the interval only when it found nothing to drain
+     */
+    void startDeferredFreeDrainer(std::chrono::microseconds interval = DEFAULT_DEFERRED_FREE_INTERVAL);
+
+    /**
+     * Stops the drainer thread and waits for it, what is left in the buffers stays there
+     */
+    void stopDeferredFreeDrainer();
+
+    /**
+     * @return deferred frees which were done right away, since the buffer of the thread was full
+     */
+    [[nodiscard]] std::size_t getDeferredFreeOverflows() const {
+      return deferred_frees_.getOverflows();
+    }
+
+    /**
+     * Only for the REGION mode. Drops every allocation at once: all heaps but the first one and all the large
+     * mappings are unmapped, top_ is rewound to the beginning of the first heap and the bins are emptied. Chunks themselves are never visited.
+     * @param release_pages if true, pages of the first heap are given back to the OS too
+     */
+    void reset(bool release_pages = false);
+
     [[nodiscard]] std::size_t getFreeSize() const {
       return af_arena_.free_size_;
     }
@@ -340,6 +1321,70 @@ class AfMalloc{
       return af_arena_.begin_;
     }
 
+    /**
+     * @return sum of the allocated size over all arenas
+     */
+    std::size_t getTotalAllocatedSize();
+
+    /**
+     * Starts the background purger thread, which runs a purge pass every half of the decay time
+     * @param decay_time how long free pages stay untouched before they are given back to the OS
+     */
+    void startPurger(std::chrono::milliseconds decay_time);
+
+    /**
+     * Stops the purger thread and waits for it, does nothing if it is not running
+     */
+    void stopPurger();
+
+    /**
+     * One purge pass over all arenas, the same one the purger thread does. Pages after the top chunk which
+     * did not move for the decay time are released with madvise, and an arena which has nothing allocated
+     * for the decay time gets its heap unmapped.
+     * @return number of bytes given back to the OS
+     */
+    std::size_t purge();
+
+    void setDecayTime(std::chrono::milliseconds decay_time) {
+      decay_time_ = decay_time;
+    }
+
+    /**
+     * @return lock contention counters summed over all arenas
+     */
+    AfLockStats getLockStats();
+
+    /**
+     * @return the longest unsorted list walk over all arenas, and how many walks hit the limit
+     */
+    AfUnsortedStats getUnsortedStats();
+
+    /**
+     * @return counters of every arena, and the mapping and trimming counters of the allocator. Each arena
+     * is locked only while its own counters are copied.
+     */
+    AfStatsRecord getStatsRecord();
+
+    /**
+     * Starts the thread which publishes getStatsRecord to the stats segment of the process every interval,
+     * where afstat reads it. Only one allocator of the process can publish.
+     * @return false if the segment can't be created, for example since some other allocator publishes already
+     */
+    bool startStatsPublisher(std::chrono::milliseconds interval = DEFAULT_STATS_PUBLISH_INTERVAL);
+
+    /**
+     * Stops the publisher thread and removes the stats segment
+     */
+    void stopStatsPublisher();
+
+    /**
+     * @param limit maximum number of chunks a single malloc sorts from the unsorted list to the bins,
+     * chunks after that wait for the following mallocs. 0 means no limit.
+     */
+    void setUnsortedSortLimit(std::size_t limit) {
+      unsorted_sort_limit_ = limit;
+    }
+
 
     Chunk *getUnsortedChunks() {
       return &af_arena_.unsorted_chunks_;
@@ -372,7 +1417,7 @@ class AfMalloc{
       return insert_iter->second;
     }
 
-    ~AfMalloc();
+    ~BasicAfMalloc();
 
 
     void printArenasMemory() {}
@@ -381,37 +1426,124 @@ class AfMalloc{
 
   bool isBinBitIndexSet(std::size_t bin, std::size_t bit);
 
+  bool isBinBitIndexSet(const AfArena &arena, std::size_t bin, std::size_t bit) const;
+
   private:
       void init();
 
-      std::optional<void*> findChunkFromUnsortedFreeChunks(std::size_t size);
+      void nameArenaBins(AfArena &arena);
+
+      void resetArena(AfArena &arena, bool release_pages);
+
+      std::size_t purgeArena(AfArena &arena, std::chrono::steady_clock::time_point now);
+
+      /**
+       * @param needed_size chunk the heap is mapped for, colour of the heap leaves room for it
+       */
+      AfHeap *allocateNewHeap(AfArena &arena, std::size_t needed_size);
+
+      // picks the arena of the calling thread and locks the arena of the lifetime under it
+      AfArena *lockLifetimeArena(typename TP::Lock &lock, AfLifetime lifetime);
+
+      // public malloc and free without the hooks, for the paths which report on their own or not at all
+      void *mallocUnreported(std::size_t size, AfLifetime lifetime);
+
+      std::size_t mallocBatchUnreported(std::size_t size, std::size_t count, void **out_ptrs);
+
+      void freeUnreported(void *p);
+
+      void freeBatchUnreported(void **ptrs, std::size_t count);
+
+      // malloc and free without taking the arena lock, the caller holds it
+      void *mallocFromArena(AfArena &arena, std::size_t needed_size);
+
+      // maps a new heap for the top if needed_size does not fit into the current one
+      // @return false if the new heap could not be mapped
+      bool makeRoomInTop(AfArena &arena, std::size_t needed_size);
 
-      void moveChunkToCorrectBin(Chunk *current_chunk, std::size_t size);
+      // chunk in a mapping of its own, above the mmap threshold
+      void *mallocLarge(std::size_t needed_size);
 
-      void moveToUnsortedLargeChunks(Chunk *free_chunk);
+      void freeLarge(AfHeap *heap);
 
-      void moveToFastBinsChunks(Chunk *free_chunk, std::size_t bit_index);
+      // unmaps the large mappings the arena keeps in the REGION mode, the caller holds the arena lock
+      void freeRegionLargeHeaps(AfArena &arena);
 
-      void moveToSmallBinsChunks(Chunk *free_chunk, std::size_t bit_index);
+      void freeChunk(AfArena &arena, Chunk *free_chunk);
+
+      // gives the slab object back to its page, the caller holds the arena lock
+      void freeObject(void *p);
+
+      std::size_t takeFromBin(AfArena &arena, std::size_t needed_size, std::size_t count, void **out_ptrs);
+
+      std::size_t carveFromTop(AfArena &arena, std::size_t needed_size, std::size_t count, void **out_ptrs);
+
+      void moveToUnsortedChunks(AfArena &arena, Chunk *free_chunk);
+
+      void extendTopChunk(AfArena &arena);
+
+      std::optional<void*> findChunkFromUnsortedFreeChunks(AfArena &arena, std::size_t size);
+
+      void moveChunkToCorrectBin(AfArena &arena, Chunk *current_chunk, std::size_t size);
+
+      void moveToUnsortedLargeChunks(AfArena &arena, Chunk *free_chunk);
+
+      void moveToFastBinsChunks(AfArena &arena, Chunk *free_chunk, std::size_t bit_index);
+
+      void moveToSmallBinsChunks(AfArena &arena, Chunk *free_chunk, std::size_t bit_index);
       // removes this chunk from the list of free chunks
 
-      Chunk *tryFindFastBinChunk(std::size_t size);
+      Chunk *tryFindFastBinChunk(AfArena &arena, std::size_t size);
 
-      Chunk *tryFindSmallBinChunk(std::size_t size);
+      Chunk *tryFindSmallBinChunk(AfArena &arena, std::size_t size);
 
 
-      void setBinIndex(std::size_t bin, std::size_t bit);
+      void setBinIndex(AfArena &arena, std::size_t bin, std::size_t bit);
 
-      void unsetBitIndex(std::size_t bin, std::size_t bit);
+      void unsetBitIndex(AfArena &arena, std::size_t bin, std::size_t bit);
 
 
 
 
+      // main arena, the first thread to allocate uses this one
       AfArena af_arena_{};
 
       std::unordered_map<Chunk *, std::string> name_map_{};
       std::unordered_map<std::string, std::size_t> name_counter_{};
       bool track_pointers_{false};
+      AfMallocMode mode_{AfMallocMode::GENERAL};
+      std::size_t unsorted_sort_limit_{DEFAULT_UNSORTED_SORT_LIMIT};
+      std::size_t mmap_threshold_{DEFAULT_MMAP_THRESHOLD};
+      std::size_t trim_threshold_{0};
+      std::atomic<std::size_t> large_mapped_size_{0};
+      // counted only for the stats
+      std::atomic<std::size_t> large_maps_{0};
+      std::atomic<std::size_t> large_unmaps_{0};
+      std::atomic<std::size_t> heap_maps_{0};
+      std::atomic<std::size_t> trims_{0};
+      std::atomic<std::size_t> trimmed_size_{0};
+      std::size_t heap_colours_{DEFAULT_HEAP_COLOURS};
+      std::atomic<std::size_t> next_heap_colour_{0};
+
+      // background purger
+      std::atomic<std::chrono::milliseconds> decay_time_{DEFAULT_DECAY_TIME};
+      std::thread purger_thread_{};
+      std::mutex purger_lock_{};
+      std::condition_variable purger_cv_{};
+      bool purger_stop_{false};
+
+      AfDeferredFrees deferred_frees_{};
+      std::thread drainer_thread_{};
+      std::mutex drainer_lock_{};
+      std::condition_variable drainer_cv_{};
+      bool drainer_stop_{false};
+
+      std::thread publisher_thread_{};
+      std::mutex publisher_lock_{};
+      std::condition_variable publisher_cv_{};
+      bool publisher_stop_{false};
+      ArenaSelection arena_selection_{ArenaSelection::THREAD};
+      std::size_t arena_count_{0};
 
 };
 
@@ -422,3 +1554,11 @@ std::string dyna_print(std::string_view rt_fmt_str, Args&&... args)
 {
   return std::vformat(rt_fmt_str, std::make_format_args(args...));
 }
+
+#include "AfMallocImpl.hpp"
+
+// Default configuration, instantiated once in AfMalloc.cpp
+using AfMalloc = BasicAfMalloc<>;
+static_assert(std::is_same_v<AfMalloc, BasicAfMalloc<ArenaLocked, LIFO, RuntimeScrub, MmapPageSource, NoSlabs>>);
+
+extern template class BasicAfMalloc<ArenaLocked, LIFO, RuntimeScrub, MmapPageSource, NoSlabs>;
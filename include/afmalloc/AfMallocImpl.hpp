@@ -0,0 +1,1220 @@
+#pragma once
+// Definitions of the BasicAfMalloc members, included at the end of AfMalloc.hpp
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::moveToUnsortedLargeChunks(AfArena &arena, Chunk *free_chunk) {
+    Chunk *next_chunk = arena.unsorted_large_chunks_.getNext();
+
+    free_chunk->setNext(next_chunk);
+    next_chunk->setPrev(free_chunk);
+
+
+    free_chunk->setPrev(&arena.unsorted_large_chunks_);
+    arena.unsorted_large_chunks_.setNext(free_chunk);
+
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::moveToFastBinsChunks(AfArena &arena, Chunk *free_chunk, std::size_t bit_index) {
+    auto &fast_bin_head = arena.fast_chunks_[bit_index];
+    auto *next = fast_bin_head.getNext();
+    fast_bin_head.setNext(free_chunk);
+
+    free_chunk->setPrev(&fast_bin_head);
+    free_chunk->setNext(next);
+
+    next->setPrev(free_chunk);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::moveToSmallBinsChunks(AfArena &arena, Chunk *free_chunk, std::size_t bit_index) {
+    auto &small_bin_head = arena.small_chunks_[bit_index];
+    auto *next = small_bin_head.getNext();
+    small_bin_head.setNext(free_chunk);
+
+    free_chunk->setPrev(&small_bin_head);
+    free_chunk->setNext(next);
+
+    next->setPrev(free_chunk);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::extendTopChunk(){
+    extendTopChunk(af_arena_);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::extendTopChunk(AfArena &arena){
+    auto *top_chunk = static_cast<Chunk *>(arena.top_);
+    assert(top_chunk->isPrevFree());
+    Chunk *prev_chunk = moveToThePreviousChunk(top_chunk, top_chunk->getPrevSize());
+    assert(prev_chunk->getNext() == nullptr && prev_chunk->getPrev() == nullptr);
+    SP::scrubChunk(prev_chunk);
+    arena.free_size_ += top_chunk->getPrevSize();
+    // old top header is now in the middle of the top chunk, it must not leave stale flags behind
+    top_chunk->setPrevSize(0);
+    top_chunk->setSize(0);
+    arena.top_ = prev_chunk;
+    prev_chunk->unsetPrevFree();
+    prev_chunk->setSize(0);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+BasicAfMalloc<TP, OP, SP, PP, TA>::BasicAfMalloc() {
+    init();
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+BasicAfMalloc<TP, OP, SP, PP, TA>::BasicAfMalloc(bool track_pointers, AfMallocMode mode, ArenaSelection arena_selection, std::size_t arena_count)
+    : track_pointers_(track_pointers), mode_(mode), arena_selection_(arena_selection), arena_count_(arena_count) {
+    init();
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+BasicAfMalloc<TP, OP, SP, PP, TA>::BasicAfMalloc(AfMallocMode mode) : mode_(mode) {
+    init();
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+BasicAfMalloc<TP, OP, SP, PP, TA>::BasicAfMalloc(ArenaSelection arena_selection, std::size_t arena_count)
+    : arena_selection_(arena_selection), arena_count_(arena_count) {
+    init();
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::init() {
+    const AfMallocOptions options = getAfMallocOptions();
+    if(arena_count_ == 0) {
+        arena_count_ = options.arena_count;
+    }
+    unsorted_sort_limit_ = options.unsorted_sort_limit;
+    mmap_threshold_ = options.mmap_threshold;
+    trim_threshold_ = options.trim_threshold;
+    decay_time_ = options.decay_time;
+    heap_colours_ = options.heap_colours;
+
+    TP::initArenas(&af_arena_, arena_selection_, arena_count_);
+    if(track_pointers_) {
+        nameArenaBins(af_arena_);
+    }
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::nameArenaBins(AfArena &arena) {
+    std::ranges::for_each(arena.fast_chunks_, [this](Chunk &chunk) {
+        createPtrHumaneReadableName("fast_chunk_", &chunk);
+    });
+    std::ranges::for_each(arena.small_chunks_, [this](Chunk &chunk) {
+        createPtrHumaneReadableName("small_chunk_", &chunk);
+    });
+    createPtrHumaneReadableName("unsorted_large_chunks_", &arena.unsorted_large_chunks_);
+    createPtrHumaneReadableName("unsorted_chunks_", &arena.unsorted_chunks_);
+}
+
+
+// Once deallocation is done, we write to the next chunk that prev_size is our size current, and we write to
+// ourselves that we are not in use
+
+// That should enable merging of two chunks
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::free(void *p) {
+    if(const AfMallocHooks *hooks = getAfMallocHooks(); hooks != nullptr) [[unlikely]] {
+        reportFree(*hooks, p);
+    }
+    freeUnreported(p);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::freeUnreported(void *p) {
+
+    // TODO detect double free -> that should be easy?
+    auto *free_chunk = moveToThePreviousChunk(p, HEAD_OF_CHUNK_SIZE);
+    // we can get heap by doing aligning our chunk to HEAP_SIZE
+    // we know that each of our chunks in heap will be N*HEAP_SIZE + chunk_offset
+    AfHeap *heap = getHeapForChunk(p);
+    if(heap->mmapped_size != 0 && heap->arena_ptr == nullptr) {
+        freeLarge(heap);
+        return;
+    }
+    AfArena *arena = heap->arena_ptr;
+    [[maybe_unused]] auto lock = TP::lockArena(*arena);
+    if(heap->mmapped_size != 0) {
+        unlinkRegionLargeHeap(*arena, heap);
+        freeLarge(heap);
+        return;
+    }
+    if constexpr (TA::USES_SLABS) {
+        if(heap->is_slab_heap) {
+            freeObject(p);
+            return;
+        }
+    }
+    freeChunk(*arena, free_chunk);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::freeObject(void *p) {
+    SP::scrubObject(p, getSlabPage(p)->object_size);
+    freeToSlab(p);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::freeBatch(void **ptrs, std::size_t count) {
+    if(const AfMallocHooks *hooks = getAfMallocHooks(); hooks != nullptr) [[unlikely]] {
+        for(std::size_t i{0}; i < count; i++) {
+            reportFree(*hooks, ptrs[i]);
+        }
+    }
+    freeBatchUnreported(ptrs, count);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::freeBatchUnreported(void **ptrs, std::size_t count) {
+    // Sorting puts chunks of the same heap, and therefore of the same arena, next to each other.
+    // As a bonus, neighbouring chunks are freed one after the other which makes coalescing cheap.
+    std::sort(ptrs, ptrs + count);
+
+    typename TP::Lock lock{};
+    AfArena *locked_arena{nullptr};
+    for(std::size_t i{0}; i < count; i++) {
+        auto *free_chunk = moveToThePreviousChunk(ptrs[i], HEAD_OF_CHUNK_SIZE);
+        AfHeap *heap = getHeapForChunk(ptrs[i]);
+        if(heap->mmapped_size != 0 && heap->arena_ptr == nullptr) {
+            freeLarge(heap);
+            continue;
+        }
+        AfArena *arena = heap->arena_ptr;
+        if(arena != locked_arena) {
+            // heaps of different arenas interleave in the address space, so sorted pointers are no lock order:
+            // the lock of one arena is released before the next one is taken
+            lock = {};
+            lock = TP::lockArena(*arena);
+            locked_arena = arena;
+        }
+        if(heap->mmapped_size != 0) {
+            unlinkRegionLargeHeap(*arena, heap);
+            freeLarge(heap);
+            continue;
+        }
+        if constexpr (TA::USES_SLABS) {
+            if(heap->is_slab_heap) {
+                freeObject(ptrs[i]);
+                continue;
+            }
+        }
+        freeChunk(*arena, free_chunk);
+    }
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::freeDeferred(void *p) {
+    // reported now, the application is done with the pointer even if it stays in the buffer for a while
+    if(const AfMallocHooks *hooks = getAfMallocHooks(); hooks != nullptr) [[unlikely]] {
+        reportFree(*hooks, p);
+    }
+    if(!deferred_frees_.push(p)) {
+        freeUnreported(p);
+    }
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::drainDeferredFrees() {
+    return deferred_frees_.drain([this](void **ptrs, const std::size_t count) {
+        freeBatchUnreported(ptrs, count);
+    });
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::startDeferredFreeDrainer(const std::chrono::microseconds interval) {
+    static_assert(!std::is_same_v<TP, SingleThreaded>, "drainer thread needs arenas which are locked");
+    stopDeferredFreeDrainer();
+    drainer_stop_ = false;
+    drainer_thread_ = std::thread{[this, interval]() {
+        std::unique_lock lock{drainer_lock_};
+        while(!drainer_stop_) {
+            lock.unlock();
+            const std::size_t drained = drainDeferredFrees();
+            lock.lock();
+            if(drained == 0) {
+                drainer_cv_.wait_for(lock, interval, [this]() { return drainer_stop_; });
+            }
+        }
+    }};
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::stopDeferredFreeDrainer() {
+    if(!drainer_thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard lock{drainer_lock_};
+        drainer_stop_ = true;
+    }
+    drainer_cv_.notify_one();
+    drainer_thread_.join();
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::freeChunk(AfArena &arena, Chunk *free_chunk) {
+    if(mode_ == AfMallocMode::REGION) {
+        // Neighbours don't get to know that we are free, so nothing ever gets coalesced with this chunk
+        moveToUnsortedChunks(arena, free_chunk);
+        return;
+    }
+    /**
+     * If chunk next to the top chunk is free, then we extend top chunk. That is why we never have
+     * inside the top chunk the prev_size or isPrevFree set inside the size although there is enough space for that
+    */
+    SP::scrubChunk(free_chunk);
+
+    // Here we want to check if the chunk in the physical memory before us has actually
+    // been freed. If so, we can try to merge those two
+    if(free_chunk->isPrevFree() && isChunkCoalescable(*free_chunk)) {
+        // previous chunk is free, we need to merge them
+        std::size_t prev_size = free_chunk->getPrevSize();
+
+        /// Then we need to go to that place in the memory
+        auto *chunk_before = moveToThePreviousChunk(free_chunk, prev_size);
+        // if we don't do this here, then we will later have a problem
+        // with merging two chunks and iterating over free chunks because of zeroing of memory
+
+        unlinkChunk(chunk_before);
+        //std::destroy_at<Chunk>(chunk_before);
+
+        chunk_before->setSize( prev_size + free_chunk->getSize());
+        free_chunk = chunk_before;
+        SP::scrubChunk(free_chunk);
+    }
+
+    auto *next_chunk = moveToTheNextChunk(free_chunk, free_chunk->getSize());
+    // Our chunk is not free until now. It can't be as we are only merging it now.
+    assert(!next_chunk->isPrevFree());
+
+    // This works even if we are at the at top, as on the top chunk we don't write size
+    Chunk *chunk_two_hops_in_front =  moveToTheNextChunk(next_chunk, next_chunk->getSize());
+
+    // if the next_chunk is free, we will merge the `freeChunk` and the `nextChunk`
+    // otherwise `nextChunk` is allocated, and we can't merge these two
+    if(chunk_two_hops_in_front->isPrevFree() && isChunkCoalescable(*free_chunk)) {
+        // nextChunk is free so we need to merge that one too
+        free_chunk->setSize(free_chunk->getSize() + next_chunk->getSize());
+
+        unlinkChunk(next_chunk);
+        // TODO add destroy at
+        //std::destroy_at<Chunk>(next_chunk);
+
+        SP::scrubChunk(free_chunk);
+        chunk_two_hops_in_front->setPrevFree();
+        chunk_two_hops_in_front->setPrevSize(free_chunk->getSize());
+    }
+    // when the nextChunk is free, if chunkTwoHopsInFront was free, it would be merged in the step before.
+    // This way we know that our chunk is free, and only one step around us can be free
+
+    // We need to find where is the next chunk, as we might have merged it in the step before
+    next_chunk = moveToTheNextChunk(free_chunk, free_chunk->getSize());
+
+    // Top chunk of the heap which is not the newest one anymore is never extended again. Its header
+    // stays with size 0 and works as a fence behind the last chunk of that heap.
+    if(next_chunk != arena.top_) {
+        // Set that our chunk is free, only if it is not fast chunk.
+        // By not setting it for the fast chunk, we disable coalasceing for the fast chunks
+        if(isChunkCoalescable(*free_chunk)) {
+            // Set on the next that chunk before is free
+            next_chunk->setPrevFree();
+            next_chunk->setPrevSize(free_chunk->getSize());
+        }else {
+            // this is needed for force coalescing of fast chunks later
+            next_chunk->setPrevSize(free_chunk->getSize());
+        }
+    }else {
+        if(isChunkCoalescable(*free_chunk)) {
+            // in this part of code we extend top to the free_chunk
+            // this means we can't add free chunk to the free list
+            static_cast<Chunk*>(arena.top_)->setPrevFree();
+            static_cast<Chunk*>(arena.top_)->setPrevSize(free_chunk->getSize());
+            // here we should actually merge our chunk with the top, and that way we have extended the unlimited free chunk
+            extendTopChunk(arena);
+            // We have extended the top, the rest of the code deals with adding the chunk to the unsorted chunks
+            return;
+        }else {
+            static_cast<Chunk*>(arena.top_)->setPrevSize(free_chunk->getSize());
+        }
+    }
+
+    moveToUnsortedChunks(arena, free_chunk);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::moveToUnsortedChunks(AfArena &arena, Chunk *free_chunk) {
+    OP::insertUnsorted(arena.unsorted_chunks_, free_chunk);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::reset(const bool release_pages) {
+    assert(mode_ == AfMallocMode::REGION);
+    TP::forEachArena([this, release_pages](AfArena &arena) {
+        resetArena(arena, release_pages);
+    });
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::resetArena(AfArena &arena, const bool release_pages) {
+    [[maybe_unused]] auto lock = TP::lockArena(arena);
+    freeRegionLargeHeaps(arena);
+    releaseSlabHeaps(arena, &PP::unmapHeap);
+    if(arena.heap_ == nullptr) {
+        return;
+    }
+
+    AfHeap *heap = arena.heap_;
+    while(heap->prev_heap != nullptr) {
+        AfHeap *prev_heap = heap->prev_heap;
+        PP::unmapHeap(heap);
+        heap = prev_heap;
+    }
+    // Freed chunks were never scrubbed, so the old content stays unless we drop the pages.
+    // This is fine as in the region mode nobody looks at the neighbours of a chunk.
+    if(release_pages) {
+        PP::releasePages(heap->memory_start, HEAP_MAX_SIZE);
+    }
+    arena.heap_ = heap;
+    arena.top_ = getFirstChunk(heap);
+    arena.allocated_size_ = MAX_HEAP_SIZE;
+    arena.free_size_ = MAX_HEAP_SIZE - heap->colour_offset;
+    auto *top_chunk = static_cast<Chunk *>(arena.top_);
+    top_chunk->setPrevSize(0);
+    top_chunk->setSize(0);
+
+    arena.clearBins();
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::startPurger(const std::chrono::milliseconds decay_time) {
+    static_assert(!std::is_same_v<TP, SingleThreaded>, "purger thread needs arenas which are locked");
+    stopPurger();
+    decay_time_ = decay_time;
+    purger_stop_ = false;
+    purger_thread_ = std::thread{[this]() {
+        std::unique_lock lock{purger_lock_};
+        while(!purger_stop_) {
+            purger_cv_.wait_for(lock, std::max(decay_time_.load() / 2, std::chrono::milliseconds{1}),
+                                [this]() { return purger_stop_; });
+            if(!purger_stop_) {
+                // allocating threads never wait for the purger lock, so the pass can run under it
+                purge();
+            }
+        }
+    }};
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::stopPurger() {
+    if(!purger_thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard lock{purger_lock_};
+        purger_stop_ = true;
+    }
+    purger_cv_.notify_one();
+    purger_thread_.join();
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::purge() {
+    const auto now = std::chrono::steady_clock::now();
+    std::size_t released{0};
+    TP::forEachArena([this, now, &released](AfArena &arena) {
+        if(const std::size_t arena_released = purgeArena(arena, now); arena_released != 0) {
+            trims_.fetch_add(1, std::memory_order_relaxed);
+            trimmed_size_.fetch_add(arena_released, std::memory_order_relaxed);
+            released += arena_released;
+        }
+    });
+    return released;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::purgeArena(AfArena &arena, const std::chrono::steady_clock::time_point now) {
+    [[maybe_unused]] auto lock = TP::lockArena(arena);
+    if(arena.heap_ == nullptr || mode_ == AfMallocMode::REGION) {
+        return 0;
+    }
+    if(arena.heap_ != arena.purge_heap_ || arena.top_ != arena.purge_top_) {
+        // top moved since the last pass. If it went up, pages we released before are in use again.
+        if(arena.heap_ != arena.purge_heap_ || (arena.purged_from_ != nullptr && arena.top_ >= arena.purged_from_)) {
+            arena.purged_from_ = nullptr;
+        }
+        arena.purge_heap_ = arena.heap_;
+        arena.purge_top_ = arena.top_;
+        arena.purge_top_since_ = now;
+    }
+    if(now - arena.purge_top_since_ < decay_time_.load()) {
+        return 0;
+    }
+
+    AfHeap *heap = arena.heap_;
+    void *heap_end = moveToTheNextPlaceInMem(heap->memory_start, HEAP_MAX_SIZE);
+    // nothing is allocated in the arena, so it is idle and the whole heap goes back
+    if(heap->prev_heap == nullptr && arena.top_ == getFirstChunk(heap)) {
+        PP::unmapHeap(heap);
+        arena.heap_ = nullptr;
+        arena.begin_ = nullptr;
+        arena.top_ = nullptr;
+        arena.allocated_size_ = 0;
+        arena.free_size_ = 0;
+        arena.purge_heap_ = nullptr;
+        arena.purge_top_ = nullptr;
+        arena.purged_from_ = nullptr;
+        return HEAP_HEADER_SIZE + HEAP_MAX_SIZE;
+    }
+
+    // header of the top chunk stays, everything after it up to what is already released goes
+    void *dirty_begin = moveToTheNextPlaceInMem(arena.top_, HEAD_OF_CHUNK_SIZE);
+    dirty_begin = moveToTheNextPlaceInMem(dirty_begin, getAlignmentSize(dirty_begin, OS_PAGE_SIZE));
+    void *dirty_end = arena.purged_from_ != nullptr ? arena.purged_from_ : heap_end;
+    if(dirty_begin >= dirty_end) {
+        return 0;
+    }
+    const std::size_t released = getPtrDiffSize(dirty_end, dirty_begin);
+    if(released < trim_threshold_) {
+        return 0;
+    }
+    PP::releasePages(dirty_begin, released);
+    arena.purged_from_ = dirty_begin;
+    return released;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+BasicAfMalloc<TP, OP, SP, PP, TA>::~BasicAfMalloc() {
+    stopStatsPublisher();
+    stopPurger();
+    stopDeferredFreeDrainer();
+    drainDeferredFrees();
+    TP::forEachArena([this](AfArena &arena) {
+        // in the region mode chunks never go back to the top, so there is nothing to check
+        const std::size_t colour_offset = arena.heap_ != nullptr ? arena.heap_->colour_offset : 0;
+        if(mode_ != AfMallocMode::REGION && arena.free_size_ + colour_offset != arena.allocated_size_) {
+            std::cout << "leaking memory" << std::endl;
+        }
+        AfHeap *heap = arena.heap_;
+        while(heap != nullptr) {
+            AfHeap *prev_heap = heap->prev_heap;
+            PP::unmapHeap(heap);
+            heap = prev_heap;
+        }
+        releaseSlabHeaps(arena, &PP::unmapHeap);
+        freeRegionLargeHeaps(arena);
+    });
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+AfLockStats BasicAfMalloc<TP, OP, SP, PP, TA>::getLockStats() {
+    AfLockStats stats{};
+    TP::forEachArena([&stats](AfArena &arena) {
+        stats.acquisitions += arena.lock_counters_.acquisitions.load(std::memory_order_relaxed);
+        stats.try_lock_failures += arena.lock_counters_.try_lock_failures.load(std::memory_order_relaxed);
+        stats.wait_ns += arena.lock_counters_.wait_ns.load(std::memory_order_relaxed);
+        stats.arena_switches += arena.arena_switches_.load(std::memory_order_relaxed);
+        stats.blocking_waits += arena.blocking_waits_.load(std::memory_order_relaxed);
+    });
+    return stats;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+AfUnsortedStats BasicAfMalloc<TP, OP, SP, PP, TA>::getUnsortedStats() {
+    AfUnsortedStats stats{};
+    TP::forEachArena([&stats](AfArena &arena) {
+        [[maybe_unused]] auto lock = TP::lockArena(arena);
+        stats.max_walk = std::max(stats.max_walk, arena.max_unsorted_walk_);
+        stats.capped_walks += arena.unsorted_capped_walks_;
+    });
+    return stats;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+AfStatsRecord BasicAfMalloc<TP, OP, SP, PP, TA>::getStatsRecord() {
+    AfStatsRecord record{};
+    record.publish_time_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+    record.large_mapped_size = large_mapped_size_.load(std::memory_order_relaxed);
+    record.large_maps = large_maps_.load(std::memory_order_relaxed);
+    record.large_unmaps = large_unmaps_.load(std::memory_order_relaxed);
+    record.heap_maps = heap_maps_.load(std::memory_order_relaxed);
+    record.trims = trims_.load(std::memory_order_relaxed);
+    record.trimmed_size = trimmed_size_.load(std::memory_order_relaxed);
+    TP::forEachArena([&record](AfArena &arena) {
+        const std::size_t index = record.arena_count++;
+        if(index >= AF_STATS_MAX_ARENAS) {
+            return;
+        }
+        AfArenaStatsRecord &arena_record = record.arenas[index];
+        // lock counters need no lock, they count the locks taken by the earlier publishes too
+        arena_record.lock_acquisitions = arena.lock_counters_.acquisitions.load(std::memory_order_relaxed);
+        arena_record.try_lock_failures = arena.lock_counters_.try_lock_failures.load(std::memory_order_relaxed);
+        arena_record.lock_wait_ns = arena.lock_counters_.wait_ns.load(std::memory_order_relaxed);
+        arena_record.arena_switches = arena.arena_switches_.load(std::memory_order_relaxed);
+        arena_record.blocking_waits = arena.blocking_waits_.load(std::memory_order_relaxed);
+
+        [[maybe_unused]] auto lock = TP::lockArena(arena);
+        arena_record.allocated_size = arena.allocated_size_;
+        arena_record.top_free_size = arena.free_size_;
+        arena_record.slab_allocated_size = arena.slab_allocated_size_;
+        arena_record.fast_bins_used = std::ranges::count_if(arena.fast_chunks_, hasElementsInList);
+        arena_record.small_bins_used = std::ranges::count_if(arena.small_chunks_, hasElementsInList);
+        arena_record.unsorted_used = (hasElementsInList(arena.unsorted_chunks_) ? 1 : 0)
+                                     + (hasElementsInList(arena.unsorted_large_chunks_) ? 1 : 0);
+        arena_record.max_unsorted_walk = arena.max_unsorted_walk_;
+    });
+    return record;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+bool BasicAfMalloc<TP, OP, SP, PP, TA>::startStatsPublisher(const std::chrono::milliseconds interval) {
+    static_assert(!std::is_same_v<TP, SingleThreaded>, "publisher thread needs arenas which are locked");
+    stopStatsPublisher();
+    std::unique_ptr<AfStatsSegment> segment = AfStatsSegment::create();
+    if(segment == nullptr) {
+        return false;
+    }
+    publisher_stop_ = false;
+    // the thread owns the segment, which is removed when the thread ends
+    publisher_thread_ = std::thread{[this, interval, segment = std::move(segment)]() {
+        std::uint64_t publish_count{0};
+        std::unique_lock lock{publisher_lock_};
+        while(!publisher_stop_) {
+            AfStatsRecord record = getStatsRecord();
+            record.publish_count = ++publish_count;
+            segment->publish(record);
+            publisher_cv_.wait_for(lock, interval, [this]() { return publisher_stop_; });
+        }
+    }};
+    return true;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::stopStatsPublisher() {
+    if(!publisher_thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard lock{publisher_lock_};
+        publisher_stop_ = true;
+    }
+    publisher_cv_.notify_one();
+    publisher_thread_.join();
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::getTotalAllocatedSize() {
+    std::size_t total{large_mapped_size_.load(std::memory_order_relaxed)};
+    TP::forEachArena([&total](AfArena &arena) {
+        [[maybe_unused]] auto lock = TP::lockArena(arena);
+        total += arena.allocated_size_ + arena.slab_allocated_size_;
+    });
+    return total;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::moveChunkToCorrectBin(AfArena &arena, Chunk *current_chunk, std::size_t needed_size) {
+    auto maybe_bin_index = findBinIndex(needed_size);
+    // free_chunk_list -> 1 -> 2 - > 3
+    if(!maybe_bin_index) {
+        moveToUnsortedLargeChunks(arena, current_chunk);
+    }else {
+        if(auto [index, bit_index] = *maybe_bin_index; index == FASTBINS_INDEX) {
+            // fast range
+            moveToFastBinsChunks(arena, current_chunk, bit_index);
+            setBinIndex(arena, index, bit_index);
+        }else {
+            // small range
+            moveToSmallBinsChunks(arena, current_chunk, bit_index);
+            setBinIndex(arena, index, bit_index);
+        }
+    }
+
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::optional<void*> BasicAfMalloc<TP, OP, SP, PP, TA>::findChunkFromUnsortedFreeChunks(AfArena &arena, std::size_t needed_size) {
+    // Next to the free chunk, unless it is in the fast bin range, there will always be an allocated chunk,
+    // since otherwise we would coalesce them
+    // on the free.
+    // For the fast bin chunk, even if the chunk next to the fast bin chunk is free, we would not coalesce them.
+
+    // Unsorted free chunks are stored in a double linked list
+    Chunk *start  = &arena.unsorted_chunks_;
+    assert(start->getNext() != nullptr);
+    Chunk *current_chunk = start->getNext();
+    Chunk *match{nullptr};
+    std::size_t sorted{0};
+    while(current_chunk != start) {
+        // We are looking for the first chunk that we can find.
+        // If we encounter a chunk which is not of needed size, we will move it to the appropriate bin
+        if(current_chunk->getSize()  >= needed_size) {
+            match = current_chunk;
+            break;
+        }
+        // The rest stays in the list for the following mallocs, so one malloc after a burst of frees
+        // does not pay for sorting all of them
+        if(unsorted_sort_limit_ != 0 && sorted == unsorted_sort_limit_) {
+            arena.unsorted_capped_walks_++;
+            break;
+        }
+        Chunk *next_chunk = current_chunk->getNext();
+        unlinkChunk(current_chunk);
+        moveChunkToCorrectBin(arena, current_chunk, current_chunk->getSize());
+        sorted++;
+        current_chunk = next_chunk;
+    }
+    arena.max_unsorted_walk_ = std::max(arena.max_unsorted_walk_, sorted + (match != nullptr ? 1 : 0));
+
+    if(match == nullptr) {
+        return std::nullopt;
+    }
+
+    unlinkChunk(match);
+
+    // TODO this is opportunity to split the chunk on the multiple chunks, since we could otherwise get really
+    // big chunk
+    Chunk* next_chunk = moveToTheNextChunk(match, match->getSize());
+    // next chunk only knows that we are free
+    next_chunk->unsetPrevFree();
+    // this part of memory will be used by our chunk also, hence we need to zero the memory
+    next_chunk->setPrevSize(0x0000);
+
+    // We don't need to call the construct here since we have already done so
+    return moveToTheNextPlaceInMem(match, HEAD_OF_CHUNK_SIZE);
+}
+
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::setBinIndex(AfArena &arena, std::size_t bin, std::size_t bit) {
+    arena.bin_indexes_[bin] |= (1ul << bit);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::unsetBitIndex(AfArena &arena, std::size_t bin, std::size_t bit) {
+    arena.bin_indexes_[bin] &= ~(1ul << bit);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+bool BasicAfMalloc<TP, OP, SP, PP, TA>::isBinBitIndexSet(std::size_t bin, std::size_t bit) {
+    return isBinBitIndexSet(af_arena_, bin, bit);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+bool BasicAfMalloc<TP, OP, SP, PP, TA>::isBinBitIndexSet(const AfArena &arena, std::size_t bin, std::size_t bit) const {
+    return arena.bin_indexes_[bin].test(bit);
+}
+
+/**
+ * Fast bin chunk gets allocated, we remove it from the list
+ * Later we add it to the unsorted chunks, and insert back into the free list
+ * It is never coalesced however.
+ * @param size
+ * @return
+ */
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+Chunk *BasicAfMalloc<TP, OP, SP, PP, TA>::tryFindFastBinChunk(AfArena &arena, const std::size_t size) {
+    auto [fast_bin_index, bit_index] = *findBinIndex(size);
+    assert(fast_bin_index == FASTBINS_INDEX);
+    auto index = bit_index;
+
+    // Traverse only up to 2 blocks away from our chunk
+    while(index < getMaxFastBinBitIndex() && (index - bit_index <= 2)) {
+        Chunk &chunk_list = arena.fast_chunks_[index];
+        if(isPointingToSelf(chunk_list)) {
+            unsetBitIndex(arena, fast_bin_index, bit_index);
+        }else {
+            // Not sure how malloc does this, but probably good idea to restrict this to one above
+            // if there is no exact match, otherwise we are wasting a lot of memory space
+            Chunk *match = chunk_list.getNext();
+            unlinkChunk(match);
+            assert(match != nullptr);
+            Chunk *next_chunk = moveToTheNextChunk(match, match->getSize());
+            // next chunk only knows that we are free
+            next_chunk->unsetPrevFree();
+            // this part of memory will be used by our chunk also, hence we need to zero the memory
+            next_chunk->setPrevSize(0x0000);
+            return match;
+        }
+        index++;
+    }
+    return nullptr;
+}
+
+/**
+ * Try to find chunk which is of same size, or one size larger.
+ * Not sure if we should iterate more here, and then just split the chunk if found
+ * @param size
+ * @return
+ */
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+Chunk *BasicAfMalloc<TP, OP, SP, PP, TA>::tryFindSmallBinChunk(AfArena &arena, std::size_t size) {
+    std::vector<Chunk > &small_chunks = arena.small_chunks_;
+    auto [small_bin_index, bit_index] = *findBinIndex(size);
+    assert(small_bin_index == SMALLBINS_INDEX);
+    auto index = bit_index;
+
+    Chunk *chunk_list{nullptr};
+    while(true) {
+        chunk_list = &small_chunks[index];
+        if(isPointingToSelf(*chunk_list) || !isBinBitIndexSet(arena, small_bin_index, index)) {
+            unsetBitIndex(arena, small_bin_index, index);
+            index++;
+        }else {
+            Chunk *match  = chunk_list->getPrev();
+            unlinkChunk(match);
+            assert(match != nullptr);
+            Chunk* next_chunk = moveToTheNextChunk(match, match->getSize());
+            // next chunk only knows that we are free
+            next_chunk->unsetPrevFree();
+            // this part of memory will be used by our chunk also, hence we need to zero the memory
+            next_chunk->setPrevSize(0x0000);
+            return match;
+        }
+
+        // Not sure how malloc does this, but probably good idea to restrict this to one above
+        // if there is no exact match, otherwise we are wasting a lot of memory space
+        if(index > getMaxSmallBinBitIndex() || index - bit_index >= 2 ) {
+            return nullptr;
+        }
+    }
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+AfHeap *BasicAfMalloc<TP, OP, SP, PP, TA>::allocateNewHeap(AfArena &arena, const std::size_t needed_size) {
+    void *p1 = PP::mapHeap();
+    if(p1 == nullptr) {
+        return nullptr;
+    }
+    heap_maps_.fetch_add(1, std::memory_order_relaxed);
+    void *memory_start = moveToTheNextPlaceInMem(p1, HEAP_HEADER_SIZE);
+    assert(getAlignmentSize(memory_start, HEAP_MAX_SIZE) == 0);
+    if constexpr (TRACKING) {
+        std::cout << "New heap at: " << memory_start << std::endl;
+    }
+    // Same offsets in different heaps map to the same cache sets, so every heap starts its chunks
+    // some cache lines further. A chunk which needs nearly the whole heap gets less of the offset.
+    std::size_t colour_offset{0};
+    if(heap_colours_ > 1) {
+        colour_offset = next_heap_colour_.fetch_add(1, std::memory_order_relaxed) % heap_colours_ * CACHE_LINE_SIZE;
+        const std::size_t room = (MAX_HEAP_SIZE - HEAD_OF_CHUNK_SIZE - needed_size) & ~(CACHE_LINE_SIZE - 1);
+        colour_offset = std::min(colour_offset, room);
+    }
+    return std::construct_at(static_cast<AfHeap *>(p1), &arena, memory_start, arena.heap_, false, 0, colour_offset);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+AfArena *BasicAfMalloc<TP, OP, SP, PP, TA>::lockLifetimeArena(typename TP::Lock &lock, const AfLifetime lifetime) {
+    AfArena *arena = TP::lockSelectedArena(lock);
+    if(lifetime == AfLifetime::SHORT) {
+        return arena;
+    }
+    // lifetime arena is locked before the selected one is released, the order is always arena then lifetime arena
+    AfArena &lifetime_arena = getLifetimeArena(*arena, lifetime);
+    lock = TP::lockArena(lifetime_arena);
+    return &lifetime_arena;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void *BasicAfMalloc<TP, OP, SP, PP, TA>::malloc(std::size_t size) {
+    return malloc(size, getLifetimeHint());
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void *BasicAfMalloc<TP, OP, SP, PP, TA>::malloc(std::size_t size, const AfLifetime lifetime) {
+    void *ptr = mallocUnreported(size, lifetime);
+    if(const AfMallocHooks *hooks = getAfMallocHooks(); hooks != nullptr) [[unlikely]] {
+        reportAlloc(*hooks, ptr, size);
+    }
+    return ptr;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void *BasicAfMalloc<TP, OP, SP, PP, TA>::mallocUnreported(std::size_t size, const AfLifetime lifetime) {
+    const std::size_t needed_size = getMallocNeededSize(size);
+    if(needed_size > mmap_threshold_) {
+        void *ptr = mallocLarge(needed_size);
+        if(mode_ == AfMallocMode::REGION && ptr != nullptr) {
+            // the mapping dies with the region, so reset has to find it
+            typename TP::Lock lock{};
+            linkRegionLargeHeap(*lockLifetimeArena(lock, lifetime), getHeapForChunk(ptr));
+        }
+        return ptr;
+    }
+
+    typename TP::Lock lock{};
+    AfArena *arena = lockLifetimeArena(lock, lifetime);
+
+    if constexpr (TA::USES_SLABS) {
+        if(isSlabSize(size)) {
+            return mallocFromSlab(*arena, size, &PP::mapHeap);
+        }
+    }
+    return mallocFromArena(*arena, needed_size);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void *BasicAfMalloc<TP, OP, SP, PP, TA>::mallocLarge(const std::size_t needed_size) {
+    void *p1 = PP::mapLarge(needed_size);
+    if(p1 == nullptr) {
+        return nullptr;
+    }
+    void *memory_start = moveToTheNextPlaceInMem(p1, HEAP_HEADER_SIZE);
+    const std::size_t mapped_size = getLargeMappingSize(needed_size);
+    std::construct_at(static_cast<AfHeap *>(p1), nullptr, memory_start, nullptr, false, mapped_size);
+    large_mapped_size_.fetch_add(mapped_size, std::memory_order_relaxed);
+    large_maps_.fetch_add(1, std::memory_order_relaxed);
+
+    // memory of a new mapping is zero, so only the size is set
+    auto *chunk = static_cast<Chunk *>(memory_start);
+    chunk->setSize(needed_size);
+    return moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::freeLarge(AfHeap *heap) {
+    large_mapped_size_.fetch_sub(heap->mmapped_size, std::memory_order_relaxed);
+    large_unmaps_.fetch_add(1, std::memory_order_relaxed);
+    PP::unmapLarge(heap);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::freeRegionLargeHeaps(AfArena &arena) {
+    while(arena.region_large_heaps_ != nullptr) {
+        AfHeap *heap = arena.region_large_heaps_;
+        arena.region_large_heaps_ = heap->next_heap;
+        freeLarge(heap);
+    }
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+bool BasicAfMalloc<TP, OP, SP, PP, TA>::makeRoomInTop(AfArena &arena, const std::size_t needed_size) {
+    // If there is less then HEAD_OF_CHUNK_SIZE left, we need to
+    if(static_cast<long>(arena.free_size_) - static_cast<long>(HEAD_OF_CHUNK_SIZE) >= static_cast<long>(needed_size)) {
+        return true;
+    }
+    if(needed_size > MAX_HEAP_SIZE - HEAD_OF_CHUNK_SIZE) {
+        assert(false); // unsupported case
+    }
+    AfHeap *heap = allocateNewHeap(arena, needed_size);
+    if(heap == nullptr) {
+        return false;
+    }
+    // Whatever was left in the old heap stays behind the old top, whose header is the fence of that heap
+    if(arena.begin_ == nullptr) {
+        arena.begin_ = getFirstChunk(heap);
+    }
+    arena.heap_ = heap;
+    arena.allocated_size_ += MAX_HEAP_SIZE;
+    arena.top_= getFirstChunk(heap);
+    arena.free_size_ = MAX_HEAP_SIZE - heap->colour_offset;
+    return true;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void *BasicAfMalloc<TP, OP, SP, PP, TA>::mallocFromArena(AfArena &arena, const std::size_t needed_size) {
+    // if there are free chunks, try to use them
+    if(hasElementsInList(arena.unsorted_chunks_)) {
+        if(auto maybe_chunk = findChunkFromUnsortedFreeChunks(arena, needed_size)) {
+            return *maybe_chunk;
+        }
+    }
+    if(isInFastBinRange(needed_size)) {
+        if(auto *chunk = tryFindFastBinChunk(arena, needed_size)) {
+            return moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
+        }
+    }
+    if(isInSmallBinRange(needed_size)) {
+        if(auto *chunk = tryFindSmallBinChunk(arena, needed_size)) {
+            return moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
+        }
+    }
+    if(!isPointingToSelf(arena.unsorted_large_chunks_)) {
+        if(auto *chunk = tryFindLargeChunk(&arena.unsorted_large_chunks_, needed_size)) {
+            return moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
+        }
+    }
+
+    // if there are no free chunks, and we have no enough size, we need to allocate a new block
+    if(!makeRoomInTop(arena, needed_size)) {
+        return nullptr;
+    }
+
+    // We can store anything which has alignment of 16 bytes.
+
+    // Here we will give to user the size needed
+    // what we will do is we will return to user pointer after chunk's block
+    void *user_ptr = arena.top_;
+
+    // TODO update this part so that we use std::start_lifetime_as
+    auto *user_chunk = std::construct_at(static_cast<Chunk*>(user_ptr), 0, needed_size, nullptr, nullptr);
+    if(track_pointers_) {
+        createPtrHumaneReadableName("ptr", user_chunk);
+    }
+    arena.free_size_ -=  needed_size;
+    arena.top_ = moveToTheNextPlaceInMem(user_chunk, needed_size);
+    SP::scrubTopHeader(arena.top_);
+
+
+    return moveToTheNextPlaceInMem(user_ptr, HEAD_OF_CHUNK_SIZE);
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::mallocBatch(std::size_t size, std::size_t count, void **out_ptrs) {
+    const std::size_t allocated = mallocBatchUnreported(size, count, out_ptrs);
+    if(const AfMallocHooks *hooks = getAfMallocHooks(); hooks != nullptr) [[unlikely]] {
+        for(std::size_t i{0}; i < allocated; i++) {
+            reportAlloc(*hooks, out_ptrs[i], size);
+        }
+    }
+    return allocated;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::mallocBatchUnreported(std::size_t size, std::size_t count, void **out_ptrs) {
+    if(getMallocNeededSize(size) > mmap_threshold_) {
+        std::size_t allocated{0};
+        while(allocated < count && (out_ptrs[allocated] = mallocLarge(getMallocNeededSize(size))) != nullptr) {
+            allocated++;
+        }
+        if(mode_ == AfMallocMode::REGION && allocated > 0) {
+            typename TP::Lock lock{};
+            AfArena *arena = lockLifetimeArena(lock, getLifetimeHint());
+            for(std::size_t i{0}; i < allocated; i++) {
+                linkRegionLargeHeap(*arena, getHeapForChunk(out_ptrs[i]));
+            }
+        }
+        return allocated;
+    }
+    typename TP::Lock lock{};
+    AfArena *arena = lockLifetimeArena(lock, getLifetimeHint());
+
+    if constexpr (TA::USES_SLABS) {
+        if(isSlabSize(size)) {
+            std::size_t allocated{0};
+            while(allocated < count && (out_ptrs[allocated] = mallocFromSlab(*arena, size, &PP::mapHeap)) != nullptr) {
+                allocated++;
+            }
+            return allocated;
+        }
+    }
+    const std::size_t needed_size = getMallocNeededSize(size);
+    std::size_t allocated = takeFromBin(*arena, needed_size, count, out_ptrs);
+    while(allocated < count) {
+        allocated += carveFromTop(*arena, needed_size, count - allocated, out_ptrs + allocated);
+        if(allocated == count) {
+            break;
+        }
+        // Top is too small for even one more chunk. Regular path either finds some free chunk or maps
+        // a new heap, from which we continue carving.
+        void *ptr = mallocFromArena(*arena, needed_size);
+        if(ptr == nullptr) {
+            break;
+        }
+        out_ptrs[allocated++] = ptr;
+    }
+    return allocated;
+}
+
+/**
+ * Takes chunks only from the bin which holds exactly `needed_size`, we don't want to
+ * waste space by handing out bigger chunks for the whole batch
+ */
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::takeFromBin(AfArena &arena, const std::size_t needed_size, const std::size_t count, void **out_ptrs) {
+    auto maybe_bin_index = findBinIndex(needed_size);
+    if(!maybe_bin_index) {
+        return 0;
+    }
+    auto [bin, bit_index] = *maybe_bin_index;
+    Chunk &chunk_list = bin == FASTBINS_INDEX ? arena.fast_chunks_[bit_index] : arena.small_chunks_[bit_index];
+
+    std::size_t taken{0};
+    while(taken < count && !isPointingToSelf(chunk_list)) {
+        Chunk *match = chunk_list.getNext();
+        unlinkChunk(match);
+        markChunkInUse(match);
+        out_ptrs[taken++] = moveToTheNextPlaceInMem(match, HEAD_OF_CHUNK_SIZE);
+    }
+    if(isPointingToSelf(chunk_list)) {
+        unsetBitIndex(arena, bin, bit_index);
+    }
+    return taken;
+}
+
+/**
+ * Splits as many chunks as it fits (up to count) from the top chunk of the arena, top is moved only once
+ */
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::carveFromTop(AfArena &arena, const std::size_t needed_size, const std::size_t count, void **out_ptrs) {
+    if(arena.top_ == nullptr || arena.free_size_ < HEAD_OF_CHUNK_SIZE + needed_size) {
+        return 0;
+    }
+    const std::size_t fits = (arena.free_size_ - HEAD_OF_CHUNK_SIZE) / needed_size;
+    const std::size_t carved = std::min(fits, count);
+
+    void *chunk_ptr = arena.top_;
+    for(std::size_t i{0}; i < carved; i++) {
+        auto *user_chunk = std::construct_at(static_cast<Chunk*>(chunk_ptr), 0, needed_size, nullptr, nullptr);
+        if(track_pointers_) {
+            createPtrHumaneReadableName("ptr", user_chunk);
+        }
+        out_ptrs[i] = moveToTheNextPlaceInMem(user_chunk, HEAD_OF_CHUNK_SIZE);
+        chunk_ptr = moveToTheNextPlaceInMem(user_chunk, needed_size);
+    }
+    arena.free_size_ -= carved * needed_size;
+    arena.top_ = chunk_ptr;
+    SP::scrubTopHeader(arena.top_);
+    return carved;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void *BasicAfMalloc<TP, OP, SP, PP, TA>::memAlign(std::size_t alignment, std::size_t size) {
+    // alignment + size
+    assert(alignment % 2 == 0);
+    // if alignment is not at least 16, reconfigure to multiple of 16, we can work with
+    // if alignment or size which we allocate for chunk is not multiple of ALIGNMENT
+    // then we will have problem allocating new chunk, it will be misaligned
+    if(alignment < ALIGNMENT || alignment % ALIGNMENT != 0) {
+        alignment = (alignment / ALIGNMENT + 1) * ALIGNMENT; // round up to the bigger number
+    }
+    const std::size_t mallocNeededSize = getMallocNeededSize(size);
+
+    typename TP::Lock lock{};
+    AfArena &arena = *lockLifetimeArena(lock, getLifetimeHint());
+    // room for the chunk wherever the aligned place turns out to be, a new heap is mapped if the top has no heap
+    // or is too small
+    if(!makeRoomInTop(arena, mallocNeededSize + alignment + HEAD_OF_CHUNK_SIZE + CHUNK_SIZE)) {
+        return nullptr;
+    }
+
+    void *top = arena.top_;
+    std::size_t alignmentSizeInternal = getAlignmentSize(top, alignment);
+    void *new_top = moveToTheNextPlaceInMem(top, alignmentSizeInternal);
+    // since new_top is now aligned to what user wants
+    // we need to check if have 16 bytes before to fit our HEAD_OF_CHUNK,
+    // and the space left before our head is either none or a whole chunk
+    while(getPtrDiffSize(new_top, top) != HEAD_OF_CHUNK_SIZE
+          && getPtrDiffSize(new_top, top) < HEAD_OF_CHUNK_SIZE + CHUNK_SIZE) {
+        new_top = moveToTheNextPlaceInMem(new_top, alignment);
+    }
+
+    void *start_of_chunk = moveToThePreviousPlaceInMem(new_top, HEAD_OF_CHUNK_SIZE);
+    assert(reinterpret_cast<uintptr_t>(new_top) % alignment == 0);
+    const std::size_t gap_size = getPtrDiffSize(start_of_chunk, top);
+
+    Chunk *chunk = std::construct_at(static_cast<Chunk*>(start_of_chunk), 0, mallocNeededSize, nullptr, nullptr);
+    arena.free_size_ -= gap_size + mallocNeededSize;
+    arena.top_ = moveToTheNextPlaceInMem(start_of_chunk, mallocNeededSize);
+    SP::scrubTopHeader(arena.top_);
+    if(gap_size != 0) {
+        // space skipped for the alignment is freed as any other chunk, so it can be reused
+        freeChunk(arena, std::construct_at(static_cast<Chunk *>(top), 0, gap_size, nullptr, nullptr));
+    }
+    lock = {};
+
+    void *user_ptr = moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
+    if(const AfMallocHooks *hooks = getAfMallocHooks(); hooks != nullptr) [[unlikely]] {
+        reportAlloc(*hooks, user_ptr, size);
+    }
+    return user_ptr;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void *BasicAfMalloc<TP, OP, SP, PP, TA>::realloc(void *p, const std::size_t size) {
+    void *new_ptr{nullptr};
+    if(p == nullptr) {
+        new_ptr = mallocUnreported(size, getLifetimeHint());
+    } else if(size == 0) {
+        freeUnreported(p);
+    } else if(const std::size_t usable_size = getUsableSize(p); size <= usable_size) {
+        new_ptr = p;
+    } else {
+        new_ptr = mallocUnreported(size, getLifetimeHint());
+        if(new_ptr == nullptr) {
+            return nullptr;
+        }
+        std::memcpy(new_ptr, p, usable_size);
+        freeUnreported(p);
+    }
+    if(const AfMallocHooks *hooks = getAfMallocHooks(); hooks != nullptr) [[unlikely]] {
+        reportRealloc(*hooks, p, new_ptr, size);
+    }
+    return new_ptr;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+std::size_t BasicAfMalloc<TP, OP, SP, PP, TA>::getUsableSize(void *p) {
+    if constexpr (TA::USES_SLABS) {
+        const AfHeap *heap = getHeapForChunk(p);
+        if(heap->mmapped_size == 0 && heap->is_slab_heap) {
+            return getSlabPage(p)->object_size;
+        }
+    }
+    // allocated chunk keeps only its size, the rest of it up to the size field of the next chunk is user's
+    return moveToThePreviousChunk(p, HEAD_OF_CHUNK_SIZE)->getSize() - SIZE_OF_SIZE;
+}
+
+template <typename TP, typename OP, typename SP, typename PP, typename TA>
+void BasicAfMalloc<TP, OP, SP, PP, TA>::dumpMemory() {
+    std::cout << std::format("-------Dumping unsorted chunks-------") << std::endl;
+
+    {
+        Chunk &head = af_arena_.unsorted_chunks_;
+        Chunk *start = head.getNext();
+
+        std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(&head), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(head.getNext()), getPtrHumaneReadableName(head.getPrev())) << std::endl;
+        while(start != &head) {
+            std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(start), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(start->getNext()), getPtrHumaneReadableName(start->getPrev())) << std::endl;
+            start = start->getNext();
+        }
+    }
+
+    {
+        auto &fast_chunks = af_arena_.fast_chunks_;
+        std::size_t i{0};
+        for(auto &head: fast_chunks) {
+            if(!isPointingToSelf(head)) {
+                std::cout << std::format("-------FastChunk{}-------", i++) << std::endl;
+                Chunk *start = head.getNext();
+
+                std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(&head), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(head.getNext()), getPtrHumaneReadableName(head.getPrev())) << std::endl;
+                while(start != &head) {
+                    std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(start), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(start->getNext()), getPtrHumaneReadableName(start->getPrev())) << std::endl;
+                    start = start->getNext();
+                }
+            }else {
+                i++;
+            }
+        }
+    }
+
+    {
+        auto &small_chunks = af_arena_.small_chunks_;
+        std::size_t i{0};
+        for(auto &head: small_chunks) {
+            if(!isPointingToSelf(head)) {
+                std::cout << std::format("-------SmallChunk{}-------", i++) << std::endl;
+                Chunk *start = head.getNext();
+
+                std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(&head), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(head.getNext()), getPtrHumaneReadableName(head.getPrev())) << std::endl;
+                while(start != &head) {
+                    std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(start), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(start->getNext()), getPtrHumaneReadableName(start->getPrev())) << std::endl;
+                    start = start->getNext();
+                }
+            }else {
+                i++;
+            }
+        }
+    }
+
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "AfMalloc.hpp"
+
+// Every link inside the region is an offset from the beginning of the region, so the region stays valid
+// when it is mapped at some other address: after a restart, or in some other process.
+using AfOffset = std::uint64_t;
+
+// Header of the heap is at the offset 0, so no chunk can ever be there
+constexpr AfOffset AF_NULL_OFFSET = 0;
+
+constexpr std::uint64_t AF_OFFSET_HEAP_MAGIC = 0x636f6c6c616d6661; // "afmalloc"
+constexpr std::uint32_t AF_OFFSET_HEAP_VERSION = 1;
+
+// One bin for every 16 bytes up to SMALL_BIN_RANGE_END, and the last one for all bigger chunks
+constexpr std::size_t NUM_OFFSET_BINS = SMALL_BIN_RANGE_END / BIN_SPACING_SIZE + 1;
+
+// First chunk starts on the cache line
+constexpr std::size_t OFFSET_HEAP_HEADER_ALIGNMENT = 64;
+
+/**
+ * Chunk with the same layout as Chunk, only with offsets in place of the pointers.
+ * User memory starts after the size, and the prev_size of the following chunk is valid only while this chunk is free.
+ */
+class AfOffsetChunk {
+  public:
+    [[nodiscard]] std::size_t getSize() const {
+      return size_ & ~PREV_FREE;
+    }
+
+    void setSize(const std::size_t size) {
+      size_ = (size & ~PREV_FREE);
+    }
+
+    [[nodiscard]] bool isPrevFree() const {
+      return size_ & PREV_FREE;
+    }
+
+    void setPrevFree() {
+      size_ |= PREV_FREE;
+    }
+
+    void unsetPrevFree() {
+      size_ &= ~PREV_FREE;
+    }
+
+    [[nodiscard]] std::size_t getPrevSize() const {
+      return previous_size_;
+    }
+
+    void setPrevSize(const std::size_t previous_size) {
+      previous_size_ = previous_size;
+    }
+
+    [[nodiscard]] AfOffset getPrev() const {
+      return prev_;
+    }
+
+    [[nodiscard]] AfOffset getNext() const {
+      return next_;
+    }
+
+    void setPrev(const AfOffset prev) {
+      prev_ = prev;
+    }
+
+    void setNext(const AfOffset next) {
+      next_ = next;
+    }
+
+  private:
+    std::uint64_t previous_size_{0};
+    std::uint64_t size_{0};
+    AfOffset prev_{AF_NULL_OFFSET};
+    AfOffset next_{AF_NULL_OFFSET};
+};
+
+static_assert(sizeof(AfOffsetChunk) == CHUNK_SIZE);
+
+/**
+ * Lives at the beginning of the region. Only fixed size types, so the same file can be read by every build.
+ */
+struct AfOffsetHeapHeader {
+  std::uint64_t magic;
+  std::uint32_t version;
+  // offset of the first chunk, space between the header and the first chunk belongs to the owner of the region
+  std::uint32_t chunks_offset;
+  std::uint64_t region_size;
+  // start of the top chunk, everything from here up to the end of the region is free
+  AfOffset top;
+  // object from which the user finds everything else after the region is mapped again
+  AfOffset root;
+  // heads of the double linked lists of the free chunks
+  std::array<AfOffset, NUM_OFFSET_BINS> bins;
+};
+
+/**
+ * Allocator over one contiguous region, which does not own the region. Free chunks are coalesced on free,
+ * same as in AfMalloc, and kept in bins of the exact size, with the last bin for everything bigger.
+ * There is no locking, the owner of the region takes care of that.
+ */
+class AfOffsetHeap {
+  public:
+    /**
+     * Formats a new heap over the region, whatever was in the region is lost
+     * @param extra_header_size bytes after the header which the owner of the region uses for itself
+     */
+    static AfOffsetHeap create(void *base, std::size_t region_size, std::size_t extra_header_size = 0);
+
+    /**
+     * Attaches to a heap which was created before, possibly at another address
+     * @param check_consistency false if the heap may be in use right now, then the owner checks it under its lock
+     * @return nullopt if the region does not hold a heap, or the heap is not consistent
+     */
+    static std::optional<AfOffsetHeap> attach(void *base, std::size_t region_size, bool check_consistency = true);
+
+    void *malloc(std::size_t size);
+
+    void free(void *p);
+
+    [[nodiscard]] AfOffset toOffset(const void *p) const {
+      return p == nullptr ? AF_NULL_OFFSET : static_cast<AfOffset>(static_cast<const std::byte *>(p) - base_);
+    }
+
+    [[nodiscard]] void *fromOffset(const AfOffset offset) const {
+      return offset == AF_NULL_OFFSET ? nullptr : base_ + offset;
+    }
+
+    void setRoot(const void *root) {
+      header_->root = toOffset(root);
+    }
+
+    [[nodiscard]] void *getRoot() const {
+      return fromOffset(header_->root);
+    }
+
+    /**
+     * @return space reserved with extra_header_size on create
+     */
+    [[nodiscard]] void *getExtraHeader() const {
+      return base_ + sizeof(AfOffsetHeapHeader);
+    }
+
+    /**
+     * @return size of the biggest chunk the top can still give, the chunk behind it stays in the region
+     */
+    [[nodiscard]] std::size_t getTopFreeSize() const;
+
+    /**
+     * Walks all the chunks and all the bins, and checks that sizes, boundary tags and links agree with each other
+     */
+    [[nodiscard]] bool checkConsistency() const;
+
+  private:
+    AfOffsetHeap(void *base, std::size_t region_size);
+
+    AfOffsetChunk *chunkAt(AfOffset offset) const {
+      return reinterpret_cast<AfOffsetChunk *>(base_ + offset);
+    }
+
+    AfOffsetChunk *chunkAfter(AfOffset offset) const {
+      return chunkAt(offset + chunkAt(offset)->getSize());
+    }
+
+    static std::size_t getBinIndex(std::size_t size);
+
+    void insertToBin(AfOffset offset);
+
+    void unlinkFromBin(AfOffset offset);
+
+    // takes the chunk out of its bin, and splits off the rest if it is big enough for a chunk of its own
+    void *useFreeChunk(AfOffset offset, std::size_t needed_size);
+
+    // makes a free chunk of size at offset and puts it to the bin, neighbours must not be free
+    void makeFreeChunk(AfOffset offset, std::size_t size);
+
+    std::byte *base_{nullptr};
+    AfOffsetHeapHeader *header_{nullptr};
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+#include "AfOffsetHeap.hpp"
+
+/**
+ * AfOffsetHeap in a memory mapped file. Everything allocated here survives the restart of the process:
+ * the file is mapped again, at whatever address, the heap is checked and the user continues from the root object.
+ *
+ * Pointers inside the allocated objects must be stored as offsets too (toOffset/fromOffset), raw pointers are
+ * valid only for the current mapping. Heap is single threaded, same as AfOffsetHeap.
+ */
+class AfPersistentHeap {
+  public:
+    /**
+     * Opens the heap in the file at path. A new or empty file is extended to size and a new heap is created,
+     * an existing file is mapped with its own size and checked.
+     * @return nullptr if the file can't be mapped, or it does not hold a consistent heap
+     */
+    static std::unique_ptr<AfPersistentHeap> open(const char *path, std::size_t size);
+
+    AfPersistentHeap(const AfPersistentHeap &) = delete;
+    AfPersistentHeap &operator=(const AfPersistentHeap &) = delete;
+
+    /**
+     * Flushes the mapping to the file and unmaps it
+     */
+    ~AfPersistentHeap();
+
+    void *malloc(std::size_t size) {
+      return heap_.malloc(size);
+    }
+
+    void free(void *p) {
+      heap_.free(p);
+    }
+
+    [[nodiscard]] AfOffset toOffset(const void *p) const {
+      return heap_.toOffset(p);
+    }
+
+    template <typename T = void>
+    [[nodiscard]] T *fromOffset(AfOffset offset) const {
+      return static_cast<T *>(heap_.fromOffset(offset));
+    }
+
+    void setRoot(const void *root) {
+      heap_.setRoot(root);
+    }
+
+    template <typename T = void>
+    [[nodiscard]] T *getRoot() const {
+      return static_cast<T *>(heap_.getRoot());
+    }
+
+    /**
+     * @return true if the heap was already in the file, false if it was created now
+     */
+    [[nodiscard]] bool wasRecovered() const {
+      return recovered_;
+    }
+
+    [[nodiscard]] void *getBase() const {
+      return base_;
+    }
+
+    /**
+     * Writes the dirty pages to the file and waits for it
+     */
+    void sync();
+
+    AfOffsetHeap &getHeap() {
+      return heap_;
+    }
+
+  private:
+    AfPersistentHeap(int fd, void *base, std::size_t size, AfOffsetHeap heap, bool recovered);
+
+    int fd_{-1};
+    void *base_{nullptr};
+    std::size_t size_{0};
+    AfOffsetHeap heap_;
+    bool recovered_{false};
+};
@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <pthread.h>
+
+#include "AfOffsetHeap.hpp"
+
+/**
+ * Handle of an object in the shared heap. It is only an offset, so it means the same in every process
+ * which maps the heap, and can be sent through a socket, a pipe or stored in another shared object.
+ */
+struct AfSharedHandle {
+  AfOffset offset{AF_NULL_OFFSET};
+
+  [[nodiscard]] bool isNull() const {
+    return offset == AF_NULL_OFFSET;
+  }
+
+  bool operator==(const AfSharedHandle &other) const = default;
+};
+
+/**
+ * Lives in the region right after the heap header, shared by all the processes
+ */
+struct AfSharedHeapControl {
+  // process shared and robust, so a process dying with the lock held does not block the others
+  pthread_mutex_t lock;
+  // set once the creator formatted the heap
+  std::atomic<std::uint32_t> ready;
+  // a process died in the middle of malloc or free and the heap was not consistent any more
+  std::atomic<std::uint32_t> broken;
+};
+
+/**
+ * AfOffsetHeap in a shared memory region, mapped by several processes at whatever addresses. Objects are
+ * handed between processes with AfSharedHandle, without copying them.
+ *
+ * The region is either a named shm_open object, or an anonymous memfd whose descriptor is inherited or
+ * passed with SCM_RIGHTS. All malloc and free go under the process shared robust mutex in the region.
+ * If the owner of the mutex dies, the next process to lock it checks the heap, and if it is not consistent
+ * any more the heap is marked broken and malloc returns nullptr from then on.
+ */
+class AfSharedHeap {
+  public:
+    /**
+     * Creates a new named shared memory object of size bytes and formats the heap in it
+     * @return nullptr if the object already exists or can't be created
+     */
+    static std::unique_ptr<AfSharedHeap> create(const char *name, std::size_t size);
+
+    /**
+     * Creates the heap in an anonymous memfd, share it with getFd()
+     */
+    static std::unique_ptr<AfSharedHeap> createAnonymous(std::size_t size);
+
+    /**
+     * Maps the named heap created by some other process
+     * @return nullptr if there is no such object, or it does not hold a ready heap
+     */
+    static std::unique_ptr<AfSharedHeap> open(const char *name);
+
+    /**
+     * Maps the heap from the descriptor received from some other process, the descriptor is duplicated
+     */
+    static std::unique_ptr<AfSharedHeap> fromFd(int fd);
+
+    /**
+     * Removes the name, processes which have the heap mapped keep using it
+     */
+    static bool unlink(const char *name);
+
+    AfSharedHeap(const AfSharedHeap &) = delete;
+    AfSharedHeap &operator=(const AfSharedHeap &) = delete;
+
+    ~AfSharedHeap();
+
+    void *malloc(std::size_t size);
+
+    void free(void *p);
+
+    [[nodiscard]] AfSharedHandle toHandle(const void *p) const {
+      return {heap_.toOffset(p)};
+    }
+
+    template <typename T = void>
+    [[nodiscard]] T *fromHandle(AfSharedHandle handle) const {
+      return static_cast<T *>(heap_.fromOffset(handle.offset));
+    }
+
+    void setRoot(AfSharedHandle root);
+
+    [[nodiscard]] AfSharedHandle getRoot();
+
+    /**
+     * Lock of the heap, to do more operations at once. Same lock is taken by malloc and free, so those
+     * must not be called while holding it.
+     */
+    void lock();
+
+    void unlock();
+
+    [[nodiscard]] bool isBroken() const {
+      return control_->broken.load(std::memory_order_acquire) != 0;
+    }
+
+    [[nodiscard]] int getFd() const {
+      return fd_;
+    }
+
+  private:
+    AfSharedHeap(int fd, void *base, std::size_t size, AfOffsetHeap heap);
+
+    static std::unique_ptr<AfSharedHeap> createInFd(int fd, std::size_t size);
+
+    static std::unique_ptr<AfSharedHeap> attachFd(int fd);
+
+    int fd_{-1};
+    void *base_{nullptr};
+    std::size_t size_{0};
+    AfOffsetHeap heap_;
+    AfSharedHeapControl *control_{nullptr};
+};
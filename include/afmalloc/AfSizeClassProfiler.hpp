@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <span>
+#include <vector>
+
+/**
+ * Number of requests of one size, from a trace or from a sampled histogram
+ */
+struct AfSizeCount {
+  std::size_t size;
+  std::size_t count;
+};
+
+struct AfSizeClassTable {
+  // ascending, the last one is the maximum size of the table
+  std::vector<std::size_t> classes{};
+  // bytes requested by the sizes the table covers, counts included
+  std::size_t requested_bytes{0};
+  // bytes lost to rounding the requests up to their class
+  std::size_t wasted_bytes{0};
+  // requests bigger than the maximum size, which the table does not cover
+  std::size_t skipped_requests{0};
+};
+
+/**
+ * Picks num_classes size classes which lose the fewest bytes to rounding the requests of the histogram
+ * up to their class. Every class is a multiple of alignment, and the biggest one is max_size, so the table
+ * covers all the sizes up to max_size even if the histogram has none of them. Exact dynamic programming over
+ * the distinct sizes of the histogram, the optimal table only ever needs classes at those sizes.
+ * @param max_size multiple of alignment
+ */
+AfSizeClassTable computeSizeClasses(std::span<const AfSizeCount> histogram, std::size_t num_classes,
+                                    std::size_t alignment, std::size_t max_size);
+
+/**
+ * @return bytes lost to rounding the requests up to the given ascending classes, requests bigger than the biggest
+ * class are left out
+ */
+std::size_t getRoundingWaste(std::span<const AfSizeCount> histogram, std::span<const std::size_t> classes);
@@ -0,0 +1,117 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+// Arenas after this many are only counted in arena_count, they get no record of their own
+constexpr std::size_t AF_STATS_MAX_ARENAS = 256;
+
+/**
+ * Counters of one arena at the moment it was published
+ */
+struct AfArenaStatsRecord {
+  std::uint64_t allocated_size;
+  // bytes left in the top chunk
+  std::uint64_t top_free_size;
+  std::uint64_t slab_allocated_size;
+  // bins which hold at least one free chunk
+  std::uint64_t fast_bins_used;
+  std::uint64_t small_bins_used;
+  std::uint64_t unsorted_used;
+  std::uint64_t max_unsorted_walk;
+  std::uint64_t lock_acquisitions;
+  std::uint64_t try_lock_failures;
+  std::uint64_t lock_wait_ns;
+  std::uint64_t arena_switches;
+  std::uint64_t blocking_waits;
+};
+
+/**
+ * Everything one publish writes to the segment. Only 64 bit fields, the segment copies it word by word.
+ */
+struct AfStatsRecord {
+  // increases with every publish, so a reader can tell that the process is still publishing
+  std::uint64_t publish_count;
+  // system clock, nanoseconds since the epoch
+  std::uint64_t publish_time_ns;
+  // all the arenas, also the ones which did not fit to the records
+  std::uint64_t arena_count;
+  std::uint64_t large_mapped_size;
+  std::uint64_t large_maps;
+  std::uint64_t large_unmaps;
+  std::uint64_t heap_maps;
+  // purge passes which released pages of an arena, and the bytes they released
+  std::uint64_t trims;
+  std::uint64_t trimmed_size;
+  std::array<AfArenaStatsRecord, AF_STATS_MAX_ARENAS> arenas;
+};
+
+constexpr std::size_t AF_STATS_RECORD_WORDS = sizeof(AfStatsRecord) / sizeof(std::uint64_t);
+static_assert(sizeof(AfStatsRecord) % sizeof(std::uint64_t) == 0);
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "readers in other processes need lock free words");
+
+// "AFSTATS1", changes whenever the record does
+constexpr std::uint64_t AF_STATS_MAGIC = 0x3153'5441'5453'4641;
+
+/**
+ * Shared memory layout. sequence is the seqlock: odd while the writer copies the record, so a reader which saw
+ * it odd, or saw it change during its copy, copies again. The writer never waits for the readers.
+ */
+struct AfStatsSegmentLayout {
+  std::atomic<std::uint64_t> magic;
+  std::uint64_t pid;
+  std::atomic<std::uint64_t> sequence;
+  std::array<std::atomic<std::uint64_t>, AF_STATS_RECORD_WORDS> record;
+};
+
+/**
+ * Named shared memory segment /afmalloc-stats.<pid> to which one allocator of the process publishes its counters,
+ * read by afstat or anything else that knows the pid.
+ */
+class AfStatsSegment {
+  public:
+    /**
+     * Creates the segment of the calling process for writing. A segment with the same name left behind by a dead
+     * process which had the same pid is removed first.
+     * @return nullptr if the process already has a writer, or the segment can't be created
+     */
+    static std::unique_ptr<AfStatsSegment> create();
+
+    /**
+     * Maps the segment of the process read only
+     * @return nullptr if the process does not publish, or the segment is from an incompatible version
+     */
+    static std::unique_ptr<AfStatsSegment> open(pid_t pid);
+
+    static std::string getName(pid_t pid);
+
+    AfStatsSegment(const AfStatsSegment &) = delete;
+    AfStatsSegment &operator=(const AfStatsSegment &) = delete;
+
+    /**
+     * Unmaps the segment, the writer removes its name too
+     */
+    ~AfStatsSegment();
+
+    /**
+     * Only for the segment from create, and from one thread at a time
+     */
+    void publish(const AfStatsRecord &record);
+
+    /**
+     * Copies the last published record, retries while the writer is in the middle of a publish
+     * @return false if every attempt overlapped with a publish, out is not valid then
+     */
+    bool read(AfStatsRecord &out) const;
+
+  private:
+    AfStatsSegment(AfStatsSegmentLayout *layout, bool writer, pid_t pid);
+
+    AfStatsSegmentLayout *layout_{nullptr};
+    bool writer_{false};
+    pid_t pid_{0};
+};
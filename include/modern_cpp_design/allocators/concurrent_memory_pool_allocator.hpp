@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "memory_pool_allocator.hpp"
+
+namespace memory {
+
+// Blocks in one magazine, a thread caches at most two magazines per size class
+constexpr std::size_t DEFAULT_MAGAZINE_SIZE = 32;
+
+// Full magazines a depot keeps per size class, blocks of the ones beyond go back to the pool
+constexpr std::size_t DEFAULT_DEPOT_FULL_MAGAZINES = 16;
+
+/**
+ * Thread safe MemoryPoolAllocator, with the magazine layer of Bonwick's allocator in front of the pool.
+ *
+ * A magazine is a stack of free blocks of one size class. Every thread has two magazines per class, loaded and
+ * previous, and allocates from and frees to them without any lock. Previous is always either full or empty, so
+ * a thread which allocates and frees around the edge of a magazine only swaps the two. Only when both are empty
+ * for allocate, or both full for free, the thread exchanges a whole magazine with the depot of the class, which
+ * is one short critical section per magazine of blocks. The pool itself is behind a lock and is used only when
+ * the depot has no full magazine to hand out, or has enough of them already.
+ *
+ * Blocks cached in magazines stay allocated from the point of view of the pool. flushThreadCache gives back
+ * the magazines of a thread, and a new thread which reuses the id of an exited one takes over its magazines.
+ */
+class ConcurrentMemoryPoolAllocator {
+  public:
+    /**
+     * @param size_classes as for MemoryPoolAllocator
+     * @param magazine_size blocks in one magazine
+     */
+    explicit ConcurrentMemoryPoolAllocator(PageSizeAllocator &page_size_allocator,
+                                           std::span<const std::size_t> size_classes = DEFAULT_SIZE_CLASSES,
+                                           std::size_t magazine_size = DEFAULT_MAGAZINE_SIZE);
+
+    ConcurrentMemoryPoolAllocator(const ConcurrentMemoryPoolAllocator &) = delete;
+    ConcurrentMemoryPoolAllocator &operator=(const ConcurrentMemoryPoolAllocator &) = delete;
+
+    /**
+     * @return nullptr if no class is big enough for size, or aligned enough for alignment
+     */
+    void *allocate(std::size_t alignment, std::size_t size);
+
+    /**
+     * Any thread can free a block, not only the one which allocated it
+     * @param alignment and size the same as for allocate, they pick the magazine without a look into the pool,
+     * whose page table can only be read under its lock
+     */
+    void deallocate(void *ptr, std::size_t alignment, std::size_t size);
+
+    /**
+     * Gives the blocks cached by the calling thread back to the pool, for a thread which is about to exit
+     */
+    void flushThreadCache();
+
+    [[nodiscard]] std::size_t getBlockSize(std::size_t alignment, std::size_t size) const {
+        // size classes never change after construction
+        return pool_.getBlockSize(alignment, size);
+    }
+
+    /**
+     * Takes the pool lock, meant for asserts
+     */
+    [[nodiscard]] bool ownsBlock(const void *ptr);
+
+    /**
+     * Takes the pool lock, meant for asserts
+     * @return true if ptr is a block of the pool which lives in a slab of the class
+     */
+    [[nodiscard]] bool ownsBlockOfClass(const void *ptr, std::size_t size_class);
+
+    /**
+     * @return number of times a thread went to a depot, every other allocate and deallocate was thread local
+     */
+    [[nodiscard]] std::size_t getNumDepotExchanges() const {
+        return depot_exchanges_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Pool behind the depots, its counters are only valid while no other thread uses the allocator
+     */
+    [[nodiscard]] const MemoryPoolAllocator &getPool() const {
+        return pool_;
+    }
+
+    /**
+     * Gives the blocks of every magazine back to the pool, no thread may use the allocator any more
+     */
+    ~ConcurrentMemoryPoolAllocator();
+
+  private:
+    // capacity is the magazine size, blocks are pushed and popped at the back
+    using Magazine = std::vector<void *>;
+
+    struct alignas(CACHE_LINE_SIZE) ThreadMagazines {
+        Magazine loaded;
+        Magazine previous;
+    };
+
+    struct ThreadCache {
+        std::vector<ThreadMagazines> classes;
+    };
+
+    struct alignas(CACHE_LINE_SIZE) Depot {
+        std::mutex lock;
+        std::vector<Magazine> full;
+        std::vector<Magazine> empty;
+    };
+
+    ThreadCache &getThreadCache();
+
+    /**
+     * Makes loaded non empty, from previous, the depot or the pool
+     * @return false if the page allocator has no memory
+     */
+    bool reload(ThreadMagazines &magazines, std::size_t size_class);
+
+    /**
+     * Makes loaded non full, with previous or an empty magazine of the depot
+     */
+    void unload(ThreadMagazines &magazines, std::size_t size_class);
+
+    void drainToPool(Magazine &magazine);
+
+    Magazine makeMagazine() const;
+
+    const std::size_t instance_id_;
+
+    const std::size_t magazine_size_;
+
+    std::mutex pool_lock_;
+
+    MemoryPoolAllocator pool_;
+
+    std::unique_ptr<Depot[]> depots_;
+
+    std::atomic<std::size_t> depot_exchanges_{0};
+
+    std::mutex thread_caches_lock_;
+
+    std::unordered_map<std::thread::id, std::unique_ptr<ThreadCache>> thread_caches_;
+};
+
+} // namespace memory
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "memory_pool_allocator.hpp"
+
+namespace memory {
+
+// Blocks carved from the pool at once when the free stack runs empty
+constexpr std::size_t DEFAULT_REFILL_BLOCKS = 64;
+
+/**
+ * Pool of blocks of one size which any thread allocates and frees without a lock, for objects which are allocated
+ * on one thread and freed on another, where thread local caches don't help.
+ *
+ * Free blocks form a Treiber stack: the first bytes of a free block point to the next one, and the head is swapped
+ * with compare exchange. The head is a pointer with a tag which every push and pop increments, and both are
+ * compared in one 16 byte compare exchange. A pop which read the head, then lost the block to other threads which
+ * popped and pushed it back in the meantime, sees another tag and retries, instead of installing the stale next
+ * pointer it read (the ABA problem).
+ *
+ * Blocks are carved by a MemoryPoolAllocator with the block size as its only size class. Only the allocate which
+ * finds the stack empty takes the lock of the pool, to carve the next blocks, and reserve does that upfront.
+ * A pop may read the next pointer of a block which another thread has just popped and is writing to, so blocks
+ * never go back to the pool while the allocator is alive.
+ */
+class LockFreePoolAllocator {
+  public:
+    /**
+     * @param size and alignment of every block, size is rounded up to a multiple of alignment and of the pointer size
+     * @param refill_blocks blocks carved from the pool when the stack runs empty
+     */
+    LockFreePoolAllocator(PageSizeAllocator &page_size_allocator, std::size_t size, std::size_t alignment,
+                          std::size_t refill_blocks = DEFAULT_REFILL_BLOCKS);
+
+    LockFreePoolAllocator(const LockFreePoolAllocator &) = delete;
+    LockFreePoolAllocator &operator=(const LockFreePoolAllocator &) = delete;
+
+    /**
+     * @return nullptr if the stack is empty and the page allocator has no memory
+     */
+    void *allocate();
+
+    /**
+     * Any thread can free a block, not only the one which allocated it
+     */
+    void deallocate(void *ptr);
+
+    /**
+     * Carves blocks until at least count were carved in total, so allocations up to count never take the lock
+     * @return false if the page allocator ran out of memory
+     */
+    bool reserve(std::size_t count);
+
+    [[nodiscard]] std::size_t getBlockSize() const {
+        return block_size_;
+    }
+
+    /**
+     * @return blocks carved from the pool so far, free and in use
+     */
+    [[nodiscard]] std::size_t getNumCarvedBlocks() const {
+        return num_carved_blocks_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * All the blocks must be freed by now
+     */
+    ~LockFreePoolAllocator();
+
+  private:
+    /**
+     * Lives in the first bytes of a free block. next is written by the thread which pushes the block and read by
+     * every thread which tries to pop it, both through atomic_ref, as a late pop may read it after the block
+     * was handed out again.
+     */
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    static std::atomic_ref<FreeBlock *> getNext(FreeBlock *block) {
+        return std::atomic_ref<FreeBlock *>{block->next};
+    }
+
+    struct alignas(16) TaggedHead {
+        FreeBlock *block;
+        std::uintptr_t tag;
+    };
+
+    void pushChain(FreeBlock *first, FreeBlock *last);
+
+    /**
+     * Carves at most count blocks and pushes them, the refill lock must be held
+     * @return number of blocks carved
+     */
+    std::size_t carveLocked(std::size_t count);
+
+    /**
+     * @return false if the stack is still empty, because the page allocator ran out of memory
+     */
+    bool refill();
+
+    // apart from the pointers of the free blocks, so pushes and pops don't invalidate the line of the counters
+    alignas(CACHE_LINE_SIZE) std::atomic<TaggedHead> head_{TaggedHead{nullptr, 0}};
+
+    alignas(CACHE_LINE_SIZE) std::atomic<std::size_t> num_carved_blocks_{0};
+
+    const std::size_t block_size_;
+
+    const std::size_t refill_blocks_;
+
+    std::mutex refill_lock_;
+
+    MemoryPoolAllocator pool_;
+
+    // blocks of one refill, only used under the refill lock
+    std::vector<void *> refill_buffer_;
+};
+
+} // namespace memory
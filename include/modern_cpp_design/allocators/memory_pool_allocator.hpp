@@ -1,45 +1,154 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <cassert>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
 
 #include "page_size_allocator.hpp"
 
 namespace memory{
+// biggest block of the default size classes
 constexpr std::size_t BLOCK_SIZE = 512;
 constexpr std::size_t NUM_BLOCKS_PER_PAGE = PAGE_SIZE / BLOCK_SIZE;
 
+/**
+ * Powers of two from 16 to 512. A table made for the workload by af_size_class_profiler
+ * (--alignment 16 --max-size 512) can be passed to the constructor instead.
+ */
+constexpr std::array<std::size_t, 6> DEFAULT_SIZE_CLASSES{16, 32, 64, 128, 256, BLOCK_SIZE};
+
+// Empty pages kept for the next burst: once there are more than the high mark, slabs are given
+// back to the page allocator until at most the low mark of pages is left
+constexpr std::size_t DEFAULT_EMPTY_PAGES_HIGH = 16;
+constexpr std::size_t DEFAULT_EMPTY_PAGES_LOW = 4;
+
+// for the state which threads share
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// Pages of the first slab of a class, every next slab of the class is twice as big up to the max
+constexpr std::size_t DEFAULT_FIRST_SLAB_PAGES = 1;
+constexpr std::size_t DEFAULT_MAX_SLAB_PAGES = 16;
+
 /**
  * Currently very simplified implementation of memory pool. In case it needs more memory
  * it calls page_size_allocator which provides page aligned memory
- * Once memory is in the memory pool it splits the page on blocks of a size of 512.
- * This would mean that free blocks will be on page_size + 0, page_size+512, ..., page_size+(4096-512)
- * Hence, the only alignment allowed is up to 512 bytes. If a block of a bigger alignment
- * is required, it would fail. (I should add a test for that).
- * Also, since allocator does not track to which page which block belongs to,
- * in case of all blocks belonging to one page are freed
- * it won't free the whole page, hence this one is
+ * Once memory is in the memory pool it splits the page on blocks of the size of one size class.
+ * For 512 this would mean that free blocks will be on page_size + 0, page_size+512, ..., page_size+(4096-512)
+ * Hence, block of a class is aligned on the biggest power of two which divides the class size, and a request
+ * of a bigger alignment goes to the first bigger class which has it.
+ *
+ * Segregated fit: every size class carves its own slabs, and a request takes a block of the smallest class
+ * it fits. A slab is a run of pages taken from the page allocator at once. The first slab of a class has
+ * one page and every next one is twice as big, up to a cap, so a class which is used a lot goes to the page
+ * allocator less and less often. The slab of a block is found in a side table by masking the block address
+ * with the page size, every page of a slab has its entry.
+ *
+ * Blocks are carved lazily: a slab hands out blocks from a bump pointer, so the pages of a new slab are touched
+ * only when their blocks are used. Blocks which were freed go to the intrusive free list of the slab:
+ * the first bytes of every free block point to the next free block, so allocate and deallocate are O(1)
+ * and the pool needs no memory of its own per block. A class allocates from its slabs which have a free block.
+ * A slab whose blocks are all free again goes to the empty slabs, which any class can take, and which are given
+ * back to the page allocator with hysteresis between two marks, so the pool shrinks after a burst without
+ * giving back and taking again the same pages all the time.
+ *
+ * The pool does not know which blocks are in use, in the debug build deallocate only checks
+ * that the block is one of its blocks.
  */
 class MemoryPoolAllocator{
 
   public:
-      // no locking in case of multi threaded applications
-      explicit MemoryPoolAllocator(PageSizeAllocator &page_size_allocator): page_size_allocator_(page_size_allocator){}
+      /**
+       * no locking in case of multi threaded applications, ConcurrentMemoryPoolAllocator is the thread safe one
+       * @param size_classes ascending block sizes, multiples of the pointer size and at most PAGE_SIZE
+       */
+      explicit MemoryPoolAllocator(PageSizeAllocator &page_size_allocator,
+                                   std::span<const std::size_t> size_classes = DEFAULT_SIZE_CLASSES);
 
+      /**
+       * @return nullptr if no class is big enough for size, or aligned enough for alignment
+       */
       void *allocate(std::size_t alignment, std::size_t size);
 
       void deallocate(void *ptr);
 
+      /**
+       * Allocates `count` blocks of one size class, for callers which cache blocks of their own
+       * @param size_class index from findSizeClass
+       * @param out_ptrs array of at least `count` elements which receives the blocks
+       * @return number of blocks allocated, less than `count` only if the page allocator ran out of memory
+       */
+      std::size_t allocateBatch(std::size_t size_class, std::size_t count, void **out_ptrs);
+
+      void deallocateBatch(void *const *ptrs, std::size_t count);
+
       void release();
 
+      /**
+       * @return free blocks of the pages of the pool, empty pages included
+       */
       [[nodiscard]] std::size_t getNumFreeBlocks() const {
-          return free_pointers_.size();
+          return num_free_blocks_;
       }
 
       [[nodiscard]] std::size_t getNumUsedBlocks() const {
-          return used_pointers_.size();
+          return num_used_blocks_;
+      }
+
+      [[nodiscard]] std::size_t getNumPages() const {
+          return page_slabs_.size();
       }
 
+      /**
+       * @return number of times the pool went to the page allocator for a new slab
+       */
+      [[nodiscard]] std::size_t getNumRefills() const {
+          return slabs_allocated_;
+      }
+
+      [[nodiscard]] std::size_t getNumEmptyPages() const {
+          return num_empty_pages_;
+      }
+
+      /**
+       * Once there are more than high empty pages, their slabs are given back to the page allocator until at most
+       * low pages are left. high 0 gives back every slab as soon as it is empty.
+       */
+      void setEmptyPageMarks(std::size_t low, std::size_t high);
+
+      /**
+       * Sizes of the slabs of the classes which take a new slab from now on
+       * @param first pages of the first slab of a class
+       * @param max pages of the biggest slab, slabs double up to it
+       */
+      void setSlabPages(std::size_t first, std::size_t max);
+
+      /**
+       * @return index of the class of the request, or getNumSizeClasses() if there is none
+       */
+      [[nodiscard]] std::size_t findSizeClass(std::size_t alignment, std::size_t size) const;
+
+      [[nodiscard]] std::size_t getNumSizeClasses() const {
+          return size_classes_.size();
+      }
+
+      /**
+       * @return size of the block which allocate gives for size and alignment, 0 if there is none
+       */
+      [[nodiscard]] std::size_t getBlockSize(std::size_t alignment, std::size_t size) const;
+
+      /**
+       * @return true if ptr is the start of a block of one of the pages of this pool
+       */
+      [[nodiscard]] bool ownsBlock(const void *ptr) const;
+
+      /**
+       * @return class of the slab of ptr, which has to be a block of this pool
+       */
+      [[nodiscard]] std::size_t getSizeClass(const void *ptr) const;
+
       ~MemoryPoolAllocator() {
         release();
       }
@@ -47,29 +156,121 @@ class MemoryPoolAllocator{
   private:
 
     /**
-     * List of free pointers of a size of 512
+     * Lives in the first bytes of a free block
      */
-    std::vector<void*> free_pointers_;
+    struct FreeBlock {
+        FreeBlock *next;
+    };
 
     /**
-     * List of a used pointers.
+     * Bookkeeping of one slab, kept outside of the slab so blocks use all of its pages
      */
-    std::vector<void*> used_pointers_;
+    struct PoolSlab {
+        void *memory;
+        std::size_t num_pages;
+        // blocks which were freed
+        FreeBlock *free_list{nullptr};
+        // next block which was never handed out, up to end
+        char *bump{nullptr};
+        char *end{nullptr};
+        std::size_t size_class{0};
+        std::size_t used{0};
+        // in the list of the class slabs which have a free block, or in the empty slabs
+        PoolSlab *prev{nullptr};
+        PoolSlab *next{nullptr};
+
+        [[nodiscard]] bool isFull(const std::size_t block_size) const {
+            return free_list == nullptr && static_cast<std::size_t>(end - bump) < block_size;
+        }
+    };
+
+    struct SizeClass {
+        std::size_t block_size;
+
+        /**
+         * Slabs of the class which have a free block and at least one block in use
+         */
+        PoolSlab *partial_slabs{nullptr};
+
+        /**
+         * Pages of the next new slab of the class
+         */
+        std::size_t next_slab_pages{DEFAULT_FIRST_SLAB_PAGES};
+    };
+
+    /**
+     * @return nullptr if the page allocator has no memory
+     */
+    void *allocateFromClass(std::size_t size_class);
+
+    /**
+     * Takes an empty slab, or a new one from the page allocator, for the class
+     * @return nullptr if the page allocator has no memory
+     */
+    PoolSlab *takeSlab(std::size_t size_class);
+
+    /**
+     * Gives empty slabs back to the page allocator until at most `keep` empty pages are left
+     */
+    void trimEmptyPages(std::size_t keep);
+
+    static void pushSlab(PoolSlab *&list, PoolSlab *slab);
+
+    static void unlinkSlab(PoolSlab *&list, PoolSlab *slab);
+
+    // empty slabs are pushed at the head and trimmed from the tail, the counter of empty pages follows them
+    void pushEmptySlab(PoolSlab *slab);
+
+    void unlinkEmptySlab(PoolSlab *slab);
+
+    static const void *getPage(const void *ptr) {
+        return reinterpret_cast<const void *>(reinterpret_cast<std::uintptr_t>(ptr) & ~(PAGE_SIZE - 1));
+    }
+
+    [[nodiscard]] std::size_t getBlocksPerSlab(const PoolSlab &slab) const {
+        return slab.num_pages * PAGE_SIZE / size_classes_[slab.size_class].block_size;
+    }
+
+    std::vector<SizeClass> size_classes_;
+
+    std::size_t num_free_blocks_{0};
+
+    std::size_t num_used_blocks_{0};
 
     /**
-      * List of pointers to the beginning of the page. We can't free
-      * each block, but we can only return whole page
+      * Every slab of the pool by the address of its first page. Nodes of the map don't move,
+      * so slabs are linked in place.
       */
-    std::vector<void*> pages_ptrs_;
+    std::unordered_map<const void*, PoolSlab> slabs_;
+
+    /**
+     * Slab of every page of the pool
+     */
+    std::unordered_map<const void*, PoolSlab*> page_slabs_;
+
+    /**
+     * Slabs with no block in use, taken by whichever class runs out of blocks first
+     */
+    PoolSlab *empty_slabs_{nullptr};
+
+    PoolSlab *empty_slabs_tail_{nullptr};
+
+    std::size_t num_empty_pages_{0};
+
+    std::size_t empty_pages_low_{DEFAULT_EMPTY_PAGES_LOW};
+
+    std::size_t empty_pages_high_{DEFAULT_EMPTY_PAGES_HIGH};
+
+    std::size_t max_slab_pages_{DEFAULT_MAX_SLAB_PAGES};
 
       /**
-       * Number of pages allocated in total
+       * Number of slabs allocated in total
        */
-    std::size_t pages_allocated_{0};
+    std::size_t slabs_allocated_{0};
 
     PageSizeAllocator &page_size_allocator_;
 
 
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "memory_pool_allocator.hpp"
+
+namespace memory {
+
+/**
+ * Pool of objects of type T. Block size and alignment come from T at compile time: a slot is a union of the storage
+ * of one T and the pointer to the next free slot, so a free slot needs no memory besides its own storage and
+ * there is no bookkeeping per object. create pops a free slot and constructs T in it, destroy destroys the object
+ * and pushes its slot, both O(1).
+ *
+ * Slots come from a MemoryPoolAllocator which has the slot size as its only size class, a page worth of them at
+ * once when the free slots run out. Free slots stay in the object pool until shrink gives them back to the pool.
+ *
+ * no locking in case of multi threaded applications
+ */
+template <typename T>
+class ObjectPool {
+    union Slot {
+        Slot *next;
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+  public:
+    static constexpr std::size_t BLOCK_SIZE = sizeof(Slot);
+    static constexpr std::size_t ALIGNMENT = alignof(Slot);
+    // slots taken from the pool when the free slots run out
+    static constexpr std::size_t REFILL_SLOTS = std::max<std::size_t>(1, PAGE_SIZE / BLOCK_SIZE);
+
+    static_assert(BLOCK_SIZE <= PAGE_SIZE, "slots are carved from pages");
+    static_assert(ALIGNMENT <= PAGE_SIZE, "slots are at most page aligned");
+
+    /**
+     * Owns one object of the pool and destroys it when it goes out of scope, like unique_ptr
+     */
+    class Handle {
+      public:
+        Handle() = default;
+
+        Handle(Handle &&other) noexcept
+            : pool_(other.pool_), object_(std::exchange(other.object_, nullptr)) {}
+
+        Handle &operator=(Handle &&other) noexcept {
+            if(this != &other) {
+                reset();
+                pool_ = other.pool_;
+                object_ = std::exchange(other.object_, nullptr);
+            }
+            return *this;
+        }
+
+        Handle(const Handle &) = delete;
+        Handle &operator=(const Handle &) = delete;
+
+        ~Handle() {
+            reset();
+        }
+
+        [[nodiscard]] T *get() const {
+            return object_;
+        }
+
+        T &operator*() const {
+            return *object_;
+        }
+
+        T *operator->() const {
+            return object_;
+        }
+
+        explicit operator bool() const {
+            return object_ != nullptr;
+        }
+
+        /**
+         * The object is not destroyed, it must be given to destroy of its pool later
+         */
+        [[nodiscard]] T *release() {
+            return std::exchange(object_, nullptr);
+        }
+
+        void reset() {
+            if(object_ != nullptr) {
+                pool_->destroy(std::exchange(object_, nullptr));
+            }
+        }
+
+      private:
+        friend class ObjectPool;
+
+        Handle(ObjectPool *pool, T *object) : pool_(pool), object_(object) {}
+
+        ObjectPool *pool_{nullptr};
+        T *object_{nullptr};
+    };
+
+    explicit ObjectPool(PageSizeAllocator &page_size_allocator)
+        : pool_(page_size_allocator, SIZE_CLASSES) {}
+
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+    /**
+     * Constructs T from args in a free slot. If the constructor throws, the slot is free again.
+     * @throws std::bad_alloc if there is no free slot and the page allocator has no memory
+     */
+    template <typename... Args>
+    [[nodiscard]] Handle create(Args &&...args) {
+        Slot *slot = takeSlot();
+        T *object{nullptr};
+        try {
+            object = ::new(static_cast<void *>(slot->storage)) T(std::forward<Args>(args)...);
+        } catch(...) {
+            putSlot(slot);
+            throw;
+        }
+        num_objects_ += 1;
+        return Handle{this, object};
+    }
+
+    /**
+     * For objects released from their handle
+     */
+    void destroy(T *object) {
+        assert(object != nullptr);
+        assert(num_objects_ > 0);
+        std::destroy_at(object);
+        num_objects_ -= 1;
+        putSlot(reinterpret_cast<Slot *>(object));
+    }
+
+    /**
+     * Gives every free slot back to the pool, which gives its empty pages back to the page allocator
+     */
+    void shrink() {
+        while(free_slots_ != nullptr) {
+            Slot *slot = free_slots_;
+            free_slots_ = slot->next;
+            pool_.deallocate(slot);
+        }
+        num_free_slots_ = 0;
+    }
+
+    [[nodiscard]] std::size_t getNumObjects() const {
+        return num_objects_;
+    }
+
+    [[nodiscard]] std::size_t getNumFreeSlots() const {
+        return num_free_slots_;
+    }
+
+    [[nodiscard]] const MemoryPoolAllocator &getPool() const {
+        return pool_;
+    }
+
+    /**
+     * All the objects must be destroyed by now
+     */
+    ~ObjectPool() {
+        assert(num_objects_ == 0);
+        shrink();
+    }
+
+  private:
+    static constexpr std::array<std::size_t, 1> SIZE_CLASSES{BLOCK_SIZE};
+
+    Slot *takeSlot() {
+        if(free_slots_ == nullptr) {
+            refill();
+        }
+        Slot *slot = free_slots_;
+        free_slots_ = slot->next;
+        num_free_slots_ -= 1;
+        return slot;
+    }
+
+    void putSlot(Slot *slot) {
+        slot->next = free_slots_;
+        free_slots_ = slot;
+        num_free_slots_ += 1;
+    }
+
+    void refill() {
+        std::array<void *, REFILL_SLOTS> slots{};
+        const std::size_t allocated = pool_.allocateBatch(0, slots.size(), slots.data());
+        if(allocated == 0) {
+            throw std::bad_alloc{};
+        }
+        // pushed in reverse, so slots are handed out in the address order of the page
+        for(std::size_t i{allocated}; i > 0; i--) {
+            putSlot(static_cast<Slot *>(slots[i - 1]));
+        }
+    }
+
+    MemoryPoolAllocator pool_;
+
+    Slot *free_slots_{nullptr};
+
+    std::size_t num_free_slots_{0};
+
+    std::size_t num_objects_{0};
+};
+
+} // namespace memory
@@ -0,0 +1,168 @@
+// Offline tool which reads allocation sizes and writes a constexpr header with the size classes which waste
+// the least memory on rounding for the given number of classes.
+//
+// af_size_class_profiler [--classes N] [--alignment A] [--max-size M] [--name NAME] [input]
+//
+// Input is read from the file or from stdin, one request per line:
+//   <size>             one request of size bytes, as in an allocation trace
+//   <size> <count>     count requests of size bytes, as in a sampled histogram
+//   malloc <size>      trace event, lines of any other event (free, ...) are skipped
+// Lines starting with # are comments.
+//
+// The slab tier of AfMalloc takes the table with the following, its classes keep the 16 byte alignment of malloc,
+// so the table has to be made with --alignment 16
+//   af_size_class_profiler --alignment 16 --max-size 64 --name AF_SLAB_SIZE_CLASSES trace.txt > af_slab_classes.hpp
+//   cmake -DAFMALLOC_SLAB_CLASSES_HEADER=/path/to/af_slab_classes.hpp
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "AfSizeClassProfiler.hpp"
+
+namespace {
+struct ProfilerOptions {
+  std::size_t num_classes{8};
+  std::size_t alignment{16};
+  std::size_t max_size{512};
+  std::string name{"AF_SIZE_CLASSES"};
+  std::string input{};
+};
+
+std::optional<std::size_t> parseNumber(const std::string &text) {
+    std::size_t value{0};
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if(error != std::errc{} || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+std::optional<ProfilerOptions> parseArguments(const int argc, char **argv) {
+    ProfilerOptions options{};
+    for(int i{1}; i < argc; i++) {
+        const std::string argument{argv[i]};
+        if(argument.starts_with("--") && i + 1 < argc) {
+            const std::string value{argv[++i]};
+            if(argument == "--name") {
+                options.name = value;
+                continue;
+            }
+            const auto number = parseNumber(value);
+            if(!number || *number == 0) {
+                return std::nullopt;
+            }
+            if(argument == "--classes") {
+                options.num_classes = *number;
+            } else if(argument == "--alignment") {
+                options.alignment = *number;
+            } else if(argument == "--max-size") {
+                options.max_size = *number;
+            } else {
+                return std::nullopt;
+            }
+        } else if(!argument.starts_with("--") && options.input.empty()) {
+            options.input = argument;
+        } else {
+            return std::nullopt;
+        }
+    }
+    if(options.max_size % options.alignment != 0) {
+        return std::nullopt;
+    }
+    return options;
+}
+
+/**
+ * @return false if some line is neither a comment, nor one of the request formats
+ */
+bool readHistogram(std::istream &input, std::vector<AfSizeCount> &histogram) {
+    std::string line;
+    while(std::getline(input, line)) {
+        std::istringstream tokens{line};
+        std::string first;
+        if(!(tokens >> first) || first.starts_with('#')) {
+            continue;
+        }
+        std::string second;
+        tokens >> second;
+        if(const auto size = parseNumber(first)) {
+            const auto count = second.empty() ? std::optional<std::size_t>{1} : parseNumber(second);
+            if(!count) {
+                return false;
+            }
+            histogram.push_back({*size, *count});
+        } else if(first == "malloc") {
+            const auto event_size = parseNumber(second);
+            if(!event_size) {
+                return false;
+            }
+            histogram.push_back({*event_size, 1});
+        }
+    }
+    return true;
+}
+
+double getPercent(const std::size_t part, const std::size_t total) {
+    return total == 0 ? 0.0 : 100.0 * static_cast<double>(part) / static_cast<double>(total);
+}
+
+void writeHeader(std::ostream &out, const ProfilerOptions &options, const std::vector<AfSizeCount> &histogram,
+                 const AfSizeClassTable &table) {
+    std::vector<std::size_t> spaced_classes{};
+    for(std::size_t size{options.alignment}; size <= options.max_size; size += options.alignment) {
+        spaced_classes.push_back(size);
+    }
+    const std::size_t spaced_waste = getRoundingWaste(histogram, spaced_classes);
+
+    out << "#pragma once\n";
+    out << "// Generated by af_size_class_profiler, do not edit\n";
+    out << "// input: " << (options.input.empty() ? "stdin" : options.input) << ", " << table.skipped_requests
+        << " requests bigger than " << options.max_size << " bytes not covered\n";
+    out << std::format("// wasted {} of {} requested bytes ({:.2f}%), {} byte spacing would waste {} ({:.2f}%)\n",
+                       table.wasted_bytes, table.requested_bytes, getPercent(table.wasted_bytes, table.requested_bytes),
+                       options.alignment, spaced_waste, getPercent(spaced_waste, table.requested_bytes));
+    out << "#include <array>\n#include <cstddef>\n\n";
+    out << "constexpr std::array<std::size_t, " << table.classes.size() << "> " << options.name << "{";
+    for(std::size_t i{0}; i < table.classes.size(); i++) {
+        out << (i == 0 ? "" : ", ") << table.classes[i];
+    }
+    out << "};\n";
+}
+}
+
+int main(int argc, char **argv) {
+    const auto options = parseArguments(argc, argv);
+    if(!options) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--classes N] [--alignment A] [--max-size M, multiple of A] [--name NAME] [input]\n"
+                  << "the slab table of AfMalloc needs --alignment 16" << std::endl;
+        return 2;
+    }
+
+    std::vector<AfSizeCount> histogram{};
+    std::ifstream file{};
+    if(!options->input.empty()) {
+        file.open(options->input);
+        if(!file) {
+            std::cerr << "can't open " << options->input << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+    }
+    if(!readHistogram(options->input.empty() ? std::cin : file, histogram)) {
+        std::cerr << "input is neither a trace nor a histogram" << std::endl;
+        return 1;
+    }
+
+    const AfSizeClassTable table = computeSizeClasses(histogram, options->num_classes, options->alignment,
+                                                      options->max_size);
+    writeHeader(std::cout, *options, histogram, table);
+    return 0;
+}
@@ -0,0 +1,137 @@
+// Prints the counters an allocator of a running process publishes with startStatsPublisher.
+// The process is never stopped, afstat only maps the stats segment of the process read only.
+//
+// afstat [--interval MS] [--count N] pid
+//
+// Without --interval the counters are printed once. With it they are printed every MS milliseconds,
+// N times or until the process exits.
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <format>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include "AfStatsSegment.hpp"
+
+namespace {
+struct AfstatOptions {
+  pid_t pid{0};
+  std::chrono::milliseconds interval{0};
+  // 0 prints until the process exits
+  std::size_t count{0};
+};
+
+std::optional<std::size_t> parseNumber(const std::string &text) {
+    std::size_t value{0};
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if(error != std::errc{} || end != text.data() + text.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+std::optional<AfstatOptions> parseArguments(const int argc, char **argv) {
+    AfstatOptions options{};
+    for(int i{1}; i < argc; i++) {
+        const std::string argument{argv[i]};
+        if(argument.starts_with("--") && i + 1 < argc) {
+            const auto number = parseNumber(argv[++i]);
+            if(!number) {
+                return std::nullopt;
+            }
+            if(argument == "--interval") {
+                options.interval = std::chrono::milliseconds{*number};
+            } else if(argument == "--count") {
+                options.count = *number;
+            } else {
+                return std::nullopt;
+            }
+        } else if(const auto pid = parseNumber(argument); pid && options.pid == 0) {
+            options.pid = static_cast<pid_t>(*pid);
+        } else {
+            return std::nullopt;
+        }
+    }
+    if(options.pid == 0) {
+        return std::nullopt;
+    }
+    if(options.interval.count() == 0) {
+        options.count = 1;
+    }
+    return options;
+}
+
+std::string formatSize(const std::uint64_t size) {
+    if(size >= 1024 * 1024 * 1024) {
+        return std::format("{:.1f}G", static_cast<double>(size) / (1024.0 * 1024 * 1024));
+    }
+    if(size >= 1024 * 1024) {
+        return std::format("{:.1f}M", static_cast<double>(size) / (1024.0 * 1024));
+    }
+    if(size >= 1024) {
+        return std::format("{:.1f}K", static_cast<double>(size) / 1024.0);
+    }
+    return std::format("{}", size);
+}
+
+void printRecord(const AfstatOptions &options, const AfStatsRecord &record) {
+    std::cout << std::format("pid {}  publish {}  arenas {}\n", options.pid, record.publish_count, record.arena_count);
+    std::cout << std::format("large mapped {}  large maps {}  large unmaps {}  heap maps {}  trims {}  trimmed {}\n",
+                             formatSize(record.large_mapped_size), record.large_maps, record.large_unmaps,
+                             record.heap_maps, record.trims, formatSize(record.trimmed_size));
+    std::cout << std::format("{:>5} {:>9} {:>9} {:>9} {:>5} {:>5} {:>8} {:>8} {:>10} {:>9} {:>9} {:>8} {:>8}\n",
+                             "arena", "allocated", "top free", "slabs", "fast", "small", "unsorted", "max walk",
+                             "locks", "try fails", "wait ms", "switches", "blocking");
+    const std::size_t recorded = std::min<std::size_t>(record.arena_count, AF_STATS_MAX_ARENAS);
+    for(std::size_t i{0}; i < recorded; i++) {
+        const AfArenaStatsRecord &arena = record.arenas[i];
+        std::cout << std::format("{:>5} {:>9} {:>9} {:>9} {:>5} {:>5} {:>8} {:>8} {:>10} {:>9} {:>9} {:>8} {:>8}\n",
+                                 i, formatSize(arena.allocated_size), formatSize(arena.top_free_size),
+                                 formatSize(arena.slab_allocated_size), arena.fast_bins_used, arena.small_bins_used,
+                                 arena.unsorted_used, arena.max_unsorted_walk, arena.lock_acquisitions,
+                                 arena.try_lock_failures, arena.lock_wait_ns / 1'000'000, arena.arena_switches,
+                                 arena.blocking_waits);
+    }
+    std::cout << std::endl;
+}
+
+bool isProcessAlive(const pid_t pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+}
+
+int main(int argc, char **argv) {
+    const auto options = parseArguments(argc, argv);
+    if(!options) {
+        std::cerr << "usage: " << argv[0] << " [--interval MS] [--count N] pid" << std::endl;
+        return 2;
+    }
+    const auto segment = AfStatsSegment::open(options->pid);
+    if(segment == nullptr) {
+        std::cerr << "process " << options->pid << " does not publish allocator stats ("
+                  << AfStatsSegment::getName(options->pid) << ")" << std::endl;
+        return 1;
+    }
+
+    auto record = std::make_unique<AfStatsRecord>();
+    for(std::size_t printed{0}; options->count == 0 || printed < options->count; printed++) {
+        if(printed != 0) {
+            std::this_thread::sleep_for(options->interval);
+            if(!isProcessAlive(options->pid)) {
+                std::cerr << "process " << options->pid << " exited" << std::endl;
+                return 0;
+            }
+        }
+        if(!segment->read(*record)) {
+            std::cerr << "counters changed during every read, try again" << std::endl;
+            return 1;
+        }
+        printRecord(*options, *record);
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "AfCoroutineFrame.hpp"
+#include "AfMalloc.hpp"
+
+
+namespace {
+struct FramePool;
+
+/**
+ * In front of every frame, so free knows the pool of the frame without a lookup. Free frame keeps the link
+ * to the next free frame right after the header.
+ */
+struct FrameHeader {
+  // nullptr for the frames too big to be pooled
+  FramePool *owner;
+  std::size_t size_index;
+};
+
+static_assert(sizeof(FrameHeader) == FRAME_SIZE_SPACING);
+
+struct FreeFrame {
+  FrameHeader header;
+  FreeFrame *next;
+};
+
+struct FramePool {
+  std::array<FreeFrame *, NUM_FRAME_SIZES> free_frames{};
+  std::array<std::size_t, NUM_FRAME_SIZES> free_counts{};
+  // frames freed by other threads, pushed by them and taken all at once by the owner
+  std::atomic<FreeFrame *> remote_frees{nullptr};
+  AfCoroutineFrameStats stats{};
+};
+
+// Frames may be freed by destructors of other statics, so neither of these is ever destroyed
+AfMalloc &frameAfMalloc() {
+    static auto *af_malloc = new AfMalloc{};
+    return *af_malloc;
+}
+
+std::mutex pools_lock{};
+
+std::vector<FramePool *> &abandonedPools() {
+    static auto *pools = new std::vector<FramePool *>{};
+    return *pools;
+}
+
+/**
+ * Pool of the thread. When the thread exits the pool is abandoned together with its free frames, and
+ * taken over by the next thread which needs a pool. Frames of the pool still in use can be freed any time,
+ * they go to the remote frees of the pool.
+ */
+class ThreadPoolHolder {
+  public:
+    FramePool *get() {
+      if(pool_ == nullptr) {
+        std::lock_guard lock{pools_lock};
+        if(abandonedPools().empty()) {
+          pool_ = new FramePool{};
+        } else {
+          pool_ = abandonedPools().back();
+          abandonedPools().pop_back();
+        }
+      }
+      return pool_;
+    }
+
+    [[nodiscard]] FramePool *peek() const {
+      return pool_;
+    }
+
+    ~ThreadPoolHolder() {
+      if(pool_ != nullptr) {
+        std::lock_guard lock{pools_lock};
+        abandonedPools().push_back(pool_);
+        pool_ = nullptr;
+      }
+    }
+
+  private:
+    FramePool *pool_{nullptr};
+};
+
+thread_local ThreadPoolHolder thread_pool{};
+
+std::size_t getFrameSizeIndex(const std::size_t size) {
+    return (size + sizeof(FrameHeader) + FRAME_SIZE_SPACING - 1) / FRAME_SIZE_SPACING;
+}
+
+void pushFreeFrame(FramePool &pool, FreeFrame *frame) {
+    const std::size_t index = frame->header.size_index;
+    if(pool.free_counts[index] == MAX_CACHED_FRAMES) {
+        frameAfMalloc().free(frame);
+        return;
+    }
+    frame->next = pool.free_frames[index];
+    pool.free_frames[index] = frame;
+    pool.free_counts[index]++;
+}
+
+void drainRemoteFrees(FramePool &pool) {
+    FreeFrame *frame = pool.remote_frees.exchange(nullptr, std::memory_order_acquire);
+    while(frame != nullptr) {
+        FreeFrame *next = frame->next;
+        pushFreeFrame(pool, frame);
+        pool.stats.remote_frees++;
+        frame = next;
+    }
+}
+
+void refill(FramePool &pool, const std::size_t index) {
+    std::array<void *, FRAME_REFILL_COUNT> frames{};
+    const std::size_t allocated = frameAfMalloc().mallocBatch(index * FRAME_SIZE_SPACING, frames.size(), frames.data());
+    for(std::size_t i{0}; i < allocated; i++) {
+        auto *frame = static_cast<FreeFrame *>(frames[i]);
+        frame->header = {&pool, index};
+        frame->next = pool.free_frames[index];
+        pool.free_frames[index] = frame;
+    }
+    pool.free_counts[index] += allocated;
+    pool.stats.refills++;
+}
+}
+
+void *allocateCoroutineFrame(const std::size_t size) {
+    const std::size_t index = getFrameSizeIndex(size);
+    if(index >= NUM_FRAME_SIZES) {
+        auto *header = static_cast<FrameHeader *>(frameAfMalloc().malloc(index * FRAME_SIZE_SPACING));
+        if(header == nullptr) {
+            throw std::bad_alloc{};
+        }
+        *header = {nullptr, index};
+        return header + 1;
+    }
+
+    FramePool &pool = *thread_pool.get();
+    if(pool.free_frames[index] == nullptr) {
+        drainRemoteFrees(pool);
+    }
+    if(pool.free_frames[index] == nullptr) {
+        refill(pool, index);
+        if(pool.free_frames[index] == nullptr) {
+            throw std::bad_alloc{};
+        }
+    } else {
+        pool.stats.reused++;
+    }
+    FreeFrame *frame = pool.free_frames[index];
+    pool.free_frames[index] = frame->next;
+    pool.free_counts[index]--;
+    return &frame->header + 1;
+}
+
+void freeCoroutineFrame(void *frame, std::size_t) {
+    auto *free_frame = reinterpret_cast<FreeFrame *>(static_cast<FrameHeader *>(frame) - 1);
+    FramePool *owner = free_frame->header.owner;
+    if(owner == nullptr) {
+        frameAfMalloc().free(free_frame);
+        return;
+    }
+    if(owner == thread_pool.peek()) {
+        pushFreeFrame(*owner, free_frame);
+        return;
+    }
+    // frame of some other thread, or of an abandoned pool
+    FreeFrame *head = owner->remote_frees.load(std::memory_order_relaxed);
+    do {
+        free_frame->next = head;
+    } while(!owner->remote_frees.compare_exchange_weak(head, free_frame, std::memory_order_release,
+                                                       std::memory_order_relaxed));
+}
+
+AfCoroutineFrameStats getCoroutineFrameStats() {
+    const FramePool *pool = thread_pool.peek();
+    return pool != nullptr ? pool->stats : AfCoroutineFrameStats{};
+}
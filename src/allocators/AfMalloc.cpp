@@ -4,12 +4,26 @@
 #include <cassert>
 #include <memory>
 #include <cstring>
+#include <cstdlib>
 #include <optional>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
 
 #include "AfMalloc.hpp"
 
+#include <sched.h>
 #include <sys/mman.h>
+#include <sys/sysinfo.h>
+// cpu_id of rseq is found from the thread pointer, which not every compiler gives as a builtin on every target
+#if __has_include(<sys/rseq.h>) && defined(__has_builtin)
+#if __has_builtin(__builtin_thread_pointer)
+#include <sys/rseq.h>
+#define AFMALLOC_RSEQ_CPU_ID 1
+#endif
+#endif
 
 #define MMAP(addr, size, prot, flags) \
  mmap(addr, (size), (prot), (flags)|MAP_ANONYMOUS|MAP_PRIVATE, -1, 0)
@@ -110,54 +124,55 @@ bool isChunkCoalescable(const Chunk &chunk) {
 }
 
 
-AfArena::AfArena() : bin_indexes_(2) {
+AfArena::AfArena(const bool with_lifetime_arenas) : bin_indexes_(2) {
     // TODO eat own dog food for bin indexes?
+    // TODO this should be implemented that we allocate memory with our own allocator and size
+    fast_chunks_.resize(NUM_FAST_CHUNKS, {0, 0, nullptr, nullptr});
+    small_chunks_.resize(NUM_SMALL_CHUNKS, {0, 0, nullptr, nullptr});
+    // Set chunks to point to itself
+    clearBins();
+    // created upfront, so they can be visited without the lock. No heap is mapped until they are used.
+    if(with_lifetime_arenas) {
+        for(auto &lifetime_arena: lifetime_arenas_) {
+            lifetime_arena = std::make_unique<AfArena>(false);
+        }
+    }
 }
 
-
-void AfMalloc::moveToUnsortedLargeChunks(Chunk *free_chunk) {
-    Chunk *next_chunk = af_arena_.unsorted_large_chunks_.getNext();
-
-    free_chunk->setNext(next_chunk);
-    next_chunk->setPrev(free_chunk);
-
-
-    free_chunk->setPrev(&af_arena_.unsorted_large_chunks_);
-    af_arena_.unsorted_large_chunks_.setNext(free_chunk);
-
-}
-
-void AfMalloc::moveToFastBinsChunks(Chunk *free_chunk, std::size_t bit_index) {
-    auto &fast_bin_head = af_arena_.fast_chunks_[bit_index];
-    auto *next = fast_bin_head.getNext();
-    fast_bin_head.setNext(free_chunk);
-
-    free_chunk->setPrev(&fast_bin_head);
-    free_chunk->setNext(next);
-
-    next->setPrev(free_chunk);
+void AfArena::clearBins() {
+    std::ranges::for_each(fast_chunks_, [](Chunk &chunk) {
+        chunk.setNext(&chunk);
+        chunk.setPrev(&chunk);
+    });
+    std::ranges::for_each(small_chunks_, [](Chunk &chunk) {
+        chunk.setNext(&chunk);
+        chunk.setPrev(&chunk);
+    });
+    unsorted_large_chunks_.setNext(&unsorted_large_chunks_);
+    unsorted_large_chunks_.setPrev(&unsorted_large_chunks_);
+    unsorted_chunks_.setNext(&unsorted_chunks_);
+    unsorted_chunks_.setPrev(&unsorted_chunks_);
+    // only FAST and SMALL bin indexes live here
+    std::ranges::for_each(bin_indexes_, [](auto &bin_index) {
+        bin_index.reset();
+    });
 }
 
-void AfMalloc::moveToSmallBinsChunks(Chunk *free_chunk, std::size_t bit_index) {
-    auto &small_bin_head = af_arena_.small_chunks_[bit_index];
-    auto *next = small_bin_head.getNext();
-    small_bin_head.setNext(free_chunk);
 
-    free_chunk->setPrev(&small_bin_head);
-    free_chunk->setNext(next);
-
-    next->setPrev(free_chunk);
+AfHeap *getHeapForChunk(const void *ptr) {
+    const auto heap_memory_start = reinterpret_cast<uintptr_t>(ptr) & ~(HEAP_MAX_SIZE - 1);
+    return reinterpret_cast<AfHeap *>(heap_memory_start - HEAP_HEADER_SIZE);
 }
 
-void AfMalloc::extendTopChunk(){
-    auto *top_chunk = static_cast<Chunk *>(getTop());
-    assert(top_chunk->isPrevFree());
-    Chunk *prev_chunk = moveToThePreviousChunk(top_chunk, top_chunk->getPrevSize());
-    assert(prev_chunk->getNext() == nullptr && prev_chunk->getPrev() == nullptr);
-    clearUpDataSpaceOfChunk(prev_chunk);
-    af_arena_.top_ = prev_chunk;
-    prev_chunk->unsetPrevFree();
-    prev_chunk->setSize(0);
+/**
+ * Chunk is handed out to the user, so the chunk after it must not think any more that we are free
+ * @param chunk chunk which is already unlinked from the free lists
+ */
+void markChunkInUse(Chunk *chunk) {
+    Chunk *next_chunk = moveToTheNextChunk(chunk, chunk->getSize());
+    next_chunk->unsetPrevFree();
+    // this part of memory will be used by our chunk also, hence we need to zero the memory
+    next_chunk->setPrevSize(0x0000);
 }
 
 void unlinkChunk(Chunk* chunk) {
@@ -176,570 +191,708 @@ void unlinkChunk(Chunk* chunk) {
     chunk->setPrev(nullptr);
 }
 
-AfMalloc::AfMalloc() {
-    init();
+std::size_t getMaxFastBinBitIndex() {
+    return FAST_BIN_RANGE_END / BIN_SPACING_SIZE;
 }
 
-AfMalloc::AfMalloc(bool track_pointers) :track_pointers_(track_pointers) {
-    init();
+std::size_t getMaxSmallBinBitIndex() {
+    return (SMALL_BIN_RANGE_END - FAST_BIN_RANGE_END) / BIN_SPACING_SIZE;
 }
 
-void AfMalloc::init() {
-    // TODO this should be implemented that we allocate memory with our own allocator and size
-    af_arena_.fast_chunks_.resize(NUM_FAST_CHUNKS, {0, 0, nullptr, nullptr});
-    std::ranges::for_each(af_arena_.fast_chunks_, [this](Chunk &chunk) {
-        if(track_pointers_) {
-            createPtrHumaneReadableName("fast_chunk_", &chunk);
-        }
-        chunk.setNext(&chunk);
-        chunk.setPrev(&chunk);
-    });
+bool isInFastBinRange(std::size_t size) {
+    // same bounds as findBinIndex, FAST_BIN_RANGE_END is already in the small bins
+    return size < FAST_BIN_RANGE_END;
+}
 
-    af_arena_.small_chunks_.resize(NUM_SMALL_CHUNKS, {0, 0, nullptr, nullptr});
-    std::ranges::for_each(af_arena_.small_chunks_, [this](auto &chunk) {
-        if(track_pointers_) {
-            createPtrHumaneReadableName("small_chunk_", &chunk);
-        }
-        chunk.setNext(&chunk);
-        chunk.setPrev(&chunk);
-    });
-    // Set chunks to point to itself
-    af_arena_.unsorted_large_chunks_ = {0, 0, nullptr, nullptr};
-    af_arena_.unsorted_large_chunks_.setNext(&af_arena_.unsorted_large_chunks_);
-    af_arena_.unsorted_large_chunks_.setPrev(&af_arena_.unsorted_large_chunks_);
+bool isInSmallBinRange(std::size_t size) {
+    return size >= FAST_BIN_RANGE_END && size < SMALL_BIN_RANGE_END;
+}
 
-    if(track_pointers_) {
-        createPtrHumaneReadableName("unsorted_large_chunks_", &af_arena_.unsorted_large_chunks_);
-    }
+bool hasLargeChunkFree(Chunk *large_chunk) {
+    return large_chunk != nullptr;
+}
 
-    af_arena_.unsorted_chunks_ = {0, 0, nullptr, nullptr};
-    af_arena_.unsorted_chunks_.setNext(&af_arena_.unsorted_chunks_);
-    af_arena_.unsorted_chunks_.setPrev(&af_arena_.unsorted_chunks_);
+Chunk *tryFindLargeChunk(Chunk *large_chunks, std::size_t size) {
+    Chunk *current = large_chunks->getPrev();
+    while(large_chunks != current) {
+        if (current->getSize() >= size) {
+            unlinkChunk(current);
+            // TODO prepare chunk to be returned to user
+            // Also split the chunk maybe
+            Chunk* next_chunk = moveToTheNextChunk(current, current->getSize());
+            // next chunk only knows that we are free
+            next_chunk->unsetPrevFree();
+            // this part of memory will be used by our chunk also, hence we need to zero the memory
+            next_chunk->setPrevSize(0x0000);
+            return current;
+        }
+        current = current->getPrev();
+    }
+    return nullptr;
+}
 
-    if(track_pointers_) {
-        createPtrHumaneReadableName("unsorted_chunks_", &af_arena_.unsorted_chunks_);
+bool isPointingToSelf(const Chunk &list_head) {
+    // Basic check that if next points to self, previous should too
+    if(list_head.getNext() == &list_head) {
+        assert(list_head.getPrev() == &list_head);
+    }
+    // or if previous points to self, next should too
+    if(list_head.getPrev() == &list_head) {
+        assert(list_head.getNext() == &list_head);
     }
+    return list_head.getPrev() == &list_head && list_head.getNext() == &list_head;
+}
 
+bool hasElementsInList(const Chunk &list_head) {
+    return !isPointingToSelf(list_head);
+}
 
-    // only FAST and SMALL bin indexes live here
-    af_arena_.bin_indexes_.resize(2, {0});
 
+namespace {
+// Every thread gets its number on the first allocation, the first thread is the one which gets the main arena
+std::atomic<std::size_t> thread_counter{0};
+thread_local const std::size_t thread_ordinal = thread_counter.fetch_add(1, std::memory_order_relaxed);
 }
 
+std::size_t getCurrentCpu() {
+#ifdef AFMALLOC_RSEQ_CPU_ID
+    // glibc registers rseq for every thread, and then the kernel keeps cpu_id up to date on each migration,
+    // so reading it is a plain load instead of a syscall (or vDSO call) that sched_getcpu is
+    if(__rseq_size > 0) {
+        const auto *rseq_area = reinterpret_cast<const volatile struct rseq *>(
+            static_cast<char *>(__builtin_thread_pointer()) + __rseq_offset);
+        const auto cpu_id = static_cast<int32_t>(rseq_area->cpu_id);
+        if(cpu_id >= 0) {
+            return static_cast<std::size_t>(cpu_id);
+        }
+    }
+#endif
+    const int cpu = sched_getcpu();
+    return cpu < 0 ? 0 : static_cast<std::size_t>(cpu);
+}
 
-// Once deallocation is done, we write to the next chunk that prev_size is our size current, and we write to
-// ourselves that we are not in use
-
-// That should enable merging of two chunks
-void AfMalloc::free(void *p) {
+void ArenaLocked::initArenas(AfArena *main_arena, const ArenaSelection arena_selection, std::size_t arena_count) {
+    arena_selection_ = arena_selection;
+    if(arena_count == 0) {
+        arena_count = arena_selection == ArenaSelection::CPU ? static_cast<std::size_t>(get_nprocs_conf())
+                                                             : ARENAS_PER_CORE * std::max(1u, std::thread::hardware_concurrency());
+    }
+    arenas_.reserve(arena_count);
+    arenas_.emplace_back(main_arena);
+    while(arenas_.size() < arena_count) {
+        arenas_.emplace_back(owned_arenas_.emplace_back(std::make_unique<AfArena>()).get());
+    }
+}
 
-    // TODO detect double free -> that should be easy?
-    /**
-     * If chunk next to the top chunk is free, then we extend top chunk. That is why we never have
-     * inside the top chunk the prev_size or isPrevFree set inside the size although there is enough space for that
-    */
-    auto *free_chunk = moveToThePreviousChunk(p, HEAD_OF_CHUNK_SIZE);
-    AfHeap *heap = getHeapForChunk()
-    // after we have heap we need to get arena
-    // then work with it
-    // we can get heap by doing aligning our chunk to HEAP_SIZE
-    // we know that each of our chunks in heap will be N*HEAP_SIZE + chunk_offset
+std::size_t ArenaLocked::selectArenaIndex() const {
+    // Arenas are all created upfront, so picking one is only an index into arenas_
+    if(arena_selection_ == ArenaSelection::CPU) {
+        return getCurrentCpu() % arenas_.size();
+    }
+    // Thread affine arenas: thread keeps the same arena, which improves locality.
+    // When there are more threads than arenas, threads start sharing them round-robin.
+    return thread_ordinal % arenas_.size();
+}
+
+AfArena *ArenaLocked::lockSelectedArena(Lock &lock) {
+    const std::size_t selected = selectArenaIndex();
+    for(std::size_t i{0}; i < arenas_.size(); i++) {
+        AfArena *arena = arenas_[(selected + i) % arenas_.size()];
+        lock = tryLockArenaCounted(*arena);
+        if(lock.owns_lock()) {
+            if(i != 0 && isStatsEnabled()) {
+                arena->arena_switches_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return arena;
+        }
+    }
+    // every arena is busy, so wait for our own
+    AfArena *arena = arenas_[selected];
+    lock = lockArenaCounted(*arena);
+    return arena;
+}
 
-    clearUpDataSpaceOfChunk(free_chunk);
 
-    // Here we want to check if the chunk in the physical memory before us has actually
-    // been freed. If so, we can try to merge those two
-    if(free_chunk->isPrevFree() && isChunkCoalescable(*free_chunk)) {
-        // previous chunk is free, we need to merge them
-        std::size_t prev_size = free_chunk->getPrevSize();
+namespace {
+std::atomic<std::size_t> per_thread_instance_counter{0};
 
-        /// Then we need to go to that place in the memory
-        auto *chunk_before = moveToThePreviousChunk(free_chunk, prev_size);
-        // if we don't do this here, then we will later have a problem
-        // with merging two chunks and iterating over free chunks because of zeroing of memory
+// Last arena used by this thread, valid only for the allocator with the same instance id
+struct ThreadArenaCache {
+    std::size_t instance_id{0};
+    AfArena *arena{nullptr};
+};
+thread_local ThreadArenaCache thread_arena_cache{};
+}
 
-        unlinkChunk(chunk_before);
-        //std::destroy_at<Chunk>(chunk_before);
+namespace {
+std::size_t getSlabSizeClass(std::size_t size) {
+    return static_cast<std::size_t>(std::ranges::lower_bound(SLAB_SIZE_CLASSES, size) - SLAB_SIZE_CLASSES.begin());
+}
 
-        chunk_before->setSize( prev_size + free_chunk->getSize());
-        free_chunk = chunk_before;
-        clearUpDataSpaceOfChunk(free_chunk);
+void pushPartialSlabPage(AfArena &arena, AfSlabPage *page) {
+    AfSlabPage *&head = arena.slab_partial_pages_[page->size_class];
+    page->prev = nullptr;
+    page->next = head;
+    if(head != nullptr) {
+        head->prev = page;
     }
+    head = page;
+}
 
-    auto *next_chunk = moveToTheNextChunk(free_chunk, free_chunk->getSize());
-    // Our chunk is not free until now. It can't be as we are only merging it now.
-    assert(!next_chunk->isPrevFree());
-
-    // This works even if we are at the at top, as on the top chunk we don't write size
-    Chunk *chunk_two_hops_in_front =  moveToTheNextChunk(next_chunk, next_chunk->getSize());
-
-    // if the next_chunk is free, we will merge the `freeChunk` and the `nextChunk`
-    // otherwise `nextChunk` is allocated, and we can't merge these two
-    if(chunk_two_hops_in_front->isPrevFree() && isChunkCoalescable(*free_chunk)) {
-        // nextChunk is free so we need to merge that one too
-        free_chunk->setSize(free_chunk->getSize() + next_chunk->getSize());
+void unlinkPartialSlabPage(AfArena &arena, AfSlabPage *page) {
+    if(page->prev != nullptr) {
+        page->prev->next = page->next;
+    } else {
+        arena.slab_partial_pages_[page->size_class] = page->next;
+    }
+    if(page->next != nullptr) {
+        page->next->prev = page->prev;
+    }
+    page->prev = nullptr;
+    page->next = nullptr;
+}
 
-        unlinkChunk(next_chunk);
-        // TODO add destroy at
-        //std::destroy_at<Chunk>(next_chunk);
+/**
+ * Takes an empty page, or cuts a new one from the slab heap, and sets it up for the size class
+ */
+AfSlabPage *newSlabPage(AfArena &arena, const std::size_t size_class, void *(*map_heap)()) {
+    void *page_start = arena.slab_empty_pages_;
+    if(page_start != nullptr) {
+        arena.slab_empty_pages_ = arena.slab_empty_pages_->next;
+    } else {
+        if(arena.slab_heap_ == nullptr ||
+           arena.slab_top_ == moveToTheNextPlaceInMem(arena.slab_heap_->memory_start, HEAP_MAX_SIZE)) {
+            void *p1 = map_heap();
+            if(p1 == nullptr) {
+                return nullptr;
+            }
+            void *memory_start = moveToTheNextPlaceInMem(p1, HEAP_HEADER_SIZE);
+            arena.slab_heap_ = std::construct_at(static_cast<AfHeap *>(p1), &arena, memory_start, arena.slab_heap_, true);
+            arena.slab_top_ = memory_start;
+            arena.slab_allocated_size_ += HEAP_MAX_SIZE;
+        }
+        page_start = arena.slab_top_;
+        arena.slab_top_ = moveToTheNextPlaceInMem(arena.slab_top_, SLAB_PAGE_SIZE);
+    }
+    const std::size_t object_size = SLAB_SIZE_CLASSES[size_class];
+    return std::construct_at(static_cast<AfSlabPage *>(page_start), AfSlabPage{
+        .arena = &arena,
+        .free_list = nullptr,
+        .bump = moveToTheNextPlaceInMem(page_start, SLAB_PAGE_HEADER_SIZE),
+        .object_size = static_cast<std::uint32_t>(object_size),
+        .size_class = static_cast<std::uint32_t>(size_class),
+        .used = 0,
+        .capacity = static_cast<std::uint32_t>((SLAB_PAGE_SIZE - SLAB_PAGE_HEADER_SIZE) / object_size),
+    });
+}
+}
 
-        clearUpDataSpaceOfChunk(free_chunk);
-        chunk_two_hops_in_front->setPrevFree();
-        chunk_two_hops_in_front->setPrevSize(free_chunk->getSize());
+void *mallocFromSlab(AfArena &arena, const std::size_t size, void *(*map_heap)()) {
+    const std::size_t size_class = getSlabSizeClass(size);
+    AfSlabPage *page = arena.slab_partial_pages_[size_class];
+    if(page == nullptr) {
+        page = newSlabPage(arena, size_class, map_heap);
+        if(page == nullptr) {
+            return nullptr;
+        }
+        pushPartialSlabPage(arena, page);
     }
-    // when the nextChunk is free, if chunkTwoHopsInFront was free, it would be merged in the step before.
-    // This way we know that our chunk is free, and only one step around us can be free
 
-    // We need to find where is the next chunk, as we might have merged it in the step before
-    next_chunk = moveToTheNextChunk(free_chunk, free_chunk->getSize());
+    void *ptr = page->free_list;
+    if(ptr != nullptr) {
+        page->free_list = *static_cast<void **>(ptr);
+        *static_cast<void **>(ptr) = nullptr;
+    } else {
+        ptr = page->bump;
+        page->bump = moveToTheNextPlaceInMem(page->bump, page->object_size);
+    }
+    if(++page->used == page->capacity) {
+        unlinkPartialSlabPage(arena, page);
+    }
+    return ptr;
+}
 
-    if(next_chunk < af_arena_.top_) {
-        // Set that our chunk is free, only if it is not fast chunk.
-        // By not setting it for the fast chunk, we disable coalasceing for the fast chunks
-        if(isChunkCoalescable(*free_chunk)) {
-            // Set on the next that chunk before is free
-            next_chunk->setPrevFree();
-            next_chunk->setPrevSize(free_chunk->getSize());
-        }else {
-            // this is needed for force coalescing of fast chunks later
-            next_chunk->setPrevSize(free_chunk->getSize());
-        }
-    }else {
-        if(isChunkCoalescable(*free_chunk)) {
-            // next chunk here is arena.top_
-            assert(next_chunk == af_arena_.top_);
-            // in this part of code we extend top to the free_chunk
-            // this means we can't add free chunk to the free list
-            static_cast<Chunk*>(af_arena_.top_)->setPrevFree();
-            static_cast<Chunk*>(af_arena_.top_)->setPrevSize(free_chunk->getSize());
-            // here we should actually merge our chunk with the top, and that way we have extended the unlimited free chunk
-            extendTopChunk();
-            // We have extended the top, the rest of the code deals with adding the chunk to the unsorted chunks
+void freeToSlab(void *ptr) {
+    AfSlabPage *page = getSlabPage(ptr);
+    AfArena &arena = *page->arena;
+    assert(page->used > 0);
+    if(page->used-- == page->capacity) {
+        pushPartialSlabPage(arena, page);
+    }
+    if(page->used == 0) {
+        // page can go to any size class now, but keep one page per class so a single object
+        // allocated and freed in a loop does not bounce the page around
+        if(page->prev != nullptr || page->next != nullptr) {
+            unlinkPartialSlabPage(arena, page);
+            page->next = arena.slab_empty_pages_;
+            arena.slab_empty_pages_ = page;
             return;
-        }else {
-            static_cast<Chunk*>(af_arena_.top_)->setPrevSize(free_chunk->getSize());
         }
     }
+    *static_cast<void **>(ptr) = page->free_list;
+    page->free_list = ptr;
+}
 
-    // We append to the top of the list newly freed chunk
-    Chunk *head_chunk = &af_arena_.unsorted_chunks_;
-    if(isPointingToSelf(*head_chunk)) {
-        head_chunk->setNext(free_chunk);
-        head_chunk->setPrev(free_chunk);
-
-        free_chunk->setNext(head_chunk);
-        free_chunk->setPrev(head_chunk);
-        return;
+void releaseSlabHeaps(AfArena &arena, void (*unmap_heap)(AfHeap *)) {
+    AfHeap *heap = arena.slab_heap_;
+    while(heap != nullptr) {
+        AfHeap *prev_heap = heap->prev_heap;
+        unmap_heap(heap);
+        heap = prev_heap;
     }
+    arena.slab_partial_pages_.fill(nullptr);
+    arena.slab_empty_pages_ = nullptr;
+    arena.slab_heap_ = nullptr;
+    arena.slab_top_ = nullptr;
+    arena.slab_allocated_size_ = 0;
+}
+
+void linkRegionLargeHeap(AfArena &arena, AfHeap *heap) {
+    heap->arena_ptr = &arena;
+    heap->prev_heap = nullptr;
+    heap->next_heap = arena.region_large_heaps_;
+    if(arena.region_large_heaps_ != nullptr) {
+        arena.region_large_heaps_->prev_heap = heap;
+    }
+    arena.region_large_heaps_ = heap;
+}
 
-    Chunk *last_in_chunk = head_chunk->getNext();
+void unlinkRegionLargeHeap(AfArena &arena, AfHeap *heap) {
+    if(heap->prev_heap != nullptr) {
+        heap->prev_heap->next_heap = heap->next_heap;
+    } else {
+        arena.region_large_heaps_ = heap->next_heap;
+    }
+    if(heap->next_heap != nullptr) {
+        heap->next_heap->prev_heap = heap->prev_heap;
+    }
+}
 
-    free_chunk->setPrev(head_chunk);
-    free_chunk->setNext(last_in_chunk);
 
-    last_in_chunk->setPrev(free_chunk);
-    head_chunk->setNext(free_chunk);
+namespace {
+bool keyEquals(const char *key, const std::size_t key_length, const char *expected) {
+    return std::strlen(expected) == key_length && std::strncmp(key, expected, key_length) == 0;
 }
 
-AfMalloc::~AfMalloc() {
-    if(af_arena_.free_size_ != af_arena_.allocated_size_) {
-        std::cout << "leaking memory" << std::endl;
+std::optional<AfMallocParam> findParam(const char *key, const std::size_t key_length) {
+    constexpr std::array<std::pair<const char *, AfMallocParam>, 8> params{{
+        {"arena_count", AfMallocParam::ARENA_COUNT},
+        {"mmap_threshold", AfMallocParam::MMAP_THRESHOLD},
+        {"trim_threshold", AfMallocParam::TRIM_THRESHOLD},
+        {"unsorted_limit", AfMallocParam::UNSORTED_SORT_LIMIT},
+        {"decay_ms", AfMallocParam::DECAY_TIME_MS},
+        {"heap_colours", AfMallocParam::HEAP_COLOURS},
+        {"scrub", AfMallocParam::SCRUB},
+        {"stats", AfMallocParam::STATS},
+    }};
+    for(const auto &[name, param]: params) {
+        if(keyEquals(key, key_length, name)) {
+            return param;
+        }
     }
-    munmap(af_arena_.begin_, af_arena_.allocated_size_);
+    return std::nullopt;
 }
 
-void AfMalloc::moveChunkToCorrectBin(Chunk *current_chunk, std::size_t needed_size) {
-    auto maybe_bin_index = findBinIndex(needed_size);
-    // free_chunk_list -> 1 -> 2 - > 3
-    if(!maybe_bin_index) {
-        moveToUnsortedLargeChunks(current_chunk);
-    }else {
-        if(auto [index, bit_index] = *maybe_bin_index; index == FASTBINS_INDEX) {
-            // fast range
-            moveToFastBinsChunks(current_chunk, bit_index);
-            setBinIndex(index, bit_index);
-        }else {
-            // small range
-            moveToSmallBinsChunks(current_chunk, bit_index);
-            setBinIndex(index, bit_index);
+/**
+ * Decimal number with an optional k, m or g suffix, and nothing else in the value
+ */
+std::optional<std::size_t> parseValue(const char *value, const std::size_t value_length) {
+    if(value_length == 0) {
+        return std::nullopt;
+    }
+    std::size_t result{0};
+    for(std::size_t i{0}; i < value_length; i++) {
+        const char c = value[i];
+        if(c >= '0' && c <= '9') {
+            result = result * 10 + static_cast<std::size_t>(c - '0');
+            continue;
+        }
+        if(i != value_length - 1 || i == 0) {
+            return std::nullopt;
+        }
+        switch(c) {
+            case 'k': case 'K': return result << 10;
+            case 'm': case 'M': return result << 20;
+            case 'g': case 'G': return result << 30;
+            default: return std::nullopt;
         }
     }
-
+    return result;
 }
 
-std::optional<void*> AfMalloc::findChunkFromUnsortedFreeChunks(std::size_t needed_size) {
-    // Next to the free chunk, unless it is in the fast bin range, there will always be an allocated chunk,
-    // since otherwise we would coalesce them
-    // on the free.
-    // For the fast bin chunk, even if the chunk next to the fast bin chunk is free, we would not coalesce them.
-
-    // Unsorted free chunks are stored in a double linked list
-    Chunk *start  = &af_arena_.unsorted_chunks_;
-    assert(start->getNext() != nullptr);
-    Chunk *current_chunk = start->getNext();
-    Chunk *match{nullptr};
-    while(current_chunk != start) {
-        // We are looking for the first chunk that we can find.
-        // If we encounter a chunk which is not of needed size, we will move it to the appropriate bin
-        if(current_chunk->getSize()  >= needed_size) {
-            match = current_chunk;
-            break;
-        }
-        Chunk *next_chunk = current_chunk->getNext();
-        unlinkChunk(current_chunk);
-        moveChunkToCorrectBin(current_chunk, current_chunk->getSize());
-        current_chunk = next_chunk;
+AfMallocOptions loadOptionsFromEnvironment() {
+    AfMallocOptions options{};
+    if(const char *env = std::getenv("AFMALLOC_OPTIONS")) {
+        // invalid string is ignored as a whole, allocator still has to work
+        parseAfMallocOptions(env, options);
     }
+    return options;
+}
 
-    if(match == nullptr) {
-        return std::nullopt;
-    }
+std::mutex options_lock{};
 
-    unlinkChunk(match);
+// caller holds options_lock
+AfMallocOptions &processOptions() {
+    static AfMallocOptions options = loadOptionsFromEnvironment();
+    return options;
+}
 
-    // TODO this is opportunity to split the chunk on the multiple chunks, since we could otherwise get really
-    // big chunk
-    Chunk* next_chunk = moveToTheNextChunk(match, match->getSize());
-    // next chunk only knows that we are free
-    next_chunk->unsetPrevFree();
-    // this part of memory will be used by our chunk also, hence we need to zero the memory
-    next_chunk->setPrevSize(0x0000);
+// read on every free and every lock, so they are kept outside of the options
+std::atomic<bool> &scrubFlag() {
+    static std::atomic<bool> scrub{getAfMallocOptions().scrub};
+    return scrub;
+}
 
-    // We don't need to call the construct here since we have already done so
-    return moveToTheNextPlaceInMem(match, HEAD_OF_CHUNK_SIZE);
+std::atomic<bool> &statsFlag() {
+    static std::atomic<bool> stats{getAfMallocOptions().stats};
+    return stats;
+}
 }
 
-std::size_t getMaxFastBinBitIndex() {
-    return FAST_BIN_RANGE_END / BIN_SPACING_SIZE;
+bool parseAfMallocOptions(const char *options, AfMallocOptions &out) {
+    AfMallocOptions parsed = out;
+    const char *entry = options;
+    while(*entry != '\0') {
+        const char *entry_end = entry;
+        while(*entry_end != '\0' && *entry_end != ',') {
+            entry_end++;
+        }
+        const char *separator = entry;
+        while(separator != entry_end && *separator != ':') {
+            separator++;
+        }
+        if(separator == entry_end) {
+            return false;
+        }
+        const auto param = findParam(entry, static_cast<std::size_t>(separator - entry));
+        const auto value = parseValue(separator + 1, static_cast<std::size_t>(entry_end - separator - 1));
+        if(!param || !value || !setAfMallocOption(parsed, *param, *value)) {
+            return false;
+        }
+        entry = *entry_end == ',' ? entry_end + 1 : entry_end;
+    }
+    out = parsed;
+    return true;
+}
+
+bool setAfMallocOption(AfMallocOptions &options, const AfMallocParam param, const std::size_t value) {
+    switch(param) {
+        case AfMallocParam::ARENA_COUNT:
+            options.arena_count = value;
+            return true;
+        case AfMallocParam::MMAP_THRESHOLD:
+            // anything bigger would not fit into a heap
+            if(value > DEFAULT_MMAP_THRESHOLD) {
+                return false;
+            }
+            options.mmap_threshold = value;
+            return true;
+        case AfMallocParam::TRIM_THRESHOLD:
+            options.trim_threshold = value;
+            return true;
+        case AfMallocParam::UNSORTED_SORT_LIMIT:
+            options.unsorted_sort_limit = value;
+            return true;
+        case AfMallocParam::DECAY_TIME_MS:
+            options.decay_time = std::chrono::milliseconds{value};
+            return true;
+        case AfMallocParam::HEAP_COLOURS:
+            if(value > MAX_HEAP_COLOURS) {
+                return false;
+            }
+            options.heap_colours = value;
+            return true;
+        case AfMallocParam::SCRUB:
+        case AfMallocParam::STATS:
+            if(value > 1) {
+                return false;
+            }
+            (param == AfMallocParam::SCRUB ? options.scrub : options.stats) = value == 1;
+            return true;
+    }
+    return false;
 }
 
-std::size_t getMaxSmallBinBitIndex() {
-    return (SMALL_BIN_RANGE_END - FAST_BIN_RANGE_END) / BIN_SPACING_SIZE;
+AfMallocOptions getAfMallocOptions() {
+    std::lock_guard lock{options_lock};
+    return processOptions();
 }
 
-bool isInFastBinRange(std::size_t size) {
-    return size <= FAST_BIN_RANGE_END;
+bool afMallopt(const AfMallocParam param, const std::size_t value) {
+    // flags read the options on their first use, that must not happen under the lock
+    scrubFlag();
+    statsFlag();
+    std::lock_guard lock{options_lock};
+    AfMallocOptions &options = processOptions();
+    if(!setAfMallocOption(options, param, value)) {
+        return false;
+    }
+    if(param == AfMallocParam::SCRUB) {
+        scrubFlag().store(options.scrub, std::memory_order_relaxed);
+    } else if(param == AfMallocParam::STATS) {
+        statsFlag().store(options.stats, std::memory_order_relaxed);
+    }
+    return true;
 }
 
-bool isInSmallBinRange(std::size_t size) {
-    return size >= FAST_BIN_RANGE_END && size <= SMALL_BIN_RANGE_END;
+bool isScrubEnabled() {
+    return scrubFlag().load(std::memory_order_relaxed);
 }
 
-bool hasLargeChunkFree(Chunk *large_chunk) {
-    return large_chunk != nullptr;
+bool isStatsEnabled() {
+    return statsFlag().load(std::memory_order_relaxed);
 }
 
+namespace {
+std::mutex hooks_lock{};
 
-void AfMalloc::setBinIndex(std::size_t bin, std::size_t bit) {
-    af_arena_.bin_indexes_[bin] |= (1ul << bit);
+// every hooks ever installed, a thread may still be calling the ones which were replaced.
+// Never destroyed, the hooks may be called while the statics are destroyed at exit.
+std::deque<AfMallocHooks> &hooksHistory() {
+    static auto *history = new std::deque<AfMallocHooks>{};
+    return *history;
+}
 }
 
-void AfMalloc::unsetBitIndex(std::size_t bin, std::size_t bit) {
-    af_arena_.bin_indexes_[bin] &= ~(1ul << bit);
+void setAfMallocHooks(const AfMallocHooks &hooks) {
+    std::lock_guard lock{hooks_lock};
+    const AfMallocHooks &installed = hooksHistory().emplace_back(hooks);
+    installed_hooks.store(&installed, std::memory_order_release);
 }
 
-bool AfMalloc::isBinBitIndexSet(std::size_t bin, std::size_t bit) {
-    return af_arena_.bin_indexes_[bin].test(bit);
+void clearAfMallocHooks() {
+    std::lock_guard lock{hooks_lock};
+    installed_hooks.store(nullptr, std::memory_order_release);
 }
 
-/**
- * Fast bin chunk gets allocated, we remove it from the list
- * Later we add it to the unsorted chunks, and insert back into the free list
- * It is never coalesced however.
- * @param size
- * @return
- */
-Chunk *AfMalloc::tryFindFastBinChunk(const std::size_t size) {
-    auto [fast_bin_index, bit_index] = *findBinIndex(size);
-    assert(fast_bin_index == FASTBINS_INDEX);
-    auto index = bit_index;
-
-    // Traverse only up to 2 blocks away from our chunk
-    while(index < getMaxFastBinBitIndex() && (index - bit_index <= 2)) {
-        Chunk &chunk_list = af_arena_.fast_chunks_[index];
-        if(isPointingToSelf(chunk_list)) {
-            unsetBitIndex(fast_bin_index, bit_index);
-        }else {
-            // Not sure how malloc does this, but probably good idea to restrict this to one above
-            // if there is no exact match, otherwise we are wasting a lot of memory space
-            Chunk *match = chunk_list.getNext();
-            unlinkChunk(match);
-            assert(match != nullptr);
-            Chunk *next_chunk = moveToTheNextChunk(match, match->getSize());
-            // next chunk only knows that we are free
-            next_chunk->unsetPrevFree();
-            // this part of memory will be used by our chunk also, hence we need to zero the memory
-            next_chunk->setPrevSize(0x0000);
-            return match;
-        }
-        index++;
+void reportAlloc(const AfMallocHooks &hooks, void *ptr, const std::size_t size) {
+    if(ptr == nullptr || hooks.on_alloc == nullptr) {
+        return;
+    }
+    AfHookScope scope{};
+    if(scope.isOutermost()) {
+        hooks.on_alloc(hooks.context, ptr, size);
     }
-    return nullptr;
 }
 
-/**
- * Try to find chunk which is of same size, or one size larger.
- * Not sure if we should iterate more here, and then just split the chunk if found
- * @param size
- * @return
- */
-Chunk *AfMalloc::tryFindSmallBinChunk(std::size_t size) {
-    std::vector<Chunk > &small_chunks = af_arena_.small_chunks_;
-    auto [small_bin_index, bit_index] = *findBinIndex(size);
-    assert(small_bin_index == SMALLBINS_INDEX);
-    auto index = bit_index;
-
-    Chunk *chunk_list{nullptr};
-    while(true) {
-        chunk_list = &small_chunks[index];
-        if(isPointingToSelf(*chunk_list) || !isBinBitIndexSet(small_bin_index, index)) {
-            unsetBitIndex(small_bin_index, index);
-            index++;
-        }else {
-            Chunk *match  = chunk_list->getPrev();
-            unlinkChunk(match);
-            assert(match != nullptr);
-            Chunk* next_chunk = moveToTheNextChunk(match, match->getSize());
-            // next chunk only knows that we are free
-            next_chunk->unsetPrevFree();
-            // this part of memory will be used by our chunk also, hence we need to zero the memory
-            next_chunk->setPrevSize(0x0000);
-            return match;
-        }
-
-        // Not sure how malloc does this, but probably good idea to restrict this to one above
-        // if there is no exact match, otherwise we are wasting a lot of memory space
-        if(index > getMaxSmallBinBitIndex() || index - bit_index >= 2 ) {
-            return nullptr;
-        }
+void reportFree(const AfMallocHooks &hooks, void *ptr) {
+    if(ptr == nullptr || hooks.on_free == nullptr) {
+        return;
+    }
+    AfHookScope scope{};
+    if(scope.isOutermost()) {
+        hooks.on_free(hooks.context, ptr);
     }
 }
 
-Chunk *tryFindLargeChunk(Chunk *large_chunks, std::size_t size) {
-    Chunk *current = large_chunks->getPrev();
-    while(large_chunks != current) {
-        if (current->getSize() >= size) {
-            unlinkChunk(current);
-            // TODO prepare chunk to be returned to user
-            // Also split the chunk maybe
-            Chunk* next_chunk = moveToTheNextChunk(current, current->getSize());
-            // next chunk only knows that we are free
-            next_chunk->unsetPrevFree();
-            // this part of memory will be used by our chunk also, hence we need to zero the memory
-            next_chunk->setPrevSize(0x0000);
-            return current;
-        }
-        current = current->getPrev();
+void reportRealloc(const AfMallocHooks &hooks, void *old_ptr, void *new_ptr, const std::size_t size) {
+    // failed realloc changed nothing
+    if((new_ptr == nullptr && size != 0) || hooks.on_realloc == nullptr) {
+        return;
+    }
+    AfHookScope scope{};
+    if(scope.isOutermost()) {
+        hooks.on_realloc(hooks.context, old_ptr, new_ptr, size);
     }
-    return nullptr;
 }
 
-bool isPointingToSelf(const Chunk &list_head) {
-    // Basic check that if next points to self, previous should too
-    if(list_head.getNext() == &list_head) {
-        assert(list_head.getPrev() == &list_head);
+
+std::unique_lock<std::mutex> tryLockArenaCounted(AfArena &arena) {
+    std::unique_lock lock{arena.arena_lock, std::try_to_lock};
+    if(!isStatsEnabled()) {
+        return lock;
     }
-    // or if previous points to self, next should too
-    if(list_head.getPrev() == &list_head) {
-        assert(list_head.getNext() == &list_head);
+    if(lock.owns_lock()) {
+        arena.lock_counters_.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        arena.lock_counters_.try_lock_failures.fetch_add(1, std::memory_order_relaxed);
     }
-    return list_head.getPrev() == &list_head && list_head.getNext() == &list_head;
+    return lock;
 }
 
-bool hasElementsInList(const Chunk &list_head) {
-    return !isPointingToSelf(list_head);
+std::unique_lock<std::mutex> lockArenaCounted(AfArena &arena) {
+    std::unique_lock lock = tryLockArenaCounted(arena);
+    if(lock.owns_lock()) {
+        return lock;
+    }
+    if(!isStatsEnabled()) {
+        lock.lock();
+        return lock;
+    }
+    // the clock is read only when we really have to wait, uncontended path stays a single try_lock
+    const auto wait_start = std::chrono::steady_clock::now();
+    lock.lock();
+    const auto waited = std::chrono::steady_clock::now() - wait_start;
+    arena.lock_counters_.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    arena.lock_counters_.wait_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count(),
+                                           std::memory_order_relaxed);
+    arena.blocking_waits_.fetch_add(1, std::memory_order_relaxed);
+    return lock;
+}
+
+namespace {
+std::atomic<std::size_t> deferred_frees_instance_counter{0};
+
+// Deferred free buffer of this thread, valid only for the allocator with the same instance id
+struct ThreadDeferredFreeCache {
+    std::size_t instance_id{0};
+    AfDeferredFreeBuffer *buffer{nullptr};
+};
+thread_local ThreadDeferredFreeCache thread_deferred_free_cache{};
+}
+
+// ids start from 1, so the empty cache never matches
+AfDeferredFrees::AfDeferredFrees()
+    : instance_id_(deferred_frees_instance_counter.fetch_add(1, std::memory_order_relaxed) + 1) {}
+
+bool AfDeferredFrees::push(void *ptr) {
+    if(getThreadBuffer()->push(ptr)) {
+        return true;
+    }
+    overflows_.fetch_add(1, std::memory_order_relaxed);
+    return false;
 }
 
+AfDeferredFreeBuffer *AfDeferredFrees::getThreadBuffer() {
+    if(thread_deferred_free_cache.instance_id == instance_id_) {
+        return thread_deferred_free_cache.buffer;
+    }
+    std::lock_guard lock{buffers_lock_};
+    auto [iter, inserted] = thread_buffers_.try_emplace(std::this_thread::get_id(), nullptr);
+    if(inserted) {
+        // a thread which reuses the id of an exited thread takes over its buffer, the buffer still has one producer
+        iter->second = buffers_.emplace_back(owned_buffers_.emplace_back(std::make_unique<AfDeferredFreeBuffer>()).get());
+    }
+    thread_deferred_free_cache = {instance_id_, iter->second};
+    return iter->second;
+}
 
-AfArena* AfMalloc::getActiveArena() {
-    // get number active arenas
-    // get max number arenas
-    // if this is not a new thread
-    //      try to get last active arena for this thread
-    //      (this should improve locality)
-    // if there is less active arenas then we have allocated
-    //      return that one
-    //  if there is space to create one more arena
-    //        create new one and use that one
-    // lock arena and return it
+void PerThread::initArenas(AfArena *main_arena, ArenaSelection, std::size_t) {
+    // ids start from 1, so the empty cache never matches
+    instance_id_ = per_thread_instance_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+    arenas_.emplace_back(main_arena);
 }
 
-AfHeap AfMalloc::getNewHeap() {
-    // creates a new heap with mmap memory
-    // this heap
+std::size_t PerThread::getArenaCount() const {
+    std::lock_guard lock{arenas_lock_};
+    return arenas_.size();
 }
 
-void *AfMalloc::malloc(std::size_t size) {
+AfArena *PerThread::selectArena() {
+    if(thread_arena_cache.instance_id == instance_id_) {
+        return thread_arena_cache.arena;
+    }
+    std::lock_guard lock{arenas_lock_};
+    auto [iter, inserted] = thread_arenas_.try_emplace(std::this_thread::get_id(), nullptr);
+    if(inserted) {
+        // the first thread takes the main arena, every other one gets a new arena
+        iter->second = thread_arenas_.size() == 1 ? arenas_.front()
+                                                  : arenas_.emplace_back(owned_arenas_.emplace_back(std::make_unique<AfArena>()).get());
+    }
+    thread_arena_cache = {instance_id_, iter->second};
+    return iter->second;
+}
 
-    AfArena *arena = getActiveArena();
 
-    std::size_t needed_size =  getMallocNeededSize(size);
+void LIFO::insertUnsorted(Chunk &head, Chunk *free_chunk) {
+    // We append to the top of the list newly freed chunk
+    Chunk *first_chunk = head.getNext();
 
-    // if there are free chunks, try to use them
-    if(hasElementsInList(af_arena_.unsorted_chunks_)) {
-        if(auto maybe_chunk = findChunkFromUnsortedFreeChunks(needed_size)) {
-            return *maybe_chunk;
-        }
-    }
-    if(isInFastBinRange(needed_size)) {
-        if(auto *chunk = tryFindFastBinChunk(needed_size)) {
-            return moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
-        }
-    }
-    if(isInSmallBinRange(needed_size)) {
-        if(auto *chunk = tryFindSmallBinChunk(needed_size)) {
-            return moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
-        }
-    }
-    if(!isPointingToSelf(af_arena_.unsorted_large_chunks_)) {
-        if(auto *chunk = tryFindLargeChunk(&af_arena_.unsorted_large_chunks_, needed_size)) {
-            return moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
-        }
-    }
+    free_chunk->setPrev(&head);
+    free_chunk->setNext(first_chunk);
 
-    // if there are no free chunks, and we have no enough size, we need to allocate a new block
-    // If there is less then HEAD_OF_CHUNK_SIZE left, we need to
-    if(static_cast<long>(af_arena_.free_size_) - static_cast<long>(HEAD_OF_CHUNK_SIZE) < static_cast<long>(needed_size)) {
-        if(needed_size > MAX_HEAP_SIZE) {
-            assert(false); // unsupported case
-        }
-        if(af_arena_.top_ != nullptr) {
-            allocateNewHeap();
-            // now we need to put that new top is this one from this heap
-            assert(false); // unsupported case with missing new heap
-        }
-        // allocate block of memory, I am not sure if this block is aligned on anything other than page size
-        void *p1 = MMAP (nullptr, MAX_HEAP_SIZE, PROT_READ | PROT_WRITE, MAP_POPULATE);
-        if(p1 == nullptr) {
-            return nullptr;
-        }
-        assert(getAlignmentSize(p1, 4096) == 0); // page size is 4096 bytes or 4kB
-        std::cout << "Value is rounded up on page size: " << reinterpret_cast<uint64_t>(p1) << "" << reinterpret_cast<uint64_t>(p1)/4096 << std::endl;
-        af_arena_.allocated_size_ = MAX_HEAP_SIZE;
-        af_arena_.begin_ = p1;
-        af_arena_.top_= p1;
-        af_arena_.free_size_ = MAX_HEAP_SIZE;
-    }
+    first_chunk->setPrev(free_chunk);
+    head.setNext(free_chunk);
+}
 
-    // We can store anything which has alignment of 16 bytes.
+void FIFO::insertUnsorted(Chunk &head, Chunk *free_chunk) {
+    // Newly freed chunk goes behind all the others, list is circular so the tail is head.prev
+    Chunk *last_chunk = head.getPrev();
 
-    // Here we will give to user the size needed
-    // what we will do is we will return to user pointer after chunk's block
-    void *user_ptr = af_arena_.top_;
+    free_chunk->setNext(&head);
+    free_chunk->setPrev(last_chunk);
 
-    // TODO update this part so that we use std::start_lifetime_as
-    auto *user_chunk = std::construct_at(static_cast<Chunk*>(user_ptr), 0, needed_size, nullptr, nullptr);
-    if(track_pointers_) {
-        createPtrHumaneReadableName("ptr", user_chunk);
-    }
-    af_arena_.free_size_ -=  needed_size;
-    af_arena_.top_ = moveToTheNextPlaceInMem(user_chunk, needed_size);
+    last_chunk->setNext(free_chunk);
+    head.setPrev(free_chunk);
+}
 
 
-    return moveToTheNextPlaceInMem(user_ptr, HEAD_OF_CHUNK_SIZE);
+void NoScrub::scrubTopHeader(void *top) {
+    // top may land on stale data of an old chunk, and the prev free flag of the top is read when coalescing
+    memset(top, 0, HEAD_OF_CHUNK_SIZE);
 }
 
+
 /**
- *
- * @param second Pointer from which to reduce first
- * @param first pointer which reduces first
- * @return difference between second and first
+ * Reserve the size and one more heap size, somewhere inside there is HEAP_MAX_SIZE aligned address with enough
+ * space in front of it for the header page. Everything around that gets unmapped.
+ * @param size size of the memory after the header page
  */
-std::size_t getPtrDiffSize(void *second, void *first) {
-    return reinterpret_cast<uintptr_t>(second) - reinterpret_cast<uintptr_t>(first);
-}
-
-void *AfMalloc::memAlign(std::size_t alignment, std::size_t size) {
-    // alignment + size
-    assert(alignment % 2 == 0);
-    // if alignment is not at least 16, reconfigure to multiple of 16, we can work with
-    // if alignment or size which we allocate for chunk is not multiple of ALIGNMENT
-    // then we will have problem allocating new chunk, it will be misaligned
-    if(alignment < ALIGNMENT || alignment % ALIGNMENT != 0) {
-        alignment = (alignment / ALIGNMENT + 1) * ALIGNMENT; // round up to the bigger number
+static void *mapAlignedHeap(const std::size_t size, const int extra_flags) {
+    const std::size_t reserved_size = size + HEAP_MAX_SIZE + HEAP_HEADER_SIZE;
+    void *reserved = MMAP(nullptr, reserved_size, PROT_NONE, MAP_NORESERVE);
+    if(reserved == MAP_FAILED) {
+        return nullptr;
     }
+    const auto reserved_start = reinterpret_cast<uintptr_t>(reserved);
+    const auto memory_start = (reserved_start + HEAP_HEADER_SIZE + HEAP_MAX_SIZE - 1) & ~(HEAP_MAX_SIZE - 1);
+    const auto heap_start = memory_start - HEAP_HEADER_SIZE;
+    const auto heap_end = memory_start + size;
 
+    if(heap_start != reserved_start) {
+        munmap(reserved, heap_start - reserved_start);
+    }
+    munmap(reinterpret_cast<void *>(heap_end), reserved_start + reserved_size - heap_end);
 
-    std::size_t alignmentSizeInternal = getAlignmentSize(getTop(), alignment);
-    void *top = getTop();
-    void *new_top = moveToTheNextPlaceInMem(top, alignmentSizeInternal);
-    // since new_top is now aligned to what user wants
-    // we need to check if have 16 bytes before to fit our HEAD_OF_CHUNK
-    if(getPtrDiffSize(new_top, top) < HEAD_OF_CHUNK_SIZE) {
-        new_top = moveToTheNextPlaceInMem(new_top, 1);
-        alignmentSizeInternal = getAlignmentSize(new_top, alignment);
-        new_top = moveToTheNextPlaceInMem(new_top, alignmentSizeInternal);
-        assert(getPtrDiffSize(new_top, top) > HEAD_OF_CHUNK_SIZE);
+    void *p1 = MMAP (reinterpret_cast<void *>(heap_start), HEAP_HEADER_SIZE + size, PROT_READ | PROT_WRITE, MAP_FIXED | extra_flags);
+    if(p1 == MAP_FAILED) {
+        munmap(reinterpret_cast<void *>(heap_start), HEAP_HEADER_SIZE + size);
+        return nullptr;
     }
+    return p1;
+}
 
-    void *start_of_chunk = moveToThePreviousPlaceInMem(new_top, HEAD_OF_CHUNK_SIZE);
-    assert(reinterpret_cast<uintptr_t>(new_top) % alignment == 0);
-    std::size_t ptrDiffSize = getPtrDiffSize(new_top, top);
+void *MmapPageSource::mapHeap() {
+    return mapAlignedHeap(HEAP_MAX_SIZE, MAP_POPULATE);
+}
 
-    std::size_t mallocNeededSize = getMallocNeededSize(size);
-    Chunk * chunk = std::construct_at(static_cast<Chunk*>(start_of_chunk), 0, 0, nullptr, nullptr);
-    chunk->setSize(mallocNeededSize);
+void MmapPageSource::unmapHeap(AfHeap *heap) {
+    munmap(heap, HEAP_HEADER_SIZE + HEAP_MAX_SIZE);
+}
 
-    if(ptrDiffSize >= CHUNK_SIZE) {
-        chunk->setPrevFree();
-        chunk->setPrevSize(ptrDiffSize);
-        // move to the unsorted bin
-    }
-    af_arena_.top_ = moveToTheNextPlaceInMem(start_of_chunk, mallocNeededSize);
+void MmapPageSource::releasePages(void *start, const std::size_t size) {
+    madvise(start, size, MADV_DONTNEED);
+}
 
-    return moveToTheNextPlaceInMem(chunk, HEAD_OF_CHUNK_SIZE);
+std::size_t getLargeMappingSize(const std::size_t needed_size) {
+    // user data reaches into the prev_size of the chunk after, which is not there, so we map for it too
+    const std::size_t chunk_end = needed_size + SIZE_OF_SIZE;
+    return HEAP_HEADER_SIZE + ((chunk_end + OS_PAGE_SIZE - 1) & ~(OS_PAGE_SIZE - 1));
 }
 
-void AfMalloc::dumpMemory() {
-    std::cout << std::format("-------Dumping unsorted chunks-------") << std::endl;
+void *MmapPageSource::mapLarge(const std::size_t size) {
+    // large chunks are not populated, most of them are never touched entirely
+    return mapAlignedHeap(getLargeMappingSize(size) - HEAP_HEADER_SIZE, 0);
+}
 
-    {
-        Chunk &head = af_arena_.unsorted_chunks_;
-        Chunk *start = head.getNext();
+void MmapPageSource::unmapLarge(AfHeap *heap) {
+    munmap(heap, heap->mmapped_size);
+}
 
-        std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(&head), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(head.getNext()), getPtrHumaneReadableName(head.getPrev())) << std::endl;
-        while(start != &head) {
-            std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(start), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(start->getNext()), getPtrHumaneReadableName(start->getPrev())) << std::endl;
-            start = start->getNext();
-        }
-    }
+void *LazyMmapPageSource::mapHeap() {
+    return mapAlignedHeap(HEAP_MAX_SIZE, 0);
+}
 
-    {
-        auto &fast_chunks = af_arena_.fast_chunks_;
-        std::size_t i{0};
-        for(auto &head: fast_chunks) {
-            if(!isPointingToSelf(head)) {
-                std::cout << std::format("-------FastChunk{}-------", i++) << std::endl;
-                Chunk *start = head.getNext();
-
-                std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(&head), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(head.getNext()), getPtrHumaneReadableName(head.getPrev())) << std::endl;
-                while(start != &head) {
-                    std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(start), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(start->getNext()), getPtrHumaneReadableName(start->getPrev())) << std::endl;
-                    start = start->getNext();
-                }
-            }else {
-                i++;
-            }
-        }
-    }
 
-    {
-        auto &small_chunks = af_arena_.small_chunks_;
-        std::size_t i{0};
-        for(auto &head: small_chunks) {
-            if(!isPointingToSelf(head)) {
-                std::cout << std::format("-------SmallChunk{}-------", i++) << std::endl;
-                Chunk *start = head.getNext();
-
-                std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(&head), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(head.getNext()), getPtrHumaneReadableName(head.getPrev())) << std::endl;
-                while(start != &head) {
-                    std::cout << std::format("{}[{} {} {} {}]", getPtrHumaneReadableName(start), start->getPrevSize(), start->getSize(), getPtrHumaneReadableName(start->getNext()), getPtrHumaneReadableName(start->getPrev())) << std::endl;
-                    start = start->getNext();
-                }
-            }else {
-                i++;
-            }
-        }
-    }
+template class BasicAfMalloc<ArenaLocked, LIFO, RuntimeScrub, MmapPageSource, NoSlabs>;
+
 
+/**
+ *
+ * @param second Pointer from which to reduce first
+ * @param first pointer which reduces first
+ * @return difference between second and first
+ */
+std::size_t getPtrDiffSize(void *second, void *first) {
+    return reinterpret_cast<uintptr_t>(second) - reinterpret_cast<uintptr_t>(first);
 }
@@ -0,0 +1,206 @@
+#include <cassert>
+#include <memory>
+
+#include "AfOffsetHeap.hpp"
+
+
+AfOffsetHeap::AfOffsetHeap(void *base, std::size_t) : base_(static_cast<std::byte *>(base)),
+                                                      header_(static_cast<AfOffsetHeapHeader *>(base)) {}
+
+AfOffsetHeap AfOffsetHeap::create(void *base, const std::size_t region_size, const std::size_t extra_header_size) {
+    const std::size_t chunks_offset = (sizeof(AfOffsetHeapHeader) + extra_header_size + OFFSET_HEAP_HEADER_ALIGNMENT - 1)
+                                      & ~(OFFSET_HEAP_HEADER_ALIGNMENT - 1);
+    assert(chunks_offset + CHUNK_SIZE + HEAD_OF_CHUNK_SIZE <= region_size);
+
+    AfOffsetHeap heap{base, region_size};
+    std::construct_at(heap.header_, AfOffsetHeapHeader{
+        .magic = AF_OFFSET_HEAP_MAGIC,
+        .version = AF_OFFSET_HEAP_VERSION,
+        .chunks_offset = static_cast<std::uint32_t>(chunks_offset),
+        .region_size = region_size,
+        .top = chunks_offset,
+        .root = AF_NULL_OFFSET,
+        .bins = {},
+    });
+    std::construct_at(heap.chunkAt(chunks_offset));
+    return heap;
+}
+
+std::optional<AfOffsetHeap> AfOffsetHeap::attach(void *base, const std::size_t region_size, const bool check_consistency) {
+    if(region_size < sizeof(AfOffsetHeapHeader)) {
+        return std::nullopt;
+    }
+    AfOffsetHeap heap{base, region_size};
+    const AfOffsetHeapHeader &header = *heap.header_;
+    if(header.magic != AF_OFFSET_HEAP_MAGIC || header.version != AF_OFFSET_HEAP_VERSION
+       || header.region_size != region_size || header.chunks_offset < sizeof(AfOffsetHeapHeader)
+       || header.chunks_offset % OFFSET_HEAP_HEADER_ALIGNMENT != 0) {
+        return std::nullopt;
+    }
+    if(check_consistency && !heap.checkConsistency()) {
+        return std::nullopt;
+    }
+    return heap;
+}
+
+std::size_t AfOffsetHeap::getBinIndex(const std::size_t size) {
+    return size < SMALL_BIN_RANGE_END ? size / BIN_SPACING_SIZE : NUM_OFFSET_BINS - 1;
+}
+
+void AfOffsetHeap::insertToBin(const AfOffset offset) {
+    AfOffsetChunk *chunk = chunkAt(offset);
+    AfOffset &head = header_->bins[getBinIndex(chunk->getSize())];
+    chunk->setPrev(AF_NULL_OFFSET);
+    chunk->setNext(head);
+    if(head != AF_NULL_OFFSET) {
+        chunkAt(head)->setPrev(offset);
+    }
+    head = offset;
+}
+
+void AfOffsetHeap::unlinkFromBin(const AfOffset offset) {
+    AfOffsetChunk *chunk = chunkAt(offset);
+    if(chunk->getPrev() != AF_NULL_OFFSET) {
+        chunkAt(chunk->getPrev())->setNext(chunk->getNext());
+    } else {
+        header_->bins[getBinIndex(chunk->getSize())] = chunk->getNext();
+    }
+    if(chunk->getNext() != AF_NULL_OFFSET) {
+        chunkAt(chunk->getNext())->setPrev(chunk->getPrev());
+    }
+    chunk->setPrev(AF_NULL_OFFSET);
+    chunk->setNext(AF_NULL_OFFSET);
+}
+
+void AfOffsetHeap::makeFreeChunk(const AfOffset offset, const std::size_t size) {
+    chunkAt(offset)->setSize(size);
+    AfOffsetChunk *next_chunk = chunkAt(offset + size);
+    next_chunk->setPrevSize(size);
+    next_chunk->setPrevFree();
+    insertToBin(offset);
+}
+
+void *AfOffsetHeap::useFreeChunk(const AfOffset offset, const std::size_t needed_size) {
+    unlinkFromBin(offset);
+    AfOffsetChunk *chunk = chunkAt(offset);
+    const std::size_t size = chunk->getSize();
+    if(size - needed_size >= CHUNK_SIZE) {
+        chunk->setSize(needed_size);
+        makeFreeChunk(offset + needed_size, size - needed_size);
+    } else {
+        chunkAfter(offset)->unsetPrevFree();
+    }
+    return fromOffset(offset + HEAD_OF_CHUNK_SIZE);
+}
+
+void *AfOffsetHeap::malloc(const std::size_t size) {
+    const std::size_t needed_size = getMallocNeededSize(size);
+    const std::size_t bin_index = getBinIndex(needed_size);
+    // exact bin first, then any bigger one, the rest gets split off
+    for(std::size_t i{bin_index}; i < NUM_OFFSET_BINS - 1; i++) {
+        if(header_->bins[i] != AF_NULL_OFFSET) {
+            return useFreeChunk(header_->bins[i], needed_size);
+        }
+    }
+    for(AfOffset offset = header_->bins[NUM_OFFSET_BINS - 1]; offset != AF_NULL_OFFSET; offset = chunkAt(offset)->getNext()) {
+        if(chunkAt(offset)->getSize() >= needed_size) {
+            return useFreeChunk(offset, needed_size);
+        }
+    }
+
+    // the new top is constructed as a whole chunk, so all of it has to fit too
+    const AfOffset offset = header_->top;
+    if(offset + needed_size + CHUNK_SIZE > header_->region_size) {
+        return nullptr;
+    }
+    chunkAt(offset)->setSize(needed_size);
+    header_->top = offset + needed_size;
+    std::construct_at(chunkAt(header_->top));
+    return fromOffset(offset + HEAD_OF_CHUNK_SIZE);
+}
+
+void AfOffsetHeap::free(void *p) {
+    if(p == nullptr) {
+        return;
+    }
+    const AfOffset chunk_offset = toOffset(p) - HEAD_OF_CHUNK_SIZE;
+    AfOffset offset = chunk_offset;
+    std::size_t size = chunkAt(offset)->getSize();
+    const AfOffset next_offset = offset + size;
+
+    if(chunkAt(offset)->isPrevFree()) {
+        const AfOffset prev_offset = offset - chunkAt(offset)->getPrevSize();
+        unlinkFromBin(prev_offset);
+        size += chunkAt(prev_offset)->getSize();
+        offset = prev_offset;
+    }
+
+    if(next_offset == header_->top) {
+        header_->top = offset;
+        std::construct_at(chunkAt(offset));
+        return;
+    }
+    if(chunkAfter(next_offset)->isPrevFree()) {
+        size += chunkAt(next_offset)->getSize();
+        unlinkFromBin(next_offset);
+    }
+    makeFreeChunk(offset, size);
+}
+
+std::size_t AfOffsetHeap::getTopFreeSize() const {
+    return header_->region_size - header_->top - CHUNK_SIZE;
+}
+
+bool AfOffsetHeap::checkConsistency() const {
+    const AfOffset top = header_->top;
+    if(top < header_->chunks_offset || top % ALIGNMENT != 0 || top + CHUNK_SIZE > header_->region_size) {
+        return false;
+    }
+
+    // every chunk from the first one up to the top, sizes must add up exactly to the top
+    std::size_t free_chunks{0};
+    bool prev_free{false};
+    std::size_t prev_size{0};
+    AfOffset offset = header_->chunks_offset;
+    while(offset < top) {
+        const AfOffsetChunk *chunk = chunkAt(offset);
+        const std::size_t size = chunk->getSize();
+        if(size < CHUNK_SIZE || size % ALIGNMENT != 0 || offset + size > top) {
+            return false;
+        }
+        if(chunk->isPrevFree() != prev_free || (prev_free && chunk->getPrevSize() != prev_size)) {
+            return false;
+        }
+        const bool free = chunkAt(offset + size)->isPrevFree();
+        // free neighbours are always coalesced
+        if(free && prev_free) {
+            return false;
+        }
+        free_chunks += free ? 1 : 0;
+        prev_free = free;
+        prev_size = size;
+        offset += size;
+    }
+    // chunk before the top is never free, it would be a part of the top
+    if(offset != top || chunkAt(top)->isPrevFree()) {
+        return false;
+    }
+
+    // every free chunk is in exactly one bin, in the right one
+    std::size_t binned_chunks{0};
+    for(std::size_t i{0}; i < NUM_OFFSET_BINS; i++) {
+        AfOffset prev = AF_NULL_OFFSET;
+        for(AfOffset node = header_->bins[i]; node != AF_NULL_OFFSET; node = chunkAt(node)->getNext()) {
+            if(node < header_->chunks_offset || node >= top || node % ALIGNMENT != 0 || ++binned_chunks > free_chunks) {
+                return false;
+            }
+            const AfOffsetChunk *chunk = chunkAt(node);
+            if(chunk->getPrev() != prev || getBinIndex(chunk->getSize()) != i || node + chunk->getSize() > top
+               || !chunkAt(node + chunk->getSize())->isPrevFree()) {
+                return false;
+            }
+            prev = node;
+        }
+    }
+    return binned_chunks == free_chunks;
+}
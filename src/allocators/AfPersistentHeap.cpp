@@ -0,0 +1,52 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AfPersistentHeap.hpp"
+
+
+AfPersistentHeap::AfPersistentHeap(const int fd, void *base, const std::size_t size, AfOffsetHeap heap, const bool recovered)
+    : fd_(fd), base_(base), size_(size), heap_(heap), recovered_(recovered) {}
+
+std::unique_ptr<AfPersistentHeap> AfPersistentHeap::open(const char *path, const std::size_t size) {
+    const int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if(fd < 0) {
+        return nullptr;
+    }
+    struct stat file_stat{};
+    if(fstat(fd, &file_stat) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    const bool exists = file_stat.st_size != 0;
+    const std::size_t mapped_size = exists ? static_cast<std::size_t>(file_stat.st_size) : size;
+    if(!exists && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    void *base = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+    std::optional<AfOffsetHeap> heap = exists ? AfOffsetHeap::attach(base, mapped_size)
+                                              : AfOffsetHeap::create(base, mapped_size);
+    if(!heap) {
+        munmap(base, mapped_size);
+        ::close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<AfPersistentHeap>{new AfPersistentHeap{fd, base, mapped_size, *heap, exists}};
+}
+
+AfPersistentHeap::~AfPersistentHeap() {
+    sync();
+    munmap(base_, size_);
+    ::close(fd_);
+}
+
+void AfPersistentHeap::sync() {
+    msync(base_, size_, MS_SYNC);
+}
@@ -0,0 +1,142 @@
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AfSharedHeap.hpp"
+
+
+AfSharedHeap::AfSharedHeap(const int fd, void *base, const std::size_t size, AfOffsetHeap heap)
+    : fd_(fd), base_(base), size_(size), heap_(heap),
+      control_(static_cast<AfSharedHeapControl *>(heap_.getExtraHeader())) {}
+
+std::unique_ptr<AfSharedHeap> AfSharedHeap::createInFd(const int fd, const std::size_t size) {
+    if(ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+    AfOffsetHeap heap = AfOffsetHeap::create(base, size, sizeof(AfSharedHeapControl));
+    auto *control = std::construct_at(static_cast<AfSharedHeapControl *>(heap.getExtraHeader()));
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&control->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    // processes which open the heap by name wait for this
+    control->ready.store(1, std::memory_order_release);
+    return std::unique_ptr<AfSharedHeap>{new AfSharedHeap{fd, base, size, heap}};
+}
+
+std::unique_ptr<AfSharedHeap> AfSharedHeap::attachFd(const int fd) {
+    struct stat fd_stat{};
+    if(fstat(fd, &fd_stat) != 0 || fd_stat.st_size == 0) {
+        ::close(fd);
+        return nullptr;
+    }
+    const auto size = static_cast<std::size_t>(fd_stat.st_size);
+    void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        ::close(fd);
+        return nullptr;
+    }
+    // other processes may be allocating right now, the heap is checked only when the lock owner dies
+    std::optional<AfOffsetHeap> heap = AfOffsetHeap::attach(base, size, false);
+    if(!heap || !static_cast<AfSharedHeapControl *>(heap->getExtraHeader())->ready.load(std::memory_order_acquire)) {
+        munmap(base, size);
+        ::close(fd);
+        return nullptr;
+    }
+    return std::unique_ptr<AfSharedHeap>{new AfSharedHeap{fd, base, size, *heap}};
+}
+
+std::unique_ptr<AfSharedHeap> AfSharedHeap::create(const char *name, const std::size_t size) {
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0) {
+        return nullptr;
+    }
+    return createInFd(fd, size);
+}
+
+std::unique_ptr<AfSharedHeap> AfSharedHeap::createAnonymous(const std::size_t size) {
+    const int fd = memfd_create("afmalloc_shared_heap", MFD_CLOEXEC);
+    if(fd < 0) {
+        return nullptr;
+    }
+    return createInFd(fd, size);
+}
+
+std::unique_ptr<AfSharedHeap> AfSharedHeap::open(const char *name) {
+    const int fd = shm_open(name, O_RDWR, 0600);
+    if(fd < 0) {
+        return nullptr;
+    }
+    return attachFd(fd);
+}
+
+std::unique_ptr<AfSharedHeap> AfSharedHeap::fromFd(const int fd) {
+    const int own_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(own_fd < 0) {
+        return nullptr;
+    }
+    return attachFd(own_fd);
+}
+
+bool AfSharedHeap::unlink(const char *name) {
+    return shm_unlink(name) == 0;
+}
+
+AfSharedHeap::~AfSharedHeap() {
+    munmap(base_, size_);
+    ::close(fd_);
+}
+
+void AfSharedHeap::lock() {
+    if(pthread_mutex_lock(&control_->lock) == EOWNERDEAD) {
+        // owner died in the middle of malloc or free, what it left behind is usable only if it is consistent
+        if(!heap_.checkConsistency()) {
+            control_->broken.store(1, std::memory_order_release);
+        }
+        pthread_mutex_consistent(&control_->lock);
+    }
+}
+
+void AfSharedHeap::unlock() {
+    pthread_mutex_unlock(&control_->lock);
+}
+
+void *AfSharedHeap::malloc(const std::size_t size) {
+    lock();
+    void *ptr = isBroken() ? nullptr : heap_.malloc(size);
+    unlock();
+    return ptr;
+}
+
+void AfSharedHeap::free(void *p) {
+    lock();
+    if(!isBroken()) {
+        heap_.free(p);
+    }
+    unlock();
+}
+
+void AfSharedHeap::setRoot(const AfSharedHandle root) {
+    lock();
+    heap_.setRoot(fromHandle(root));
+    unlock();
+}
+
+AfSharedHandle AfSharedHeap::getRoot() {
+    lock();
+    const AfSharedHandle root = toHandle(heap_.getRoot());
+    unlock();
+    return root;
+}
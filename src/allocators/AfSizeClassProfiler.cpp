@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <map>
+
+#include "AfSizeClassProfiler.hpp"
+
+
+namespace {
+// one candidate class: requests which round up to this size when it is their class
+struct SizePoint {
+  std::size_t size;
+  std::size_t count;
+  std::size_t requested_bytes;
+};
+}
+
+AfSizeClassTable computeSizeClasses(const std::span<const AfSizeCount> histogram, const std::size_t num_classes,
+                                    const std::size_t alignment, const std::size_t max_size) {
+    assert(num_classes > 0 && alignment > 0 && max_size % alignment == 0);
+    AfSizeClassTable table{};
+
+    // requests of the sizes which round up to the same multiple of alignment can only go to the same class
+    std::map<std::size_t, SizePoint> points_by_size{};
+    points_by_size[max_size] = {max_size, 0, 0};
+    for(const auto &[size, count]: histogram) {
+        if(size > max_size) {
+            table.skipped_requests += count;
+            continue;
+        }
+        const std::size_t aligned_size = std::max((size + alignment - 1) / alignment * alignment, alignment);
+        SizePoint &point = points_by_size.try_emplace(aligned_size, SizePoint{aligned_size, 0, 0}).first->second;
+        point.count += count;
+        point.requested_bytes += size * count;
+        table.requested_bytes += size * count;
+    }
+    std::vector<SizePoint> points{};
+    for(const auto &[size, point]: points_by_size) {
+        points.push_back(point);
+    }
+    const std::size_t n = points.size();
+    const std::size_t k = std::min(num_classes, n);
+
+    // prefix sums, so the cost of a class over the points [first, last] is constant time
+    std::vector<std::size_t> counts(n + 1, 0);
+    std::vector<std::size_t> requested(n + 1, 0);
+    for(std::size_t i{0}; i < n; i++) {
+        counts[i + 1] = counts[i] + points[i].count;
+        requested[i + 1] = requested[i] + points[i].requested_bytes;
+    }
+    auto cost = [&](const std::size_t first, const std::size_t last) {
+        return points[last].size * (counts[last + 1] - counts[first]) - (requested[last + 1] - requested[first]);
+    };
+
+    // waste[j][i]: least waste of the points [0, i] with j + 1 classes, the last one at the point i
+    constexpr std::size_t INFINITE_WASTE = std::numeric_limits<std::size_t>::max();
+    std::vector<std::vector<std::size_t>> waste(k, std::vector<std::size_t>(n, INFINITE_WASTE));
+    std::vector<std::vector<std::size_t>> previous_class(k, std::vector<std::size_t>(n, 0));
+    for(std::size_t i{0}; i < n; i++) {
+        waste[0][i] = cost(0, i);
+    }
+    for(std::size_t j{1}; j < k; j++) {
+        for(std::size_t i{j}; i < n; i++) {
+            for(std::size_t p{j - 1}; p < i; p++) {
+                const std::size_t candidate = waste[j - 1][p] + cost(p + 1, i);
+                if(candidate < waste[j][i]) {
+                    waste[j][i] = candidate;
+                    previous_class[j][i] = p;
+                }
+            }
+        }
+    }
+
+    table.wasted_bytes = waste[k - 1][n - 1];
+    table.classes.resize(k);
+    std::size_t point = n - 1;
+    for(std::size_t j{k}; j-- > 0;) {
+        table.classes[j] = points[point].size;
+        point = previous_class[j][point];
+    }
+    return table;
+}
+
+std::size_t getRoundingWaste(const std::span<const AfSizeCount> histogram, const std::span<const std::size_t> classes) {
+    std::size_t wasted{0};
+    for(const auto &[size, count]: histogram) {
+        const auto size_class = std::ranges::lower_bound(classes, size);
+        if(size_class != classes.end()) {
+            wasted += (*size_class - size) * count;
+        }
+    }
+    return wasted;
+}
@@ -0,0 +1,149 @@
+#include <bit>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <format>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "AfStatsSegment.hpp"
+
+
+namespace {
+// a publish copies a few kilobytes, readers which keep overlapping with it give up after this many copies
+constexpr int MAX_READ_ATTEMPTS = 1000;
+
+using RecordWords = std::array<std::uint64_t, AF_STATS_RECORD_WORDS>;
+
+// true while this process has a writer, only then may the segment named after our pid be in use by us
+std::atomic<bool> writer_exists{false};
+
+/**
+ * Segment named after our pid which this process does not write was left behind by a dead process with the same
+ * pid. A pid stored in the segment by some other process which is still alive keeps the segment where it is.
+ */
+bool isStaleSegment(const std::string &name, const pid_t pid) {
+    const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0) {
+        // removed in the meantime
+        return errno == ENOENT;
+    }
+    struct stat fd_stat{};
+    void *base{MAP_FAILED};
+    if(fstat(fd, &fd_stat) == 0 && static_cast<std::size_t>(fd_stat.st_size) == sizeof(AfStatsSegmentLayout)) {
+        base = mmap(nullptr, sizeof(AfStatsSegmentLayout), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if(base == MAP_FAILED) {
+        // creator died before the segment got its size
+        return true;
+    }
+    const auto stored_pid = static_cast<pid_t>(static_cast<const AfStatsSegmentLayout *>(base)->pid);
+    munmap(base, sizeof(AfStatsSegmentLayout));
+    return stored_pid == pid || stored_pid == 0 || (kill(stored_pid, 0) != 0 && errno == ESRCH);
+}
+}
+
+AfStatsSegment::AfStatsSegment(AfStatsSegmentLayout *layout, const bool writer, const pid_t pid)
+    : layout_(layout), writer_(writer), pid_(pid) {}
+
+std::string AfStatsSegment::getName(const pid_t pid) {
+    return std::format("/afmalloc-stats.{}", pid);
+}
+
+std::unique_ptr<AfStatsSegment> AfStatsSegment::create() {
+    if(writer_exists.exchange(true)) {
+        return nullptr;
+    }
+    const pid_t pid = getpid();
+    const std::string name = getName(pid);
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd < 0 && errno == EEXIST && isStaleSegment(name, pid)) {
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if(fd < 0) {
+        writer_exists.store(false);
+        return nullptr;
+    }
+    void *base{MAP_FAILED};
+    if(ftruncate(fd, sizeof(AfStatsSegmentLayout)) == 0) {
+        base = mmap(nullptr, sizeof(AfStatsSegmentLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if(base == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        writer_exists.store(false);
+        return nullptr;
+    }
+    // memory of the new segment is zero, which is sequence 0 and an empty record
+    auto *layout = static_cast<AfStatsSegmentLayout *>(base);
+    layout->pid = static_cast<std::uint64_t>(pid);
+    layout->magic.store(AF_STATS_MAGIC, std::memory_order_release);
+    return std::unique_ptr<AfStatsSegment>{new AfStatsSegment{layout, true, pid}};
+}
+
+std::unique_ptr<AfStatsSegment> AfStatsSegment::open(const pid_t pid) {
+    const int fd = shm_open(getName(pid).c_str(), O_RDONLY, 0);
+    if(fd < 0) {
+        return nullptr;
+    }
+    struct stat fd_stat{};
+    void *base{MAP_FAILED};
+    if(fstat(fd, &fd_stat) == 0 && static_cast<std::size_t>(fd_stat.st_size) == sizeof(AfStatsSegmentLayout)) {
+        base = mmap(nullptr, sizeof(AfStatsSegmentLayout), PROT_READ, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if(base == MAP_FAILED) {
+        return nullptr;
+    }
+    auto *layout = static_cast<AfStatsSegmentLayout *>(base);
+    if(layout->magic.load(std::memory_order_acquire) != AF_STATS_MAGIC) {
+        munmap(base, sizeof(AfStatsSegmentLayout));
+        return nullptr;
+    }
+    return std::unique_ptr<AfStatsSegment>{new AfStatsSegment{layout, false, pid}};
+}
+
+AfStatsSegment::~AfStatsSegment() {
+    munmap(layout_, sizeof(AfStatsSegmentLayout));
+    if(writer_) {
+        shm_unlink(getName(pid_).c_str());
+        writer_exists.store(false);
+    }
+}
+
+void AfStatsSegment::publish(const AfStatsRecord &record) {
+    const auto words = std::bit_cast<RecordWords>(record);
+    const std::uint64_t sequence = layout_->sequence.load(std::memory_order_relaxed);
+    layout_->sequence.store(sequence + 1, std::memory_order_relaxed);
+    // odd sequence is visible before any word of the record changes
+    std::atomic_thread_fence(std::memory_order_release);
+    for(std::size_t i{0}; i < AF_STATS_RECORD_WORDS; i++) {
+        layout_->record[i].store(words[i], std::memory_order_relaxed);
+    }
+    layout_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+bool AfStatsSegment::read(AfStatsRecord &out) const {
+    RecordWords words{};
+    for(int attempt{0}; attempt < MAX_READ_ATTEMPTS; attempt++) {
+        const std::uint64_t before = layout_->sequence.load(std::memory_order_acquire);
+        if(before % 2 != 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        for(std::size_t i{0}; i < AF_STATS_RECORD_WORDS; i++) {
+            words[i] = layout_->record[i].load(std::memory_order_relaxed);
+        }
+        // words are read before the sequence is checked again
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(layout_->sequence.load(std::memory_order_relaxed) == before) {
+            out = std::bit_cast<AfStatsRecord>(words);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,184 @@
+#include "concurrent_memory_pool_allocator.hpp"
+#include <cassert>
+#include <utility>
+
+namespace memory {
+    namespace {
+    std::atomic<std::size_t> instance_counter{0};
+    }
+
+    // ids start from 1, so the empty thread cache never matches
+    ConcurrentMemoryPoolAllocator::ConcurrentMemoryPoolAllocator(PageSizeAllocator &page_size_allocator,
+                                                                 const std::span<const std::size_t> size_classes,
+                                                                 const std::size_t magazine_size)
+        : instance_id_(instance_counter.fetch_add(1, std::memory_order_relaxed) + 1),
+          magazine_size_(magazine_size),
+          pool_(page_size_allocator, size_classes),
+          depots_(std::make_unique<Depot[]>(pool_.getNumSizeClasses())) {
+        assert(magazine_size > 0);
+    }
+
+    ConcurrentMemoryPoolAllocator::~ConcurrentMemoryPoolAllocator() {
+        for(auto &[thread_id, cache]: thread_caches_) {
+            for(ThreadMagazines &magazines: cache->classes) {
+                drainToPool(magazines.loaded);
+                drainToPool(magazines.previous);
+            }
+        }
+        for(std::size_t i{0}; i < pool_.getNumSizeClasses(); i++) {
+            for(Magazine &magazine: depots_[i].full) {
+                drainToPool(magazine);
+            }
+        }
+    }
+
+    void *ConcurrentMemoryPoolAllocator::allocate(const std::size_t alignment, const std::size_t size) {
+        const std::size_t size_class = pool_.findSizeClass(alignment, size);
+        if(size_class == pool_.getNumSizeClasses()) {
+            return nullptr;
+        }
+        ThreadMagazines &magazines = getThreadCache().classes[size_class];
+        if(magazines.loaded.empty() && !reload(magazines, size_class)) {
+            return nullptr;
+        }
+        void *ptr = magazines.loaded.back();
+        magazines.loaded.pop_back();
+        return ptr;
+    }
+
+    void ConcurrentMemoryPoolAllocator::deallocate(void *ptr, const std::size_t alignment, const std::size_t size) {
+        const std::size_t size_class = pool_.findSizeClass(alignment, size);
+        assert(size_class < pool_.getNumSizeClasses());
+        // a block filed under some other class would be handed out later for requests of that class
+        assert(ownsBlockOfClass(ptr, size_class));
+        ThreadMagazines &magazines = getThreadCache().classes[size_class];
+        if(magazines.loaded.size() == magazine_size_) {
+            unload(magazines, size_class);
+        }
+        magazines.loaded.push_back(ptr);
+    }
+
+    bool ConcurrentMemoryPoolAllocator::reload(ThreadMagazines &magazines, const std::size_t size_class) {
+        if(!magazines.previous.empty()) {
+            // previous is full
+            std::swap(magazines.loaded, magazines.previous);
+            return true;
+        }
+        depot_exchanges_.fetch_add(1, std::memory_order_relaxed);
+        Depot &depot = depots_[size_class];
+        {
+            std::lock_guard lock{depot.lock};
+            if(!depot.full.empty()) {
+                // both magazines are empty, one of them goes to the depot for a full one
+                depot.empty.push_back(std::move(magazines.previous));
+                magazines.previous = std::move(magazines.loaded);
+                magazines.loaded = std::move(depot.full.back());
+                depot.full.pop_back();
+                return true;
+            }
+        }
+        magazines.loaded.resize(magazine_size_);
+        std::size_t allocated{0};
+        {
+            std::lock_guard lock{pool_lock_};
+            allocated = pool_.allocateBatch(size_class, magazine_size_, magazines.loaded.data());
+        }
+        magazines.loaded.resize(allocated);
+        return allocated > 0;
+    }
+
+    void ConcurrentMemoryPoolAllocator::unload(ThreadMagazines &magazines, const std::size_t size_class) {
+        if(magazines.previous.empty()) {
+            std::swap(magazines.loaded, magazines.previous);
+            return;
+        }
+        depot_exchanges_.fetch_add(1, std::memory_order_relaxed);
+        // both magazines are full, one of them goes to the depot for an empty one
+        Magazine full = std::move(magazines.previous);
+        magazines.previous = std::move(magazines.loaded);
+        magazines.loaded = {};
+        bool full_taken{false};
+        Depot &depot = depots_[size_class];
+        {
+            std::lock_guard lock{depot.lock};
+            if(depot.full.size() < DEFAULT_DEPOT_FULL_MAGAZINES) {
+                depot.full.push_back(std::move(full));
+                full_taken = true;
+            }
+            if(!depot.empty.empty()) {
+                magazines.loaded = std::move(depot.empty.back());
+                depot.empty.pop_back();
+            }
+        }
+        if(!full_taken) {
+            // the depot holds enough blocks already, the pool can give empty pages back to the page allocator
+            drainToPool(full);
+            if(magazines.loaded.capacity() == 0) {
+                magazines.loaded = std::move(full);
+            }
+        }
+        if(magazines.loaded.capacity() == 0) {
+            magazines.loaded = makeMagazine();
+        }
+    }
+
+    void ConcurrentMemoryPoolAllocator::flushThreadCache() {
+        for(ThreadMagazines &magazines: getThreadCache().classes) {
+            drainToPool(magazines.loaded);
+            drainToPool(magazines.previous);
+        }
+    }
+
+    void ConcurrentMemoryPoolAllocator::drainToPool(Magazine &magazine) {
+        if(magazine.empty()) {
+            return;
+        }
+        {
+            std::lock_guard lock{pool_lock_};
+            pool_.deallocateBatch(magazine.data(), magazine.size());
+        }
+        magazine.clear();
+    }
+
+    bool ConcurrentMemoryPoolAllocator::ownsBlock(const void *ptr) {
+        std::lock_guard lock{pool_lock_};
+        return pool_.ownsBlock(ptr);
+    }
+
+    bool ConcurrentMemoryPoolAllocator::ownsBlockOfClass(const void *ptr, const std::size_t size_class) {
+        std::lock_guard lock{pool_lock_};
+        return pool_.ownsBlock(ptr) && pool_.getSizeClass(ptr) == size_class;
+    }
+
+    ConcurrentMemoryPoolAllocator::Magazine ConcurrentMemoryPoolAllocator::makeMagazine() const {
+        Magazine magazine;
+        magazine.reserve(magazine_size_);
+        return magazine;
+    }
+
+    ConcurrentMemoryPoolAllocator::ThreadCache &ConcurrentMemoryPoolAllocator::getThreadCache() {
+        // cache of the allocator this thread used last, a thread which switches between allocators
+        // finds its cache in the map under the lock
+        thread_local struct {
+            std::size_t instance_id;
+            ThreadCache *cache;
+        } last_used{0, nullptr};
+        if(last_used.instance_id == instance_id_) {
+            return *last_used.cache;
+        }
+        std::lock_guard lock{thread_caches_lock_};
+        auto [iter, inserted] = thread_caches_.try_emplace(std::this_thread::get_id(), nullptr);
+        if(inserted) {
+            // a thread which reuses the id of an exited thread takes over its magazines
+            iter->second = std::make_unique<ThreadCache>();
+            iter->second->classes.resize(pool_.getNumSizeClasses());
+            for(ThreadMagazines &magazines: iter->second->classes) {
+                magazines.loaded = makeMagazine();
+                magazines.previous = makeMagazine();
+            }
+        }
+        last_used = {instance_id_, iter->second.get()};
+        return *iter->second;
+    }
+
+} //namespace memory
@@ -0,0 +1,104 @@
+#include "lock_free_pool_allocator.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+
+namespace memory {
+    namespace {
+    std::size_t roundUpBlockSize(const std::size_t size, const std::size_t alignment) {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+        // a multiple of the alignment is aligned in the page aligned slabs of the pool
+        const std::size_t granule = std::max(alignment, sizeof(void *));
+        return (std::max(size, std::size_t{1}) + granule - 1) / granule * granule;
+    }
+    }
+
+    LockFreePoolAllocator::LockFreePoolAllocator(PageSizeAllocator &page_size_allocator, const std::size_t size,
+                                                 const std::size_t alignment, const std::size_t refill_blocks)
+        : block_size_(roundUpBlockSize(size, alignment)),
+          refill_blocks_(refill_blocks),
+          pool_(page_size_allocator, std::array<std::size_t, 1>{block_size_}),
+          refill_buffer_(refill_blocks) {
+        assert(refill_blocks > 0);
+    }
+
+    LockFreePoolAllocator::~LockFreePoolAllocator() {
+        TaggedHead head = head_.load(std::memory_order_acquire);
+        while(head.block != nullptr) {
+            FreeBlock *next = getNext(head.block).load(std::memory_order_relaxed);
+            pool_.deallocate(head.block);
+            head.block = next;
+        }
+    }
+
+    void *LockFreePoolAllocator::allocate() {
+        TaggedHead head = head_.load(std::memory_order_acquire);
+        while(true) {
+            if(head.block == nullptr) {
+                if(!refill()) {
+                    return nullptr;
+                }
+                head = head_.load(std::memory_order_acquire);
+                continue;
+            }
+            // the block may be popped and written to by another thread by now, the tag changed then
+            // and the compare exchange fails, so the next pointer read here is never installed
+            const TaggedHead next{getNext(head.block).load(std::memory_order_relaxed), head.tag + 1};
+            if(head_.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire)) {
+                return head.block;
+            }
+        }
+    }
+
+    void LockFreePoolAllocator::deallocate(void *ptr) {
+        assert(ptr != nullptr);
+        auto *block = static_cast<FreeBlock *>(ptr);
+        pushChain(block, block);
+    }
+
+    void LockFreePoolAllocator::pushChain(FreeBlock *first, FreeBlock *last) {
+        TaggedHead head = head_.load(std::memory_order_relaxed);
+        do {
+            getNext(last).store(head.block, std::memory_order_relaxed);
+        } while(!head_.compare_exchange_weak(head, TaggedHead{first, head.tag + 1}, std::memory_order_release,
+                                             std::memory_order_relaxed));
+    }
+
+    std::size_t LockFreePoolAllocator::carveLocked(const std::size_t count) {
+        const std::size_t carved = pool_.allocateBatch(0, std::min(count, refill_blocks_), refill_buffer_.data());
+        if(carved == 0) {
+            return 0;
+        }
+        // blocks are linked before the chain is published with one compare exchange
+        auto *first = static_cast<FreeBlock *>(refill_buffer_[0]);
+        FreeBlock *last = first;
+        for(std::size_t i{1}; i < carved; i++) {
+            auto *block = static_cast<FreeBlock *>(refill_buffer_[i]);
+            getNext(last).store(block, std::memory_order_relaxed);
+            last = block;
+        }
+        num_carved_blocks_.fetch_add(carved, std::memory_order_relaxed);
+        pushChain(first, last);
+        return carved;
+    }
+
+    bool LockFreePoolAllocator::refill() {
+        std::lock_guard lock{refill_lock_};
+        // another thread may have refilled while this one waited, or blocks were freed
+        if(head_.load(std::memory_order_acquire).block != nullptr) {
+            return true;
+        }
+        return carveLocked(refill_blocks_) > 0;
+    }
+
+    bool LockFreePoolAllocator::reserve(const std::size_t count) {
+        std::lock_guard lock{refill_lock_};
+        while(num_carved_blocks_.load(std::memory_order_relaxed) < count) {
+            if(carveLocked(count - num_carved_blocks_.load(std::memory_order_relaxed)) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+} //namespace memory
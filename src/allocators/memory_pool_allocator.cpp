@@ -2,48 +2,247 @@
 #include <cstdint>
 #include <algorithm>
 namespace memory {
+    MemoryPoolAllocator::MemoryPoolAllocator(PageSizeAllocator &page_size_allocator,
+                                             const std::span<const std::size_t> size_classes)
+        : page_size_allocator_(page_size_allocator) {
+        assert(!size_classes.empty());
+        assert(std::ranges::is_sorted(size_classes));
+        for(const std::size_t block_size: size_classes) {
+            // free block holds the pointer to the next one
+            assert(block_size >= sizeof(FreeBlock) && block_size % sizeof(FreeBlock) == 0);
+            assert(block_size <= PAGE_SIZE);
+            size_classes_.push_back({block_size});
+        }
+    }
+
+    std::size_t MemoryPoolAllocator::findSizeClass(const std::size_t alignment, const std::size_t size) const {
+        auto size_class = std::ranges::lower_bound(size_classes_, size, {}, &SizeClass::block_size);
+        // blocks start at multiples of the block size in a page aligned slab
+        while(size_class != size_classes_.end() && (size_class->block_size & (~size_class->block_size + 1)) < alignment) {
+            ++size_class;
+        }
+        return static_cast<std::size_t>(size_class - size_classes_.begin());
+    }
+
+    std::size_t MemoryPoolAllocator::getBlockSize(const std::size_t alignment, const std::size_t size) const {
+        const std::size_t size_class = findSizeClass(alignment, size);
+        return size_class == size_classes_.size() ? 0 : size_classes_[size_class].block_size;
+    }
+
     void *MemoryPoolAllocator::allocate(std::size_t alignment, std::size_t size){
-        assert(size <= 512);
-        assert(alignment <= 512);
-
-        if (free_pointers_.empty()) {
-            void *ptr = page_size_allocator_.allocate(alignment, size);
-            pages_ptrs_.emplace_back(ptr);
-            assert(ptr != nullptr);
-            pages_allocated_+=1;
-            for(std::size_t i{0}; i<PAGE_SIZE/BLOCK_SIZE; i++) {
-                free_pointers_.emplace_back(reinterpret_cast<void *>(reinterpret_cast<uint64_t>(ptr) + i * 512));
+        const std::size_t size_class = findSizeClass(alignment, size);
+        if(size_class == size_classes_.size()) {
+            return nullptr;
+        }
+        return allocateFromClass(size_class);
+    }
+
+    std::size_t MemoryPoolAllocator::allocateBatch(const std::size_t size_class, const std::size_t count, void **out_ptrs) {
+        assert(size_class < size_classes_.size());
+        for(std::size_t i{0}; i < count; i++) {
+            out_ptrs[i] = allocateFromClass(size_class);
+            if(out_ptrs[i] == nullptr) {
+                return i;
             }
         }
-        assert(!free_pointers_.empty());
+        return count;
+    }
+
+    void MemoryPoolAllocator::deallocateBatch(void *const *ptrs, const std::size_t count) {
+        for(std::size_t i{0}; i < count; i++) {
+            deallocate(ptrs[i]);
+        }
+    }
 
-        // swap beginning and end
-        std::iter_swap(free_pointers_.begin(), free_pointers_.end()-1);
+    void *MemoryPoolAllocator::allocateFromClass(const std::size_t size_class) {
+        SizeClass &current_class = size_classes_[size_class];
 
-        auto *free_ptr = free_pointers_.back();
-        free_pointers_.pop_back();
-        used_pointers_.emplace_back(free_ptr);
-        return free_ptr;
+        PoolSlab *slab = current_class.partial_slabs;
+        if (slab == nullptr) {
+            slab = takeSlab(size_class);
+            if(slab == nullptr) {
+                return nullptr;
+            }
+            pushSlab(current_class.partial_slabs, slab);
+        }
+
+        void *block{nullptr};
+        if(slab->free_list != nullptr) {
+            block = slab->free_list;
+            slab->free_list = slab->free_list->next;
+        } else {
+            assert(static_cast<std::size_t>(slab->end - slab->bump) >= current_class.block_size);
+            block = slab->bump;
+            slab->bump += current_class.block_size;
+        }
+        slab->used += 1;
+        if(slab->isFull(current_class.block_size)) {
+            // full slabs are in no list, the first free puts them back
+            unlinkSlab(current_class.partial_slabs, slab);
+        }
+        num_free_blocks_ -= 1;
+        num_used_blocks_ += 1;
+        return block;
     }
 
     void MemoryPoolAllocator::deallocate(void *ptr) {
-        auto const elem = std::find_if(used_pointers_.begin(), used_pointers_.end(), [&ptr](void * const &curr) {
-            return reinterpret_cast<uint64_t>(ptr) == reinterpret_cast<uint64_t>(curr);
-        });
-        assert(elem != used_pointers_.end());
-        // kick out the element
-        std::iter_swap(elem, used_pointers_.end()-1);
-        used_pointers_.pop_back();
+        assert(ownsBlock(ptr));
+        assert(num_used_blocks_ > 0);
+
+        PoolSlab &slab = *page_slabs_.find(getPage(ptr))->second;
+        SizeClass &current_class = size_classes_[slab.size_class];
+        if(slab.isFull(current_class.block_size)) {
+            pushSlab(current_class.partial_slabs, &slab);
+        }
+        auto *block = static_cast<FreeBlock *>(ptr);
+        block->next = slab.free_list;
+        slab.free_list = block;
+        slab.used -= 1;
+        num_free_blocks_ += 1;
+        num_used_blocks_ -= 1;
 
-        free_pointers_.emplace_back(ptr);
+        if(slab.used == 0) {
+            unlinkSlab(current_class.partial_slabs, &slab);
+            pushEmptySlab(&slab);
+            if(num_empty_pages_ > empty_pages_high_) {
+                trimEmptyPages(empty_pages_low_);
+            }
+        }
+    }
+
+    MemoryPoolAllocator::PoolSlab *MemoryPoolAllocator::takeSlab(const std::size_t size_class) {
+        SizeClass &current_class = size_classes_[size_class];
+        PoolSlab *slab = empty_slabs_;
+        if(slab != nullptr) {
+            unlinkEmptySlab(slab);
+            if(slab->size_class == size_class) {
+                // free list and bump are already those of the class
+                return slab;
+            }
+            num_free_blocks_ -= getBlocksPerSlab(*slab);
+        } else {
+            const std::size_t num_pages = current_class.next_slab_pages;
+            void *ptr = page_size_allocator_.allocate(PAGE_SIZE, num_pages * PAGE_SIZE);
+            if(ptr == nullptr) {
+                return nullptr;
+            }
+            slab = &slabs_.emplace(ptr, PoolSlab{ptr, num_pages}).first->second;
+            for(std::size_t i{0}; i < num_pages; i++) {
+                page_slabs_.emplace(static_cast<char *>(ptr) + i * PAGE_SIZE, slab);
+            }
+            slabs_allocated_+=1;
+            current_class.next_slab_pages = std::min(num_pages * 2, max_slab_pages_);
+        }
+        // nothing is carved yet, blocks are cut from the bump pointer when they are first needed
+        slab->size_class = size_class;
+        slab->free_list = nullptr;
+        slab->bump = static_cast<char *>(slab->memory);
+        slab->end = slab->bump + getBlocksPerSlab(*slab) * current_class.block_size;
+        num_free_blocks_ += getBlocksPerSlab(*slab);
+        return slab;
+    }
+
+    void MemoryPoolAllocator::trimEmptyPages(const std::size_t keep) {
+        while(num_empty_pages_ > keep) {
+            // the slab emptied longest ago goes first, the recently used ones at the head are still warm
+            PoolSlab *slab = empty_slabs_tail_;
+            unlinkEmptySlab(slab);
+            num_free_blocks_ -= getBlocksPerSlab(*slab);
+            void *memory = slab->memory;
+            for(std::size_t i{0}; i < slab->num_pages; i++) {
+                page_slabs_.erase(static_cast<char *>(memory) + i * PAGE_SIZE);
+            }
+            slabs_.erase(memory);
+            page_size_allocator_.deallocate(memory);
+        }
+    }
+
+    void MemoryPoolAllocator::setEmptyPageMarks(const std::size_t low, const std::size_t high) {
+        assert(low <= high);
+        empty_pages_low_ = low;
+        empty_pages_high_ = high;
+        if(num_empty_pages_ > empty_pages_high_) {
+            trimEmptyPages(empty_pages_low_);
+        }
+    }
+
+    void MemoryPoolAllocator::setSlabPages(const std::size_t first, const std::size_t max) {
+        assert(first > 0 && first <= max);
+        max_slab_pages_ = max;
+        for(SizeClass &size_class: size_classes_) {
+            size_class.next_slab_pages = first;
+        }
+    }
+
+    void MemoryPoolAllocator::pushSlab(PoolSlab *&list, PoolSlab *slab) {
+        slab->prev = nullptr;
+        slab->next = list;
+        if(list != nullptr) {
+            list->prev = slab;
+        }
+        list = slab;
+    }
+
+    void MemoryPoolAllocator::unlinkSlab(PoolSlab *&list, PoolSlab *slab) {
+        if(slab->prev != nullptr) {
+            slab->prev->next = slab->next;
+        } else {
+            list = slab->next;
+        }
+        if(slab->next != nullptr) {
+            slab->next->prev = slab->prev;
+        }
+        slab->prev = nullptr;
+        slab->next = nullptr;
+    }
+
+    void MemoryPoolAllocator::pushEmptySlab(PoolSlab *slab) {
+        pushSlab(empty_slabs_, slab);
+        if(empty_slabs_tail_ == nullptr) {
+            empty_slabs_tail_ = slab;
+        }
+        num_empty_pages_ += slab->num_pages;
+    }
+
+    void MemoryPoolAllocator::unlinkEmptySlab(PoolSlab *slab) {
+        if(slab == empty_slabs_tail_) {
+            empty_slabs_tail_ = slab->prev;
+        }
+        unlinkSlab(empty_slabs_, slab);
+        num_empty_pages_ -= slab->num_pages;
+    }
+
+    bool MemoryPoolAllocator::ownsBlock(const void *ptr) const {
+        const auto page_slab = page_slabs_.find(getPage(ptr));
+        if(page_slab == page_slabs_.end()) {
+            return false;
+        }
+        const PoolSlab &slab = *page_slab->second;
+        const std::size_t block_size = size_classes_[slab.size_class].block_size;
+        const auto offset = reinterpret_cast<std::uintptr_t>(ptr) - reinterpret_cast<std::uintptr_t>(slab.memory);
+        // tail of the slab which is too small for a block is not a block
+        return offset % block_size == 0 && offset + block_size <= slab.num_pages * PAGE_SIZE;
+    }
+
+    std::size_t MemoryPoolAllocator::getSizeClass(const void *ptr) const {
+        assert(ownsBlock(ptr));
+        return page_slabs_.at(getPage(ptr))->size_class;
     }
 
     void MemoryPoolAllocator::release() {
-        assert(used_pointers_.empty());
-        for(void *ptr: pages_ptrs_) {
-            page_size_allocator_.deallocate(ptr);
+        assert(num_used_blocks_ == 0);
+        for(const auto &[memory, slab]: slabs_) {
+            page_size_allocator_.deallocate(slab.memory);
+        }
+        slabs_.clear();
+        page_slabs_.clear();
+        for(SizeClass &size_class: size_classes_) {
+            size_class.partial_slabs = nullptr;
         }
-        free_pointers_.clear();
+        empty_slabs_ = nullptr;
+        empty_slabs_tail_ = nullptr;
+        num_empty_pages_ = 0;
+        num_free_blocks_ = 0;
     }
 
 } //namespace memory
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+#include <coroutine>
+#include <exception>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "AfCoroutineFrame.hpp"
+
+// Coroutine which only suspends at the start, enough to own a frame
+struct PooledCoroutine {
+  struct promise_type : AfPooledFrame {
+    PooledCoroutine get_return_object() {
+      return PooledCoroutine{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_always final_suspend() noexcept {
+      return {};
+    }
+
+    void return_void() {}
+
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+
+  explicit PooledCoroutine(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+  PooledCoroutine(PooledCoroutine &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+
+  ~PooledCoroutine() {
+    if(handle_) {
+      handle_.destroy();
+    }
+  }
+
+  [[nodiscard]] void *getFrame() const {
+    return handle_.address();
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+PooledCoroutine makeCoroutine(int value) {
+    [[maybe_unused]] volatile int kept_in_frame = value;
+    co_return;
+}
+
+PooledCoroutine makeBigCoroutine() {
+    // read after the suspension, so the buffer has to live in the frame
+    volatile char buffer[4096]{};
+    co_await std::suspend_always{};
+    buffer[0] = static_cast<char>(buffer[sizeof(buffer) - 1] + 1);
+}
+
+TEST(CoroutineFrameTest, TestFramesAreReused) {
+    const AfCoroutineFrameStats before = getCoroutineFrameStats();
+    void *frame{nullptr};
+    {
+        PooledCoroutine coroutine = makeCoroutine(1);
+        frame = coroutine.getFrame();
+        coroutine.handle_.resume();
+    }
+    PooledCoroutine coroutine = makeCoroutine(2);
+    ASSERT_EQ(coroutine.getFrame(), frame);
+    ASSERT_GT(getCoroutineFrameStats().reused, before.reused);
+}
+
+TEST(CoroutineFrameTest, TestFrameFreedOnAnotherThread) {
+    PooledCoroutine coroutine = makeCoroutine(1);
+    void *frame = coroutine.getFrame();
+    std::vector<PooledCoroutine> others;
+    const AfCoroutineFrameStats before = getCoroutineFrameStats();
+    std::thread{[moved = std::move(coroutine)]() mutable {
+        PooledCoroutine destroyed_here = std::move(moved);
+    }}.join();
+
+    // once the free frames of the size run out, pool drains the remote frees before it goes to AfMalloc
+    while(true) {
+        PooledCoroutine next = makeCoroutine(3);
+        if(next.getFrame() == frame) {
+            break;
+        }
+        ASSERT_EQ(getCoroutineFrameStats().refills, before.refills);
+        others.push_back(std::move(next));
+    }
+    ASSERT_EQ(getCoroutineFrameStats().remote_frees, before.remote_frees + 1);
+}
+
+TEST(CoroutineFrameTest, TestBigFramesAreNotPooled) {
+    const AfCoroutineFrameStats before = getCoroutineFrameStats();
+    {
+        PooledCoroutine coroutine = makeBigCoroutine();
+        coroutine.handle_.resume();
+    }
+    const AfCoroutineFrameStats after = getCoroutineFrameStats();
+    ASSERT_EQ(after.reused, before.reused);
+    ASSERT_EQ(after.refills, before.refills);
+}
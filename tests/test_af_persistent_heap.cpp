@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "AfPersistentHeap.hpp"
+
+struct Node {
+  AfOffset next;
+  std::size_t value;
+};
+
+class PersistentHeapTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+      path_ = std::string{"/tmp/af_persistent_heap_test_"} + std::to_string(getpid());
+      unlink(path_.c_str());
+    }
+
+    void TearDown() override {
+      unlink(path_.c_str());
+    }
+
+    std::string path_{};
+};
+
+TEST_F(PersistentHeapTest, TestReopenKeepsObjects) {
+    {
+        auto heap = AfPersistentHeap::open(path_.c_str(), 1 << 20);
+        ASSERT_NE(heap, nullptr);
+        ASSERT_FALSE(heap->wasRecovered());
+
+        // list 0 -> 1 -> ... -> 99, linked with offsets
+        AfOffset head = AF_NULL_OFFSET;
+        for(std::size_t i{100}; i-- > 0;) {
+            auto *node = static_cast<Node *>(heap->malloc(sizeof(Node)));
+            ASSERT_NE(node, nullptr);
+            *node = {head, i};
+            head = heap->toOffset(node);
+        }
+        heap->setRoot(heap->fromOffset(head));
+    }
+
+    auto heap = AfPersistentHeap::open(path_.c_str(), 1 << 20);
+    ASSERT_NE(heap, nullptr);
+    ASSERT_TRUE(heap->wasRecovered());
+    std::size_t expected{0};
+    for(auto *node = heap->getRoot<Node>(); node != nullptr; node = heap->fromOffset<Node>(node->next)) {
+        ASSERT_EQ(node->value, expected++);
+    }
+    ASSERT_EQ(expected, 100);
+}
+
+TEST_F(PersistentHeapTest, TestRegionIsRelocatable) {
+    std::vector<std::byte> region(64 * 1024);
+    AfOffsetHeap heap = AfOffsetHeap::create(region.data(), region.size());
+    auto *text = static_cast<char *>(heap.malloc(32));
+    strcpy(text, "relocated");
+    auto *node = static_cast<Node *>(heap.malloc(sizeof(Node)));
+    *node = {heap.toOffset(text), 42};
+    heap.setRoot(node);
+    heap.free(heap.malloc(300));
+
+    // the same bytes at another address are the same heap
+    std::vector<std::byte> copy = region;
+    auto moved_heap = AfOffsetHeap::attach(copy.data(), copy.size());
+    ASSERT_TRUE(moved_heap.has_value());
+    auto *moved_node = static_cast<Node *>(moved_heap->getRoot());
+    ASSERT_NE(moved_node, node);
+    ASSERT_EQ(moved_node->value, 42);
+    ASSERT_STREQ(static_cast<char *>(moved_heap->fromOffset(moved_node->next)), "relocated");
+    ASSERT_NE(moved_heap->malloc(100), nullptr);
+    ASSERT_TRUE(moved_heap->checkConsistency());
+}
+
+TEST_F(PersistentHeapTest, TestCorruptionIsDetected) {
+    std::vector<std::byte> region(64 * 1024);
+    AfOffsetHeap heap = AfOffsetHeap::create(region.data(), region.size());
+    void *first = heap.malloc(100);
+    void *second = heap.malloc(100);
+    heap.malloc(100);
+    heap.free(second);
+    ASSERT_TRUE(AfOffsetHeap::attach(region.data(), region.size()).has_value());
+
+    // size of the first chunk does not reach the next chunk any more
+    auto *size = reinterpret_cast<std::uint64_t *>(static_cast<std::byte *>(first) - 8);
+    *size += 16;
+    ASSERT_FALSE(AfOffsetHeap::attach(region.data(), region.size()).has_value());
+    *size -= 16;
+    ASSERT_TRUE(AfOffsetHeap::attach(region.data(), region.size()).has_value());
+
+    ASSERT_FALSE(AfOffsetHeap::attach(region.data(), region.size() / 2).has_value());
+    std::ranges::fill(region, std::byte{0});
+    ASSERT_FALSE(AfOffsetHeap::attach(region.data(), region.size()).has_value());
+}
+
+TEST_F(PersistentHeapTest, TestCoalescingStaysConsistent) {
+    std::vector<std::byte> region(1 << 20);
+    AfOffsetHeap heap = AfOffsetHeap::create(region.data(), region.size());
+    const std::size_t initial_free = heap.getTopFreeSize();
+
+    std::mt19937 generator{42};
+    std::vector<void *> ptrs;
+    for(std::size_t i{0}; i < 5000; i++) {
+        if(ptrs.empty() || generator() % 3 != 0) {
+            void *ptr = heap.malloc(generator() % 1000);
+            ASSERT_NE(ptr, nullptr);
+            ptrs.push_back(ptr);
+        } else {
+            std::swap(ptrs[generator() % ptrs.size()], ptrs.back());
+            heap.free(ptrs.back());
+            ptrs.pop_back();
+        }
+    }
+    ASSERT_TRUE(heap.checkConsistency());
+
+    // everything freed coalesces back into the top
+    std::ranges::for_each(ptrs, [&heap](void *ptr) { heap.free(ptr); });
+    ASSERT_TRUE(heap.checkConsistency());
+    ASSERT_EQ(heap.getTopFreeSize(), initial_free);
+}
+
+TEST_F(PersistentHeapTest, TestExhaustedRegionStaysInBounds) {
+    // the region ends right at a guard page, a write past its end faults
+    const long page_size = sysconf(_SC_PAGESIZE);
+    auto *mapping = static_cast<std::byte *>(mmap(nullptr, 2 * page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    ASSERT_NE(mapping, MAP_FAILED);
+    ASSERT_EQ(mprotect(mapping + page_size, page_size, PROT_NONE), 0);
+    AfOffsetHeap heap = AfOffsetHeap::create(mapping, page_size);
+
+    std::vector<void *> ptrs;
+    while(heap.getTopFreeSize() > 64) {
+        ptrs.push_back(heap.malloc(40));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+    // the last chunk takes all of the top, the next top chunk is still written inside the region
+    void *last = heap.malloc(heap.getTopFreeSize() - 8);
+    ASSERT_NE(last, nullptr);
+    ASSERT_EQ(heap.getTopFreeSize(), 0);
+    ASSERT_EQ(heap.malloc(1), nullptr);
+    ASSERT_TRUE(heap.checkConsistency());
+
+    heap.free(last);
+    std::ranges::for_each(ptrs, [&heap](void *ptr) { heap.free(ptr); });
+    ASSERT_TRUE(heap.checkConsistency());
+    ASSERT_EQ(munmap(mapping, 2 * page_size), 0);
+}
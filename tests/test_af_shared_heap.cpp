@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "AfSharedHeap.hpp"
+
+struct Message {
+  AfSharedHandle text;
+  std::size_t length;
+};
+
+static int waitForChild(const pid_t pid) {
+    int status{0};
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+TEST(SharedHeapTest, TestHandlesPassBetweenProcesses) {
+    auto heap = AfSharedHeap::createAnonymous(1 << 20);
+    ASSERT_NE(heap, nullptr);
+    auto *request = static_cast<char *>(heap->malloc(64));
+    strcpy(request, "ping");
+    const AfSharedHandle request_handle = heap->toHandle(request);
+
+    const pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if(pid == 0) {
+        // keep the parent's mapping busy, so the child maps the heap somewhere else
+        auto child_heap = AfSharedHeap::fromFd(heap->getFd());
+        if(child_heap == nullptr || child_heap->fromHandle(request_handle) == request) {
+            _exit(1);
+        }
+        if(strcmp(child_heap->fromHandle<char>(request_handle), "ping") != 0) {
+            _exit(2);
+        }
+        auto *reply_text = static_cast<char *>(child_heap->malloc(64));
+        strcpy(reply_text, "pong");
+        auto *reply = static_cast<Message *>(child_heap->malloc(sizeof(Message)));
+        *reply = {child_heap->toHandle(reply_text), 4};
+        child_heap->setRoot(child_heap->toHandle(reply));
+        _exit(0);
+    }
+    ASSERT_EQ(waitForChild(pid), 0);
+
+    const auto *reply = heap->fromHandle<Message>(heap->getRoot());
+    ASSERT_NE(reply, nullptr);
+    ASSERT_EQ(reply->length, 4);
+    ASSERT_STREQ(heap->fromHandle<char>(reply->text), "pong");
+    heap->free(heap->fromHandle(reply->text));
+    heap->free(request);
+}
+
+TEST(SharedHeapTest, TestDeadLockOwnerDoesNotBlock) {
+    auto heap = AfSharedHeap::createAnonymous(1 << 20);
+    ASSERT_NE(heap, nullptr);
+    heap->free(heap->malloc(100));
+
+    const pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if(pid == 0) {
+        heap->lock();
+        _exit(0);
+    }
+    ASSERT_EQ(waitForChild(pid), 0);
+
+    // heap was consistent when the owner died, so it can still be used
+    void *ptr = heap->malloc(100);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_FALSE(heap->isBroken());
+    heap->free(ptr);
+}
+
+TEST(SharedHeapTest, TestNamedHeap) {
+    const std::string name = std::string{"/af_shared_heap_test_"} + std::to_string(getpid());
+    AfSharedHeap::unlink(name.c_str());
+    ASSERT_EQ(AfSharedHeap::open(name.c_str()), nullptr);
+
+    auto heap = AfSharedHeap::create(name.c_str(), 1 << 16);
+    ASSERT_NE(heap, nullptr);
+    ASSERT_EQ(AfSharedHeap::create(name.c_str(), 1 << 16), nullptr);
+    void *ptr = heap->malloc(100);
+    heap->setRoot(heap->toHandle(ptr));
+
+    auto other = AfSharedHeap::open(name.c_str());
+    ASSERT_NE(other, nullptr);
+    ASSERT_EQ(other->getRoot(), heap->toHandle(ptr));
+    other->free(other->fromHandle(other->getRoot()));
+    ASSERT_TRUE(AfSharedHeap::unlink(name.c_str()));
+    ASSERT_EQ(AfSharedHeap::open(name.c_str()), nullptr);
+}
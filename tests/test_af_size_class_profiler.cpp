@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "AfSizeClassProfiler.hpp"
+
+TEST(SizeClassProfilerTest, TestSpikySizesGetExactClasses) {
+    // few protocol structs, rounding them to 16 byte steps wastes a lot
+    const std::vector<AfSizeCount> histogram{{40, 1000}, {72, 5000}, {200, 300}, {300, 10}};
+    const AfSizeClassTable table = computeSizeClasses(histogram, 5, 8, 512);
+    ASSERT_EQ(table.classes, (std::vector<std::size_t>{40, 72, 200, 304, 512}));
+    ASSERT_EQ(table.wasted_bytes, 4 * 10);
+    ASSERT_EQ(table.requested_bytes, 40 * 1000 + 72 * 5000 + 200 * 300 + 300 * 10);
+    ASSERT_EQ(getRoundingWaste(histogram, table.classes), table.wasted_bytes);
+}
+
+TEST(SizeClassProfilerTest, TestFewerClassesThanSizes) {
+    const std::vector<AfSizeCount> histogram{{16, 100}, {32, 1}, {48, 100}, {64, 1}};
+    // two classes next to the max size go to the frequent 16 and 48, the one rare 32 byte request rounds up to 48
+    // and wastes the 16 bytes
+    const AfSizeClassTable three = computeSizeClasses(histogram, 3, 16, 64);
+    ASSERT_EQ(three.classes, (std::vector<std::size_t>{16, 48, 64}));
+    ASSERT_EQ(three.wasted_bytes, 16);
+
+    const AfSizeClassTable one = computeSizeClasses(histogram, 1, 16, 64);
+    ASSERT_EQ(one.classes, (std::vector<std::size_t>{64}));
+    ASSERT_EQ(one.wasted_bytes, 48 * 100 + 32 * 1 + 16 * 100);
+}
+
+TEST(SizeClassProfilerTest, TestBigRequestsAreSkipped) {
+    const std::vector<AfSizeCount> histogram{{1, 10}, {4096, 3}};
+    const AfSizeClassTable table = computeSizeClasses(histogram, 4, 16, 64);
+    ASSERT_EQ(table.skipped_requests, 3);
+    ASSERT_EQ(table.classes, (std::vector<std::size_t>{16, 64}));
+    ASSERT_EQ(table.wasted_bytes, 15 * 10);
+}
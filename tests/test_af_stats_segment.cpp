@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
+#include <memory>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+#include "AfMalloc.hpp"
+#include "AfStatsSegment.hpp"
+
+namespace {
+// AfStatsRecord is too big for the stack of a test
+std::unique_ptr<AfStatsRecord> makeRecord() {
+    return std::make_unique<AfStatsRecord>();
+}
+}
+
+TEST(StatsSegmentTest, TestReaderSeesPublishedRecord) {
+    auto writer = AfStatsSegment::create();
+    ASSERT_NE(writer, nullptr);
+    // one segment per process
+    ASSERT_EQ(AfStatsSegment::create(), nullptr);
+
+    auto reader = AfStatsSegment::open(getpid());
+    ASSERT_NE(reader, nullptr);
+    auto record = makeRecord();
+    record->publish_count = 7;
+    record->arena_count = 2;
+    record->arenas[1].allocated_size = 12345;
+    writer->publish(*record);
+
+    auto read = makeRecord();
+    ASSERT_TRUE(reader->read(*read));
+    ASSERT_EQ(read->publish_count, 7);
+    ASSERT_EQ(read->arena_count, 2);
+    ASSERT_EQ(read->arenas[1].allocated_size, 12345);
+
+    writer.reset();
+    ASSERT_EQ(AfStatsSegment::open(getpid()), nullptr);
+}
+
+TEST(StatsSegmentTest, TestReaderNeverSeesTornRecord) {
+    auto writer = AfStatsSegment::create();
+    ASSERT_NE(writer, nullptr);
+    auto reader = AfStatsSegment::open(getpid());
+    ASSERT_NE(reader, nullptr);
+
+    std::atomic<bool> stop{false};
+    std::thread publisher{[&writer, &stop]() {
+        auto record = makeRecord();
+        for(std::uint64_t value{1}; !stop.load(std::memory_order_relaxed); value++) {
+            // every publish writes the same value to the first and the last word
+            record->publish_count = value;
+            record->arenas.back().blocking_waits = value;
+            writer->publish(*record);
+        }
+    }};
+    auto read = makeRecord();
+    std::size_t reads{0};
+    for(int i{0}; i < 2000; i++) {
+        if(reader->read(*read)) {
+            ASSERT_EQ(read->publish_count, read->arenas.back().blocking_waits);
+            reads++;
+        }
+    }
+    stop = true;
+    publisher.join();
+    ASSERT_GT(reads, 0);
+}
+
+TEST(StatsSegmentTest, TestStaleSegmentIsReplaced) {
+    // a crashed process which had our pid left its segment behind
+    const std::string name = AfStatsSegment::getName(getpid());
+    const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, sizeof(AfStatsSegmentLayout)), 0);
+    void *base = mmap(nullptr, sizeof(AfStatsSegmentLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    ASSERT_NE(base, MAP_FAILED);
+    auto *layout = static_cast<AfStatsSegmentLayout *>(base);
+    layout->pid = static_cast<std::uint64_t>(getpid());
+    layout->sequence.store(41);
+
+    auto writer = AfStatsSegment::create();
+    ASSERT_NE(writer, nullptr);
+    auto record = makeRecord();
+    record->publish_count = 3;
+    writer->publish(*record);
+    auto read = makeRecord();
+    ASSERT_TRUE(AfStatsSegment::open(getpid())->read(*read));
+    ASSERT_EQ(read->publish_count, 3);
+    // the old mapping still shows the unlinked segment
+    ASSERT_EQ(layout->sequence.load(), 41);
+    munmap(base, sizeof(AfStatsSegmentLayout));
+}
+
+TEST(StatsSegmentTest, TestAllocatorPublishes) {
+    AfMalloc af_malloc{};
+    void *small = af_malloc.malloc(100);
+    void *large = af_malloc.malloc(2 * MAX_HEAP_SIZE);
+    ASSERT_TRUE(af_malloc.startStatsPublisher(std::chrono::milliseconds{1}));
+
+    auto reader = AfStatsSegment::open(getpid());
+    ASSERT_NE(reader, nullptr);
+    auto record = makeRecord();
+    for(int i{0}; i < 1000 && record->publish_count < 2; i++) {
+        ASSERT_TRUE(reader->read(*record));
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    ASSERT_GE(record->publish_count, 2);
+    ASSERT_GE(record->arena_count, 1);
+    ASSERT_GE(record->heap_maps, 1);
+    ASSERT_EQ(record->large_maps, 1);
+    ASSERT_GT(record->large_mapped_size, 2 * MAX_HEAP_SIZE);
+    std::uint64_t allocated{0};
+    for(std::size_t i{0}; i < std::min<std::size_t>(record->arena_count, AF_STATS_MAX_ARENAS); i++) {
+        allocated += record->arenas[i].allocated_size;
+    }
+    ASSERT_EQ(allocated, MAX_HEAP_SIZE);
+
+    af_malloc.stopStatsPublisher();
+    ASSERT_EQ(AfStatsSegment::open(getpid()), nullptr);
+    af_malloc.free(large);
+    af_malloc.free(small);
+}
@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/sysinfo.h>
 
 #include "AfMalloc.hpp"
 
@@ -611,6 +616,229 @@ TEST_F(BasicAfMallocSizeAllocated, TestMemAlign) {
     ASSERT_EQ(getPtrDiffSize(ptr_3, top_chunk_2), 128);
 
 }
+TEST_F(BasicAfMallocSizeAllocated, TestMemAlignUsesArenaOfThread) {
+    AfMalloc af_malloc{ArenaSelection::THREAD, 2};
+
+    // threads one after the other get the neighbouring arenas, whose heaps are not mapped yet
+    std::vector<AfArena *> arenas;
+    for(int i{0}; i < 2; ++i) {
+        std::thread{[&af_malloc, &arenas]() {
+            void *small = af_malloc.malloc(25);
+            void *ptr_1 = af_malloc.memAlign(64, 63);
+            void *ptr_2 = af_malloc.memAlign(256, 1000);
+            ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr_1) % 64, 0);
+            ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr_2) % 256, 0);
+            AfArena *arena = getHeapForChunk(ptr_1)->arena_ptr;
+            ASSERT_EQ(getHeapForChunk(ptr_2)->arena_ptr, arena);
+            ASSERT_EQ(getHeapForChunk(small)->arena_ptr, arena);
+            arenas.push_back(arena);
+            // free size follows the top, also over the space skipped for the alignment
+            ASSERT_EQ(getPtrDiffSize(moveToTheNextPlaceInMem(arena->heap_->memory_start, MAX_HEAP_SIZE), arena->top_),
+                      arena->free_size_);
+
+            af_malloc.free(ptr_2);
+            af_malloc.free(ptr_1);
+            af_malloc.free(small);
+        }}.join();
+    }
+    ASSERT_EQ(arenas.size(), 2);
+    ASSERT_NE(arenas[0], arenas[1]);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestMallocBatchCarvesFromTop) {
+    AfMalloc af_malloc{};
+
+    // first heap gets mapped by the regular path
+    void *first_ptr = af_malloc.malloc(25);
+    void *top = af_malloc.getTop();
+
+    constexpr std::size_t count = 64;
+    std::vector<void *> ptrs(count);
+    ASSERT_EQ(af_malloc.mallocBatch(25, count, ptrs.data()), count);
+
+    // chunks are carved one after the other from the old top
+    ASSERT_EQ(moveToThePreviousChunk(ptrs[0], HEAD_OF_CHUNK_SIZE), top);
+    for(std::size_t i{1}; i < count; i++) {
+        ASSERT_EQ(getPtrDiffSize(ptrs[i], ptrs[i-1]), 48);
+        ASSERT_EQ(getAlignmentSizeTest(ptrs[i], ALIGNMENT), 0);
+    }
+    ASSERT_EQ(af_malloc.getTop(), moveToTheNextPlaceInMem(top, count * 48));
+    ASSERT_EQ(MAX_HEAP_SIZE - af_malloc.getFreeSize(), (count + 1) * 48);
+
+    af_malloc.freeBatch(ptrs.data(), count);
+    af_malloc.free(first_ptr);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestMallocBatchReusesBinChunks) {
+    AfMalloc af_malloc{};
+
+    std::vector<void *> ptrs(8);
+    std::vector<void *> guards(8);
+    for(std::size_t i{0}; i < ptrs.size(); i++) {
+        ptrs[i] = af_malloc.malloc(25);
+        guards[i] = af_malloc.malloc(100);
+    }
+    for(void *ptr: ptrs) {
+        af_malloc.free(ptr);
+    }
+    // sorts freed chunks out of the unsorted list into the fast bin
+    void *sorting_ptr = af_malloc.malloc(FAST_BIN_RANGE_END + 200);
+    auto [bin, bit] = *findBinIndex(getMallocNeededSize(25));
+    ASSERT_TRUE(af_malloc.isBinBitIndexSet(bin, bit));
+
+    void *top = af_malloc.getTop();
+    std::vector<void *> batch(10);
+    ASSERT_EQ(af_malloc.mallocBatch(25, batch.size(), batch.data()), batch.size());
+
+    // first 8 come from the bin, the rest from the top
+    std::vector<void *> from_bin(batch.begin(), batch.begin() + 8);
+    std::ranges::sort(from_bin);
+    ASSERT_EQ(from_bin, ptrs);
+    ASSERT_TRUE(isPointingToSelf(af_malloc.getFastBinChunks()[bit]));
+    ASSERT_FALSE(af_malloc.isBinBitIndexSet(bin, bit));
+    ASSERT_EQ(moveToThePreviousChunk(batch[8], HEAD_OF_CHUNK_SIZE), top);
+
+    af_malloc.free(sorting_ptr);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestFreeBatchCoalescesIntoTop) {
+    AfMalloc af_malloc{};
+
+    void *first_ptr = af_malloc.malloc(25);
+    void *top = af_malloc.getTop();
+    const std::size_t free_size = af_malloc.getFreeSize();
+
+    constexpr std::size_t count = 16;
+    std::vector<void *> ptrs(count);
+    ASSERT_EQ(af_malloc.mallocBatch(FAST_BIN_RANGE_END + 10, count, ptrs.data()), count);
+
+    // the order of frees should not matter
+    std::ranges::reverse(ptrs);
+    af_malloc.freeBatch(ptrs.data(), count);
+
+    ASSERT_TRUE(isPointingToSelf(*af_malloc.getUnsortedChunks()));
+    ASSERT_EQ(af_malloc.getTop(), top);
+    ASSERT_EQ(af_malloc.getFreeSize(), free_size);
+
+    af_malloc.free(first_ptr);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestMallocBatchSpansHeaps) {
+    AfMalloc af_malloc{};
+
+    // more than what fits inside one heap
+    const std::size_t count = MAX_HEAP_SIZE / 48 + 100;
+    std::vector<void *> ptrs(count);
+    ASSERT_EQ(af_malloc.mallocBatch(25, count, ptrs.data()), count);
+    ASSERT_EQ(af_malloc.getAllocatedSize(), 2 * MAX_HEAP_SIZE);
+
+    ASSERT_EQ(getHeapForChunk(ptrs.front())->memory_start, af_malloc.getBegin());
+    ASSERT_NE(getHeapForChunk(ptrs.front()), getHeapForChunk(ptrs.back()));
+    ASSERT_EQ(getHeapForChunk(ptrs.back())->prev_heap, getHeapForChunk(ptrs.front()));
+
+    af_malloc.freeBatch(ptrs.data(), count);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestRegionFreeDoesNotCoalesce) {
+    AfMalloc af_malloc{AfMallocMode::REGION};
+
+    void *ptr_0 = af_malloc.malloc(FAST_BIN_RANGE_END + 10);
+    void *ptr_1 = af_malloc.malloc(FAST_BIN_RANGE_END + 10);
+    void *ptr_2 = af_malloc.malloc(25);
+    Chunk *chunk_0 = moveToThePreviousChunk(ptr_0, HEAD_OF_CHUNK_SIZE);
+    Chunk *chunk_1 = moveToThePreviousChunk(ptr_1, HEAD_OF_CHUNK_SIZE);
+    Chunk *chunk_2 = moveToThePreviousChunk(ptr_2, HEAD_OF_CHUNK_SIZE);
+    void *top = af_malloc.getTop();
+    // first 16 bytes of user data get the list pointers once the chunk is free
+    strcpy(static_cast<char *>(moveToTheNextPlaceInMem(ptr_1, 2 * SIZE_OF_SIZE)), "lala");
+
+    af_malloc.free(ptr_0);
+    af_malloc.free(ptr_1);
+    af_malloc.free(ptr_2);
+
+    // all three are in the unsorted list, and top has not moved
+    Chunk *unsorted_chunks = af_malloc.getUnsortedChunks();
+    ASSERT_EQ(unsorted_chunks->getNext(), chunk_2);
+    ASSERT_EQ(chunk_2->getNext(), chunk_1);
+    ASSERT_EQ(chunk_1->getNext(), chunk_0);
+    ASSERT_EQ(af_malloc.getTop(), top);
+
+    // neighbours don't know about the free chunks and memory is not scrubbed
+    ASSERT_FALSE(chunk_1->isPrevFree());
+    ASSERT_FALSE(chunk_2->isPrevFree());
+    ASSERT_EQ(chunk_0->getSize(), FAST_BIN_RANGE_END + 32);
+    ASSERT_STREQ(static_cast<char *>(moveToTheNextPlaceInMem(ptr_1, 2 * SIZE_OF_SIZE)), "lala");
+
+    // freed chunks are still reused
+    ASSERT_EQ(af_malloc.malloc(25), ptr_2);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestRegionReset) {
+    AfMalloc af_malloc{AfMallocMode::REGION};
+
+    const std::size_t count = MAX_HEAP_SIZE / 48 + 100;
+    std::vector<void *> ptrs(count);
+    ASSERT_EQ(af_malloc.mallocBatch(25, count, ptrs.data()), count);
+    af_malloc.free(ptrs[0]);
+    af_malloc.free(ptrs[1]);
+    void *sorting_ptr = af_malloc.malloc(FAST_BIN_RANGE_END + 200);
+    ASSERT_EQ(af_malloc.getAllocatedSize(), 2 * MAX_HEAP_SIZE);
+
+    af_malloc.reset(true);
+
+    ASSERT_EQ(af_malloc.getAllocatedSize(), MAX_HEAP_SIZE);
+    ASSERT_EQ(af_malloc.getFreeSize(), MAX_HEAP_SIZE);
+    ASSERT_EQ(af_malloc.getTop(), af_malloc.getBegin());
+    ASSERT_TRUE(isPointingToSelf(*af_malloc.getUnsortedChunks()));
+    auto [bin, bit] = *findBinIndex(getMallocNeededSize(25));
+    ASSERT_FALSE(af_malloc.isBinBitIndexSet(bin, bit));
+    ASSERT_TRUE(isPointingToSelf(af_malloc.getFastBinChunks()[bit]));
+
+    // we start again from the beginning of the first heap
+    void *ptr = af_malloc.malloc(25);
+    ASSERT_EQ(moveToThePreviousChunk(ptr, HEAD_OF_CHUNK_SIZE), af_malloc.getBegin());
+    (void)sorting_ptr;
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestRegionResetUnmapsLargeAllocations) {
+    AfMalloc af_malloc{AfMallocMode::REGION};
+
+    void *large = af_malloc.malloc(2 * MAX_HEAP_SIZE);
+    std::vector<void *> ptrs(3);
+    ASSERT_EQ(af_malloc.mallocBatch(MAX_HEAP_SIZE, ptrs.size(), ptrs.data()), ptrs.size());
+    ASSERT_NE(large, nullptr);
+    ASSERT_EQ(af_malloc.getStatsRecord().large_maps, 4);
+
+    // a large allocation freed before the reset is unmapped right away and not a second time on reset
+    af_malloc.free(ptrs[1]);
+    ASSERT_EQ(af_malloc.getStatsRecord().large_unmaps, 1);
+
+    af_malloc.reset();
+    const AfStatsRecord record = af_malloc.getStatsRecord();
+    ASSERT_EQ(record.large_unmaps, 4);
+    ASSERT_EQ(record.large_mapped_size, 0);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestBinRangeEndsBelongToNextRange) {
+    // as in findBinIndex, chunks of exactly the end of the fast or small range are in the next range
+    for(const std::size_t needed_size: {FAST_BIN_RANGE_END, SMALL_BIN_RANGE_END}) {
+        AfMalloc af_malloc{};
+        const std::size_t size = needed_size - SIZE_OF_SIZE;
+        ASSERT_EQ(getMallocNeededSize(size), needed_size);
+        void *ptr = af_malloc.malloc(size);
+        void *fence = af_malloc.malloc(25);
+        af_malloc.free(ptr);
+        // bigger request moves the freed chunk from the unsorted list to its bin
+        void *sorting_ptr = af_malloc.malloc(SMALL_BIN_RANGE_END + 200);
+        ASSERT_TRUE(isPointingToSelf(*af_malloc.getUnsortedChunks()));
+
+        ASSERT_EQ(af_malloc.malloc(size), ptr);
+        af_malloc.free(sorting_ptr);
+        af_malloc.free(fence);
+        af_malloc.free(ptr);
+    }
+}
+
 TEST_F(BasicAfMallocSizeAllocated, TestMoveFromFreeChunks) {
 
 }
@@ -620,6 +848,595 @@ TEST_F(BasicAfMallocSizeAllocated, DoubleFree) {
     // This should be possible to detect?
 }
 
+TEST_F(BasicAfMallocSizeAllocated, TestThreadAffineArenas) {
+    AfMalloc af_malloc{ArenaSelection::THREAD, 2};
+    ASSERT_EQ(af_malloc.getArenaCount(), 2);
+
+    // two threads one after the other get the neighbouring arenas
+    void *first_ptr{nullptr};
+    void *second_ptr{nullptr};
+    std::thread{[&af_malloc, &first_ptr]() { first_ptr = af_malloc.malloc(25); }}.join();
+    std::thread{[&af_malloc, &second_ptr]() { second_ptr = af_malloc.malloc(25); }}.join();
+
+    ASSERT_NE(getHeapForChunk(first_ptr), getHeapForChunk(second_ptr));
+    ASSERT_NE(getHeapForChunk(first_ptr)->arena_ptr, getHeapForChunk(second_ptr)->arena_ptr);
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 2 * MAX_HEAP_SIZE);
+
+    // chunks go back to the arena they came from, whichever thread frees them
+    af_malloc.free(first_ptr);
+    af_malloc.free(second_ptr);
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 2 * MAX_HEAP_SIZE);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestPerCpuArenas) {
+    AfMalloc af_malloc{ArenaSelection::CPU};
+    ASSERT_EQ(af_malloc.getArenaCount(), get_nprocs_conf());
+    ASSERT_LT(getCurrentCpu(), af_malloc.getArenaCount());
+
+    std::vector<std::thread> threads;
+    for(std::size_t i{0}; i < 16; i++) {
+        threads.emplace_back([&af_malloc]() {
+            std::vector<void *> ptrs(100);
+            for(auto &ptr: ptrs) {
+                ptr = af_malloc.malloc(100);
+                ASSERT_NE(ptr, nullptr);
+            }
+            af_malloc.freeBatch(ptrs.data(), ptrs.size());
+        });
+    }
+    std::ranges::for_each(threads, [](std::thread &thread) { thread.join(); });
+
+    // no more heaps than there are CPUs
+    ASSERT_LE(af_malloc.getTotalAllocatedSize(), af_malloc.getArenaCount() * MAX_HEAP_SIZE);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestFifoUnsortedOrder) {
+    BasicAfMalloc<SingleThreaded, FIFO, NoScrub> af_malloc{};
+    ASSERT_EQ(af_malloc.getArenaCount(), 1);
+
+    // guards keep freed chunks from coalescing with each other or with the top
+    void *first_ptr = af_malloc.malloc(200);
+    void *first_guard = af_malloc.malloc(200);
+    void *second_ptr = af_malloc.malloc(200);
+    void *second_guard = af_malloc.malloc(200);
+    strcpy(static_cast<char *>(first_ptr) + 16, "first");
+
+    af_malloc.free(first_ptr);
+    af_malloc.free(second_ptr);
+
+    // the chunk freed first is reused first, and its data is not scrubbed
+    void *reused_ptr = af_malloc.malloc(200);
+    ASSERT_EQ(reused_ptr, first_ptr);
+    ASSERT_STREQ(static_cast<char *>(reused_ptr) + 16, "first");
+    ASSERT_EQ(af_malloc.malloc(200), second_ptr);
+
+    af_malloc.free(first_guard);
+    af_malloc.free(second_guard);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestLifoUnsortedOrder) {
+    AfMalloc af_malloc{};
+
+    void *first_ptr = af_malloc.malloc(200);
+    void *first_guard = af_malloc.malloc(200);
+    void *second_ptr = af_malloc.malloc(200);
+    void *second_guard = af_malloc.malloc(200);
+    strcpy(static_cast<char *>(second_ptr) + 16, "second");
+
+    af_malloc.free(first_ptr);
+    af_malloc.free(second_ptr);
+
+    // the most recently freed chunk is reused first, and its data is zeroed
+    void *reused_ptr = af_malloc.malloc(200);
+    ASSERT_EQ(reused_ptr, second_ptr);
+    ASSERT_EQ(static_cast<char *>(reused_ptr)[16], 0);
+
+    af_malloc.free(first_guard);
+    af_malloc.free(second_guard);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestPerThreadArenas) {
+    BasicAfMalloc<PerThread, LIFO, ZeroScrub, LazyMmapPageSource> af_malloc{};
+    void *main_ptr = af_malloc.malloc(25);
+    ASSERT_EQ(af_malloc.getArenaCount(), 1);
+
+    std::vector<void *> thread_ptrs(4);
+    std::vector<std::thread> threads;
+    for(auto &thread_ptr: thread_ptrs) {
+        threads.emplace_back([&af_malloc, &thread_ptr]() {
+            thread_ptr = af_malloc.malloc(25);
+            // the same thread keeps its arena
+            void *ptr = af_malloc.malloc(25);
+            ASSERT_EQ(getHeapForChunk(ptr)->arena_ptr, getHeapForChunk(thread_ptr)->arena_ptr);
+            af_malloc.free(ptr);
+        });
+    }
+    std::ranges::for_each(threads, [](std::thread &thread) { thread.join(); });
+
+    ASSERT_EQ(af_malloc.getArenaCount(), thread_ptrs.size() + 1);
+    for(void *thread_ptr: thread_ptrs) {
+        ASSERT_NE(getHeapForChunk(thread_ptr)->arena_ptr, getHeapForChunk(main_ptr)->arena_ptr);
+        af_malloc.free(thread_ptr);
+    }
+    af_malloc.free(main_ptr);
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), (thread_ptrs.size() + 1) * MAX_HEAP_SIZE);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestLockedArenaIsSkipped) {
+    AfMalloc af_malloc{ArenaSelection::THREAD, 2};
+    void *first_ptr = af_malloc.malloc(25);
+    AfArena *own_arena = getHeapForChunk(first_ptr)->arena_ptr;
+    ASSERT_EQ(af_malloc.getLockStats().try_lock_failures, 0);
+
+    // some other thread holds our arena, so malloc goes to the next one instead of waiting
+    own_arena->arena_lock.lock();
+    void *second_ptr = af_malloc.malloc(25);
+    ASSERT_NE(getHeapForChunk(second_ptr)->arena_ptr, own_arena);
+
+    auto stats = af_malloc.getLockStats();
+    ASSERT_EQ(stats.try_lock_failures, 1);
+    ASSERT_EQ(stats.arena_switches, 1);
+    ASSERT_EQ(stats.blocking_waits, 0);
+    ASSERT_EQ(stats.acquisitions, 2);
+
+    // free has to go to the arena of the chunk, so it waits
+    std::thread free_thread{[&af_malloc, first_ptr]() { af_malloc.free(first_ptr); }};
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    own_arena->arena_lock.unlock();
+    free_thread.join();
+
+    stats = af_malloc.getLockStats();
+    ASSERT_EQ(stats.try_lock_failures, 2);
+    ASSERT_EQ(stats.blocking_waits, 1);
+    ASSERT_GE(stats.wait_ns, 10'000'000);
+    af_malloc.free(second_ptr);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestFreeBatchHoldsOneArenaLock) {
+    AfMalloc af_malloc{ArenaSelection::THREAD, 2};
+
+    // threads one after the other alternate between the two arenas, and every second chunk needs a new heap,
+    // so heaps of the arenas are created in turns and interleave in the address space
+    std::vector<void *> ptrs(4);
+    for(auto &ptr: ptrs) {
+        std::thread{[&af_malloc, &ptr]() { ptr = af_malloc.malloc(70'000); }}.join();
+    }
+    std::sort(ptrs.begin(), ptrs.end());
+    AfArena *first_arena = getHeapForChunk(ptrs.front())->arena_ptr;
+    auto other = std::ranges::find_if(ptrs, [first_arena](void *ptr) { return getHeapForChunk(ptr)->arena_ptr != first_arena; });
+    ASSERT_NE(other, ptrs.end());
+    AfArena *other_arena = getHeapForChunk(*other)->arena_ptr;
+
+    // the batch waits for the other arena, which must not keep the first one locked in the meantime,
+    // or a thread freeing a batch in the opposite order deadlocks with it
+    other_arena->arena_lock.lock();
+    const std::size_t try_lock_failures = af_malloc.getLockStats().try_lock_failures;
+    std::thread free_thread{[&af_malloc, &ptrs]() { af_malloc.freeBatch(ptrs.data(), ptrs.size()); }};
+    // the failed try_lock is counted right before the wait starts
+    while(af_malloc.getLockStats().try_lock_failures == try_lock_failures) {
+        std::this_thread::yield();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const bool first_arena_free = first_arena->arena_lock.try_lock();
+    if(first_arena_free) {
+        first_arena->arena_lock.unlock();
+    }
+    other_arena->arena_lock.unlock();
+    free_thread.join();
+    ASSERT_TRUE(first_arena_free);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestSlabTinyAllocations) {
+    BasicAfMalloc<ArenaLocked, LIFO, ZeroScrub, MmapPageSource, Slabs> af_malloc{ArenaSelection::THREAD, 1};
+
+    // no header and no minimum chunk size, objects of the same class are next to each other
+    auto *first_ptr = static_cast<char *>(af_malloc.malloc(8));
+    auto *second_ptr = static_cast<char *>(af_malloc.malloc(8));
+    ASSERT_EQ(second_ptr - first_ptr, 8);
+    auto *first_node = static_cast<char *>(af_malloc.malloc(16));
+    auto *second_node = static_cast<char *>(af_malloc.malloc(16));
+    ASSERT_EQ(second_node - first_node, 16);
+    ASSERT_EQ(getAlignmentSize(first_node, ALIGNMENT), 0);
+
+    // every class has its own page, found by masking the address
+    AfSlabPage *page = getSlabPage(first_ptr);
+    ASSERT_EQ(page, getSlabPage(second_ptr));
+    ASSERT_NE(page, getSlabPage(first_node));
+    ASSERT_EQ(page->object_size, 8);
+    ASSERT_EQ(page->used, 2);
+    ASSERT_TRUE(getHeapForChunk(first_ptr)->is_slab_heap);
+
+    // bigger sizes are still chunks
+    void *chunk_ptr = af_malloc.malloc(65);
+    ASSERT_FALSE(getHeapForChunk(chunk_ptr)->is_slab_heap);
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 2 * MAX_HEAP_SIZE);
+
+    // freed object is reused first, and it comes back zeroed
+    strcpy(first_node, "node");
+    af_malloc.free(first_node);
+    auto *reused_node = static_cast<char *>(af_malloc.malloc(12));
+    ASSERT_EQ(reused_node, first_node);
+    ASSERT_EQ(std::count(reused_node, reused_node + 16, 0), 16);
+
+    af_malloc.free(first_ptr);
+    af_malloc.free(second_ptr);
+    ASSERT_EQ(page->used, 0);
+    af_malloc.free(reused_node);
+    af_malloc.free(second_node);
+    af_malloc.free(chunk_ptr);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestSlabPagesFillAndEmpty) {
+    BasicAfMalloc<ArenaLocked, LIFO, ZeroScrub, MmapPageSource, Slabs> af_malloc{ArenaSelection::THREAD, 1};
+    constexpr std::size_t objects_per_page = (SLAB_PAGE_SIZE - SLAB_PAGE_HEADER_SIZE) / 64;
+
+    std::vector<void *> ptrs(3 * objects_per_page);
+    ASSERT_EQ(af_malloc.mallocBatch(64, ptrs.size(), ptrs.data()), ptrs.size());
+    ASSERT_EQ(getSlabPage(ptrs[0])->capacity, objects_per_page);
+    ASSERT_EQ(getSlabPage(ptrs[0]), getSlabPage(ptrs[objects_per_page - 1]));
+    ASSERT_NE(getSlabPage(ptrs[0]), getSlabPage(ptrs[objects_per_page]));
+
+    // empty pages are taken by other size classes
+    af_malloc.freeBatch(ptrs.data(), ptrs.size());
+    void *small_ptr = af_malloc.malloc(32);
+    ASSERT_EQ(getSlabPage(small_ptr)->object_size, 32);
+    ASSERT_LT(reinterpret_cast<uintptr_t>(small_ptr), reinterpret_cast<uintptr_t>(ptrs.back()));
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), MAX_HEAP_SIZE);
+
+    // more pages than a heap holds
+    std::vector<void *> many_ptrs(MAX_HEAP_SIZE / SLAB_PAGE_SIZE * objects_per_page + 1);
+    ASSERT_EQ(af_malloc.mallocBatch(64, many_ptrs.size(), many_ptrs.data()), many_ptrs.size());
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 2 * MAX_HEAP_SIZE);
+    af_malloc.freeBatch(many_ptrs.data(), many_ptrs.size());
+    af_malloc.free(small_ptr);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestUnsortedSortLimit) {
+    AfMalloc af_malloc{};
+    af_malloc.setUnsortedSortLimit(3);
+
+    // guards keep the freed chunks apart, so all of them stay in the unsorted list
+    std::vector<void *> ptrs(10);
+    std::vector<void *> guards(10);
+    for(std::size_t i{0}; i < ptrs.size(); i++) {
+        ptrs[i] = af_malloc.malloc(200);
+        guards[i] = af_malloc.malloc(200);
+    }
+    std::ranges::for_each(ptrs, [&af_malloc](void *ptr) { af_malloc.free(ptr); });
+
+    auto count_unsorted = [&af_malloc]() {
+        std::size_t count{0};
+        for(Chunk *chunk = af_malloc.getUnsortedChunks()->getNext(); chunk != af_malloc.getUnsortedChunks(); chunk = chunk->getNext()) {
+            count++;
+        }
+        return count;
+    };
+
+    // none of them fits, only 3 are sorted into the bins
+    void *big_ptr = af_malloc.malloc(400);
+    ASSERT_EQ(count_unsorted(), 7);
+    ASSERT_EQ(af_malloc.getUnsortedStats().max_walk, 3);
+    ASSERT_EQ(af_malloc.getUnsortedStats().capped_walks, 1);
+
+    af_malloc.setUnsortedSortLimit(0);
+    void *second_big_ptr = af_malloc.malloc(400);
+    ASSERT_EQ(count_unsorted(), 0);
+    ASSERT_EQ(af_malloc.getUnsortedStats().max_walk, 7);
+    ASSERT_EQ(af_malloc.getUnsortedStats().capped_walks, 1);
+
+    af_malloc.free(big_ptr);
+    af_malloc.free(second_big_ptr);
+    std::ranges::for_each(guards, [&af_malloc](void *ptr) { af_malloc.free(ptr); });
+}
+
+static bool isPageResident(void *ptr) {
+    unsigned char resident{0};
+    mincore(ptr, OS_PAGE_SIZE, &resident);
+    return (resident & 1) != 0;
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestPurgeReleasesPagesAfterTop) {
+    AfMalloc af_malloc{};
+    af_malloc.setDecayTime(std::chrono::milliseconds{10'000});
+
+    void *ptr = af_malloc.malloc(200);
+    auto *big_ptr = static_cast<char *>(af_malloc.malloc(64 * 1024));
+    memset(big_ptr, 1, 64 * 1024);
+    af_malloc.free(big_ptr);
+    ASSERT_EQ(af_malloc.getTop(), moveToThePreviousChunk(big_ptr, HEAD_OF_CHUNK_SIZE));
+
+    // pages became free just now, they are younger than the decay time
+    ASSERT_EQ(af_malloc.purge(), 0);
+    void *first_free_page = big_ptr + getAlignmentSize(big_ptr, OS_PAGE_SIZE);
+    ASSERT_TRUE(isPageResident(first_free_page));
+
+    af_malloc.setDecayTime(std::chrono::milliseconds{0});
+    const auto heap_end = reinterpret_cast<uintptr_t>(af_malloc.getBegin()) + MAX_HEAP_SIZE;
+    ASSERT_EQ(af_malloc.purge(), heap_end - reinterpret_cast<uintptr_t>(first_free_page));
+    ASSERT_FALSE(isPageResident(first_free_page));
+    // released pages are not released again
+    ASSERT_EQ(af_malloc.purge(), 0);
+
+    // memory is usable again, and zeroed
+    auto *new_big_ptr = static_cast<char *>(af_malloc.malloc(64 * 1024));
+    ASSERT_EQ(new_big_ptr, big_ptr);
+    ASSERT_EQ(std::count(new_big_ptr, new_big_ptr + 64 * 1024, 0), 64 * 1024);
+    af_malloc.free(new_big_ptr);
+
+    // nothing is allocated any more, so the arena is trimmed
+    af_malloc.free(ptr);
+    ASSERT_EQ(af_malloc.purge(), HEAP_HEADER_SIZE + MAX_HEAP_SIZE);
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 0);
+
+    void *ptr_after_trim = af_malloc.malloc(200);
+    ASSERT_NE(ptr_after_trim, nullptr);
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), MAX_HEAP_SIZE);
+    af_malloc.free(ptr_after_trim);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestMemAlignAfterArenaIsTrimmed) {
+    AfMalloc af_malloc{};
+    af_malloc.setDecayTime(std::chrono::milliseconds{0});
+    af_malloc.free(af_malloc.malloc(200));
+    ASSERT_EQ(af_malloc.purge(), HEAP_HEADER_SIZE + MAX_HEAP_SIZE);
+    ASSERT_EQ(af_malloc.getTop(), nullptr);
+
+    // arena has no heap any more, memAlign maps one as malloc would
+    void *ptr = af_malloc.memAlign(64, 63);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % 64, 0);
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), MAX_HEAP_SIZE);
+    af_malloc.free(ptr);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestPurgerThread) {
+    AfMalloc af_malloc{};
+    af_malloc.free(af_malloc.malloc(200));
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), MAX_HEAP_SIZE);
+
+    af_malloc.startPurger(std::chrono::milliseconds{1});
+    for(int i{0}; i < 1000 && af_malloc.getTotalAllocatedSize() != 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    af_malloc.stopPurger();
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 0);
+    // stopping twice is fine
+    af_malloc.stopPurger();
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestParseOptions) {
+    AfMallocOptions options{};
+    ASSERT_TRUE(parseAfMallocOptions("arena_count:4,mmap_threshold:64k,trim_threshold:1m,unsorted_limit:32,"
+                                     "decay_ms:1000,heap_colours:8,scrub:0,stats:0", options));
+    ASSERT_EQ(options.arena_count, 4);
+    ASSERT_EQ(options.mmap_threshold, 64 * 1024);
+    ASSERT_EQ(options.trim_threshold, 1024 * 1024);
+    ASSERT_EQ(options.unsorted_sort_limit, 32);
+    ASSERT_EQ(options.decay_time, std::chrono::milliseconds{1000});
+    ASSERT_EQ(options.heap_colours, 8);
+    ASSERT_FALSE(options.scrub);
+    ASSERT_FALSE(options.stats);
+
+    // invalid string leaves the options as they were
+    AfMallocOptions unchanged{};
+    ASSERT_FALSE(parseAfMallocOptions("arena_count:2,unknown:1", unchanged));
+    ASSERT_FALSE(parseAfMallocOptions("arena_count:2x", unchanged));
+    ASSERT_FALSE(parseAfMallocOptions("arena_count", unchanged));
+    ASSERT_FALSE(parseAfMallocOptions("scrub:2", unchanged));
+    ASSERT_FALSE(parseAfMallocOptions("mmap_threshold:1m", unchanged));
+    ASSERT_FALSE(parseAfMallocOptions("heap_colours:65", unchanged));
+    // there are no per-thread caches to size
+    ASSERT_FALSE(parseAfMallocOptions("tcache_count:16", unchanged));
+    ASSERT_EQ(unchanged.arena_count, 0);
+    ASSERT_TRUE(parseAfMallocOptions("", unchanged));
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestMalloptAppliesToNewAllocators) {
+    const AfMallocOptions defaults = getAfMallocOptions();
+    ASSERT_TRUE(afMallopt(AfMallocParam::ARENA_COUNT, 3));
+    ASSERT_TRUE(afMallopt(AfMallocParam::MMAP_THRESHOLD, 4096));
+    ASSERT_FALSE(afMallopt(AfMallocParam::STATS, 5));
+    ASSERT_TRUE(afMallopt(AfMallocParam::SCRUB, 0));
+    {
+        AfMalloc af_malloc{};
+        ASSERT_EQ(af_malloc.getArenaCount(), 3);
+
+        // above the threshold chunk gets its own mapping, which goes away on free
+        auto *large_ptr = static_cast<char *>(af_malloc.malloc(200 * 1024));
+        AfHeap *large_heap = getHeapForChunk(large_ptr);
+        ASSERT_EQ(large_heap->mmapped_size, HEAP_HEADER_SIZE + 204 * 1024);
+        ASSERT_EQ(af_malloc.getTotalAllocatedSize(), large_heap->mmapped_size);
+        memset(large_ptr, 1, 200 * 1024);
+        af_malloc.free(large_ptr);
+        ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 0);
+
+        // without scrubbing freed data stays
+        void *ptr = af_malloc.malloc(200);
+        void *guard = af_malloc.malloc(200);
+        strcpy(static_cast<char *>(ptr) + 16, "data");
+        af_malloc.free(ptr);
+        void *reused_ptr = af_malloc.malloc(200);
+        ASSERT_EQ(reused_ptr, ptr);
+        ASSERT_STREQ(static_cast<char *>(reused_ptr) + 16, "data");
+        af_malloc.free(reused_ptr);
+        af_malloc.free(guard);
+    }
+    afMallopt(AfMallocParam::ARENA_COUNT, defaults.arena_count);
+    afMallopt(AfMallocParam::MMAP_THRESHOLD, defaults.mmap_threshold);
+    afMallopt(AfMallocParam::SCRUB, defaults.scrub);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestLifetimeHeapsAreSegregated) {
+    AfMalloc af_malloc{};
+    void *short_ptr = af_malloc.malloc(200);
+    void *long_ptr = af_malloc.malloc(200, AfLifetime::LONG);
+    void *permanent_ptr{nullptr};
+    {
+        AfLifetimeScope scope{AfLifetime::PERMANENT};
+        permanent_ptr = af_malloc.malloc(200);
+    }
+    void *after_scope_ptr = af_malloc.malloc(200);
+
+    AfHeap *short_heap = getHeapForChunk(short_ptr);
+    AfHeap *long_heap = getHeapForChunk(long_ptr);
+    AfHeap *permanent_heap = getHeapForChunk(permanent_ptr);
+    ASSERT_NE(short_heap, long_heap);
+    ASSERT_NE(short_heap, permanent_heap);
+    ASSERT_NE(long_heap, permanent_heap);
+    ASSERT_EQ(getHeapForChunk(after_scope_ptr), short_heap);
+    ASSERT_EQ(short_heap->arena_ptr, &getLifetimeArena(*short_heap->arena_ptr, AfLifetime::SHORT));
+    ASSERT_EQ(long_heap->arena_ptr, &getLifetimeArena(*short_heap->arena_ptr, AfLifetime::LONG));
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 3 * MAX_HEAP_SIZE);
+
+    // the long lived chunk is not in the way, so the short ones go back to the top
+    af_malloc.free(short_ptr);
+    af_malloc.free(after_scope_ptr);
+    ASSERT_EQ(af_malloc.getTop(), short_heap->memory_start);
+
+    af_malloc.free(long_ptr);
+    af_malloc.free(permanent_ptr);
+    ASSERT_EQ(af_malloc.purge(), 0);
+    af_malloc.setDecayTime(std::chrono::milliseconds{0});
+    af_malloc.purge();
+    ASSERT_EQ(af_malloc.getTotalAllocatedSize(), 0);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestHeapsAreColoured) {
+    const AfMallocOptions defaults = getAfMallocOptions();
+    {
+        AfMalloc af_malloc{};
+        // every chunk takes more than half of the heap, so each one starts a heap
+        std::array<void *, 4> ptrs{};
+        for(std::size_t i{0}; i < ptrs.size(); i++) {
+            ptrs[i] = af_malloc.malloc(MAX_HEAP_SIZE / 2 + 1024);
+            AfHeap *heap = getHeapForChunk(ptrs[i]);
+            ASSERT_EQ(heap->colour_offset, i * CACHE_LINE_SIZE);
+            ASSERT_EQ(moveToThePreviousPlaceInMem(ptrs[i], HEAD_OF_CHUNK_SIZE), getFirstChunk(heap));
+        }
+        // chunk of the whole heap gets no offset
+        void *whole_heap_ptr = af_malloc.malloc(MAX_HEAP_SIZE - 2 * HEAD_OF_CHUNK_SIZE);
+        ASSERT_EQ(getHeapForChunk(whole_heap_ptr)->colour_offset, 0);
+        af_malloc.free(whole_heap_ptr);
+        std::ranges::for_each(ptrs, [&af_malloc](void *ptr) { af_malloc.free(ptr); });
+    }
+
+    ASSERT_TRUE(afMallopt(AfMallocParam::HEAP_COLOURS, 1));
+    {
+        AfMalloc af_malloc{};
+        void *first = af_malloc.malloc(MAX_HEAP_SIZE / 2 + 1024);
+        void *second = af_malloc.malloc(MAX_HEAP_SIZE / 2 + 1024);
+        ASSERT_EQ(getHeapForChunk(second)->colour_offset, 0);
+        af_malloc.free(second);
+        af_malloc.free(first);
+    }
+    afMallopt(AfMallocParam::HEAP_COLOURS, defaults.heap_colours);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestDeferredFreeWaitsForDrain) {
+    AfMalloc af_malloc{};
+    std::vector<void *> ptrs(100);
+    for(auto &ptr: ptrs) {
+        ptr = af_malloc.malloc(200);
+    }
+    void *begin = af_malloc.getBegin();
+    for(void *ptr: ptrs) {
+        af_malloc.freeDeferred(ptr);
+    }
+    // nothing is freed until the drain
+    ASSERT_NE(af_malloc.getTop(), begin);
+    ASSERT_EQ(af_malloc.drainDeferredFrees(), ptrs.size());
+    ASSERT_EQ(af_malloc.getTop(), begin);
+    ASSERT_EQ(af_malloc.drainDeferredFrees(), 0);
+
+    // full buffer frees right away
+    std::vector<void *> overflowing(DEFERRED_FREE_BUFFER_SIZE + 1);
+    for(auto &ptr: overflowing) {
+        ptr = af_malloc.malloc(16);
+    }
+    for(void *ptr: overflowing) {
+        af_malloc.freeDeferred(ptr);
+    }
+    ASSERT_EQ(af_malloc.getDeferredFreeOverflows(), 1);
+    ASSERT_EQ(af_malloc.drainDeferredFrees(), DEFERRED_FREE_BUFFER_SIZE);
+}
+
+TEST_F(BasicAfMallocSizeAllocated, TestDeferredFreeDrainerThread) {
+    AfMalloc af_malloc{};
+    void *first = af_malloc.malloc(200);
+    void *last = af_malloc.malloc(200);
+    af_malloc.startDeferredFreeDrainer(std::chrono::microseconds{100});
+    std::thread{[&af_malloc, last]() { af_malloc.freeDeferred(last); }}.join();
+
+    // until the drainer frees last, its place is not handed out again
+    bool reused{false};
+    for(int i{0}; i < 1000 && !reused; i++) {
+        void *ptr = af_malloc.malloc(200);
+        reused = ptr == last;
+        if(!reused) {
+            af_malloc.free(ptr);
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+    }
+    af_malloc.stopDeferredFreeDrainer();
+    ASSERT_TRUE(reused);
+    af_malloc.free(last);
+    af_malloc.free(first);
+}
+
+struct HookCounts {
+  std::size_t allocs{0};
+  std::size_t alloc_bytes{0};
+  std::size_t frees{0};
+  std::size_t reallocs{0};
+  AfMalloc *nested_malloc{nullptr};
+};
+
+TEST_F(BasicAfMallocSizeAllocated, TestHooksObserveAllocations) {
+    AfMalloc af_malloc{};
+    HookCounts counts{};
+    AfMallocHooks hooks{};
+    hooks.context = &counts;
+    hooks.on_alloc = [](void *context, void *, const std::size_t size) {
+        auto *hook_counts = static_cast<HookCounts *>(context);
+        hook_counts->allocs++;
+        hook_counts->alloc_bytes += size;
+        // allocations of the hook itself are not reported
+        hook_counts->nested_malloc->free(hook_counts->nested_malloc->malloc(32));
+    };
+    hooks.on_free = [](void *context, void *) { static_cast<HookCounts *>(context)->frees++; };
+    hooks.on_realloc = [](void *context, void *, void *, std::size_t) { static_cast<HookCounts *>(context)->reallocs++; };
+    counts.nested_malloc = &af_malloc;
+    setAfMallocHooks(hooks);
+
+    void *ptr = af_malloc.malloc(100);
+    std::array<void *, 4> batch{};
+    ASSERT_EQ(af_malloc.mallocBatch(48, batch.size(), batch.data()), batch.size());
+    ASSERT_EQ(counts.allocs, 5);
+    ASSERT_EQ(counts.alloc_bytes, 100 + 4 * 48);
+
+    std::memset(ptr, 0xab, 100);
+    void *same = af_malloc.realloc(ptr, af_malloc.getUsableSize(ptr));
+    ASSERT_EQ(same, ptr);
+    void *moved = af_malloc.realloc(ptr, 1000);
+    ASSERT_NE(moved, ptr);
+    ASSERT_EQ(static_cast<unsigned char *>(moved)[99], 0xab);
+    // realloc is reported only as itself, not as the malloc and the free it did
+    ASSERT_EQ(counts.reallocs, 2);
+    ASSERT_EQ(counts.allocs, 5);
+    ASSERT_EQ(counts.frees, 0);
+
+    af_malloc.freeBatch(batch.data(), batch.size());
+    af_malloc.freeDeferred(moved);
+    ASSERT_EQ(counts.frees, 5);
+    af_malloc.drainDeferredFrees();
+    ASSERT_EQ(counts.frees, 5);
+
+    clearAfMallocHooks();
+    af_malloc.free(af_malloc.malloc(100));
+    ASSERT_EQ(counts.allocs, 5);
+    ASSERT_EQ(counts.frees, 5);
+}
+
 // how to synchronize multiple threads allocating at the same time?
 TEST_F(BasicAfMallocSizeAllocated, MultipleThreadsAllocating) {
 
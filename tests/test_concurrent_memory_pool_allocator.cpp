@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "concurrent_memory_pool_allocator.hpp"
+#include "page_size_allocator.hpp"
+
+
+TEST(ConcurrentMemoryPoolAllocatorTest, TestAllocateAndFreeStayThreadLocal){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::ConcurrentMemoryPoolAllocator pool{page_size_allocator};
+
+    // the first allocation fills a magazine from the pool
+    void *ptr = pool.allocate(8, 64);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(pool.getNumDepotExchanges(), 1);
+    ASSERT_EQ(pool.getPool().getNumUsedBlocks(), memory::DEFAULT_MAGAZINE_SIZE);
+
+    for(int i{0}; i < 10'000; ++i) {
+        pool.deallocate(ptr, 8, 64);
+        ptr = pool.allocate(8, 64);
+    }
+    // the last freed block comes back, and the depot was never needed
+    ASSERT_EQ(pool.getNumDepotExchanges(), 1);
+
+    // a batch which fits into the two magazines is thread local too
+    std::vector<void *> ptrs{ptr};
+    for(std::size_t i{1}; i < 2 * memory::DEFAULT_MAGAZINE_SIZE; ++i) {
+        ptrs.emplace_back(pool.allocate(8, 64));
+    }
+    const std::size_t exchanges = pool.getNumDepotExchanges();
+    for(int round{0}; round < 100; ++round) {
+        for(void *block: ptrs) {
+            pool.deallocate(block, 8, 64);
+        }
+        for(void *&block: ptrs) {
+            block = pool.allocate(8, 64);
+        }
+    }
+    ASSERT_EQ(pool.getNumDepotExchanges(), exchanges);
+    for(void *block: ptrs) {
+        pool.deallocate(block, 8, 64);
+    }
+    ASSERT_EQ(pool.allocate(1, memory::BLOCK_SIZE + 1), nullptr);
+}
+
+TEST(ConcurrentMemoryPoolAllocatorTest, TestDeallocateChecksSizeClass){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::ConcurrentMemoryPoolAllocator pool{page_size_allocator};
+
+    void *ptr = pool.allocate(8, 64);
+    ASSERT_TRUE(pool.ownsBlockOfClass(ptr, pool.getPool().findSizeClass(8, 64)));
+    ASSERT_FALSE(pool.ownsBlockOfClass(ptr, pool.getPool().findSizeClass(8, 16)));
+    // size of some other class would put the block into the magazine of that class
+    EXPECT_DEBUG_DEATH(pool.deallocate(ptr, 8, 16), "ownsBlockOfClass");
+    pool.deallocate(ptr, 8, 64);
+}
+
+TEST(ConcurrentMemoryPoolAllocatorTest, TestDepotHandsMagazinesToOtherThreads){
+    memory::PageSizeAllocator page_size_allocator{};
+    constexpr std::size_t magazine_size = 4;
+    memory::ConcurrentMemoryPoolAllocator pool{page_size_allocator, memory::DEFAULT_SIZE_CLASSES, magazine_size};
+
+    // the allocating thread's magazines hold 2 of the 6 magazines of blocks, the depot the other 4
+    std::vector<void *> ptrs;
+    for(std::size_t i{0}; i < 6 * magazine_size; ++i) {
+        ptrs.emplace_back(pool.allocate(16, 16));
+    }
+    std::thread{[&] {
+        for(void *ptr: ptrs) {
+            pool.deallocate(ptr, 16, 16);
+        }
+    }}.join();
+    const std::size_t pages = page_size_allocator.getPagesAllocated();
+
+    // another thread gets the full magazines from the depot, not new blocks of the pool
+    std::thread{[&] {
+        for(void *&ptr: ptrs) {
+            ptr = pool.allocate(16, 16);
+        }
+        ASSERT_EQ(pool.getPool().getNumUsedBlocks(), 6 * magazine_size);
+        for(void *ptr: ptrs) {
+            pool.deallocate(ptr, 16, 16);
+        }
+        pool.flushThreadCache();
+    }}.join();
+    ASSERT_EQ(page_size_allocator.getPagesAllocated(), pages);
+}
+
+TEST(ConcurrentMemoryPoolAllocatorTest, TestBlocksFreedByOtherThreads){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::ConcurrentMemoryPoolAllocator pool{page_size_allocator, memory::DEFAULT_SIZE_CLASSES, 8};
+
+    constexpr int num_pairs = 4;
+    constexpr int num_blocks = 20'000;
+    std::vector<std::thread> threads;
+    std::atomic<int> corrupted{0};
+    for(int pair{0}; pair < num_pairs; ++pair) {
+        // every producer hands its blocks to a consumer, which checks and frees them
+        auto handoff = std::make_shared<std::vector<std::atomic<void *>>>(num_blocks);
+        threads.emplace_back([&pool, handoff, pair] {
+            for(int i{0}; i < num_blocks; ++i) {
+                const std::size_t size = 16u << (i % 6);
+                auto *block = static_cast<unsigned char *>(pool.allocate(16, size));
+                std::memset(block, pair + 1, size);
+                (*handoff)[i].store(block, std::memory_order_release);
+            }
+            pool.flushThreadCache();
+        });
+        threads.emplace_back([&pool, &corrupted, handoff, pair] {
+            for(int i{0}; i < num_blocks; ++i) {
+                void *ptr{nullptr};
+                while((ptr = (*handoff)[i].load(std::memory_order_acquire)) == nullptr) {
+                    std::this_thread::yield();
+                }
+                const std::size_t size = 16u << (i % 6);
+                const auto *block = static_cast<unsigned char *>(ptr);
+                if(block[0] != pair + 1 || block[size - 1] != pair + 1) {
+                    corrupted.fetch_add(1, std::memory_order_relaxed);
+                }
+                pool.deallocate(ptr, 16, size);
+            }
+            pool.flushThreadCache();
+        });
+    }
+    for(std::thread &thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(corrupted.load(), 0);
+    // whatever is still allocated in the pool sits in full magazines of the depots
+    ASSERT_LE(pool.getPool().getNumUsedBlocks(),
+              memory::DEFAULT_SIZE_CLASSES.size() * memory::DEFAULT_DEPOT_FULL_MAGAZINES * 8);
+}
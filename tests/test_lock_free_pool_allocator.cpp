@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "lock_free_pool_allocator.hpp"
+#include "page_size_allocator.hpp"
+
+
+TEST(LockFreePoolAllocatorTest, TestBlockSizeAndReuse){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::LockFreePoolAllocator pool{page_size_allocator, 20, 16, 4};
+    ASSERT_EQ(pool.getBlockSize(), 32);
+    ASSERT_EQ(memory::LockFreePoolAllocator(page_size_allocator, 24, 8).getBlockSize(), 24);
+
+    void *first = pool.allocate();
+    void *second = pool.allocate();
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(first) % 16, 0);
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(second) % 16, 0);
+    // the first refill carved 4 blocks
+    ASSERT_EQ(pool.getNumCarvedBlocks(), 4);
+    pool.deallocate(first);
+    pool.deallocate(second);
+    // the last freed block is the first one handed out again
+    ASSERT_EQ(pool.allocate(), second);
+    ASSERT_EQ(pool.allocate(), first);
+
+    std::vector<void *> ptrs{first, second};
+    for(int i{0}; i < 3; ++i) {
+        ptrs.emplace_back(pool.allocate());
+    }
+    // the stack ran empty once more
+    ASSERT_EQ(pool.getNumCarvedBlocks(), 8);
+    for(void *ptr: ptrs) {
+        pool.deallocate(ptr);
+    }
+}
+
+TEST(LockFreePoolAllocatorTest, TestReserveCarvesUpfront){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::LockFreePoolAllocator pool{page_size_allocator, 64, 8};
+
+    ASSERT_TRUE(pool.reserve(1000));
+    ASSERT_EQ(pool.getNumCarvedBlocks(), 1000);
+    std::vector<void *> ptrs;
+    for(int i{0}; i < 1000; ++i) {
+        ptrs.emplace_back(pool.allocate());
+    }
+    ASSERT_EQ(pool.getNumCarvedBlocks(), 1000);
+    std::sort(ptrs.begin(), ptrs.end());
+    ASSERT_EQ(std::adjacent_find(ptrs.begin(), ptrs.end()), ptrs.end());
+    for(void *ptr: ptrs) {
+        pool.deallocate(ptr);
+    }
+}
+
+TEST(LockFreePoolAllocatorTest, TestHandoffBetweenThreads){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::LockFreePoolAllocator pool{page_size_allocator, sizeof(std::uint64_t) * 2, 8, 16};
+
+    constexpr int num_pairs = 4;
+    constexpr int num_blocks = 50'000;
+    std::atomic<int> corrupted{0};
+    std::vector<std::thread> threads;
+    for(int pair{0}; pair < num_pairs; ++pair) {
+        // the producer allocates and the consumer frees, so the stack is popped and pushed from different threads
+        auto handoff = std::make_shared<std::vector<std::atomic<std::uint64_t *>>>(num_blocks);
+        threads.emplace_back([&pool, handoff, pair] {
+            for(int i{0}; i < num_blocks; ++i) {
+                auto *block = static_cast<std::uint64_t *>(pool.allocate());
+                block[1] = static_cast<std::uint64_t>(pair) << 32 | static_cast<std::uint64_t>(i);
+                (*handoff)[i].store(block, std::memory_order_release);
+            }
+        });
+        threads.emplace_back([&pool, &corrupted, handoff, pair] {
+            for(int i{0}; i < num_blocks; ++i) {
+                std::uint64_t *block{nullptr};
+                while((block = (*handoff)[i].load(std::memory_order_acquire)) == nullptr) {
+                    std::this_thread::yield();
+                }
+                // a block handed out twice would have been overwritten by the other producer
+                if(block[1] != (static_cast<std::uint64_t>(pair) << 32 | static_cast<std::uint64_t>(i))) {
+                    corrupted.fetch_add(1, std::memory_order_relaxed);
+                }
+                pool.deallocate(block);
+            }
+        });
+    }
+    for(std::thread &thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(corrupted.load(), 0);
+    // nothing lost: every carved block is on the stack again
+    std::vector<void *> ptrs;
+    for(std::size_t i{0}; i < pool.getNumCarvedBlocks(); ++i) {
+        ptrs.emplace_back(pool.allocate());
+    }
+    const std::size_t carved = pool.getNumCarvedBlocks();
+    std::sort(ptrs.begin(), ptrs.end());
+    ASSERT_EQ(std::adjacent_find(ptrs.begin(), ptrs.end()), ptrs.end());
+    ASSERT_EQ(ptrs.size(), carved);
+    for(void *ptr: ptrs) {
+        pool.deallocate(ptr);
+    }
+}
+
+TEST(LockFreePoolAllocatorTest, TestContendedPopAndPush){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::LockFreePoolAllocator pool{page_size_allocator, 16, 8};
+    ASSERT_TRUE(pool.reserve(8));
+
+    // few blocks and many threads, so heads are popped and pushed back again while other pops are in flight
+    constexpr int num_threads = 8;
+    constexpr int num_rounds = 100'000;
+    std::atomic<int> corrupted{0};
+    std::vector<std::thread> threads;
+    for(int t{0}; t < num_threads; ++t) {
+        threads.emplace_back([&pool, &corrupted, t] {
+            for(int i{0}; i < num_rounds; ++i) {
+                auto *a = static_cast<std::uint64_t *>(pool.allocate());
+                auto *b = static_cast<std::uint64_t *>(pool.allocate());
+                a[1] = static_cast<std::uint64_t>(t);
+                b[1] = static_cast<std::uint64_t>(t);
+                std::this_thread::yield();
+                if(a == b || a[1] != static_cast<std::uint64_t>(t) || b[1] != static_cast<std::uint64_t>(t)) {
+                    corrupted.fetch_add(1, std::memory_order_relaxed);
+                }
+                pool.deallocate(a);
+                pool.deallocate(b);
+            }
+        });
+    }
+    for(std::thread &thread: threads) {
+        thread.join();
+    }
+    ASSERT_EQ(corrupted.load(), 0);
+    // two blocks per thread at most are in use at once
+    ASSERT_LE(pool.getNumCarvedBlocks(), 2 * num_threads + memory::DEFAULT_REFILL_BLOCKS);
+}
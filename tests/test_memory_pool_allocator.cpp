@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
+#include <array>
+#include <cstring>
 #include <string>
+#include <vector>
 
 #include "memory_pool_allocator.hpp"
 #include "page_size_allocator.hpp"
@@ -23,7 +26,7 @@ TEST(MemoryPoolAllocatorTest, TestMemoryPoolAllocatesOnlyOnePage){
     constexpr std::size_t num_blocks = memory::PAGE_SIZE / memory::BLOCK_SIZE;
     ptrs.reserve(num_blocks);
 
-    void *ptr = memory_pool_allocator.allocate(1, 1);
+    void *ptr = memory_pool_allocator.allocate(1, memory::BLOCK_SIZE);
     ASSERT_NE(ptr, nullptr);
     ptrs.emplace_back(ptr);
     ASSERT_EQ(page_size_allocator.getPagesAllocated(), 1);
@@ -32,7 +35,7 @@ TEST(MemoryPoolAllocatorTest, TestMemoryPoolAllocatesOnlyOnePage){
 
 
     for(std::size_t i{0}; i < num_blocks - 1; ++i) {
-        void *new_ptr = memory_pool_allocator.allocate(1, 1);
+        void *new_ptr = memory_pool_allocator.allocate(1, memory::BLOCK_SIZE);
         ASSERT_NE(new_ptr, nullptr);
         ASSERT_EQ(page_size_allocator.getPagesAllocated(), 1);
         ptrs.emplace_back(new_ptr);
@@ -62,7 +65,234 @@ TEST(MemoryPoolAllocatorTest, TestMemoryPoolAllocatesOnlyOnePage){
 }
 
 TEST(MemoryPoolAllocatorTest, TestMemoryPoolReusesAllocations){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+
+    void *first = memory_pool_allocator.allocate(1, 1);
+    void *second = memory_pool_allocator.allocate(1, 1);
+    memory_pool_allocator.deallocate(first);
+    memory_pool_allocator.deallocate(second);
+    // the last freed block is the first one handed out again
+    ASSERT_EQ(memory_pool_allocator.allocate(1, 1), second);
+    ASSERT_EQ(memory_pool_allocator.allocate(1, 1), first);
+    ASSERT_EQ(page_size_allocator.getPagesAllocated(), 1);
+
+    memory_pool_allocator.deallocate(first);
+    memory_pool_allocator.deallocate(second);
+}
+
+TEST(MemoryPoolAllocatorTest, TestManyLiveBlocks){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+
+    constexpr std::size_t num_blocks = 100'000;
+    std::vector<void *> ptrs;
+    ptrs.reserve(num_blocks);
+    for(std::size_t i{0}; i < num_blocks; ++i) {
+        ptrs.emplace_back(memory_pool_allocator.allocate(1, memory::BLOCK_SIZE));
+        // block is usable as a whole, the free list lives in it only while it is free
+        std::memset(ptrs.back(), 0xab, memory::BLOCK_SIZE);
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumUsedBlocks(), num_blocks);
+    // slabs double up to the max, so the last one is at most partly used
+    ASSERT_GE(page_size_allocator.getPagesAllocated(), num_blocks / memory::NUM_BLOCKS_PER_PAGE);
+    ASSERT_LT(page_size_allocator.getPagesAllocated(),
+              num_blocks / memory::NUM_BLOCKS_PER_PAGE + memory::DEFAULT_MAX_SLAB_PAGES);
+
+    // every other block, then the rest, so the free list is not in the address order
+    for(std::size_t i{0}; i < num_blocks; i += 2) {
+        memory_pool_allocator.deallocate(ptrs[i]);
+    }
+    for(std::size_t i{1}; i < num_blocks; i += 2) {
+        memory_pool_allocator.deallocate(ptrs[i]);
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumUsedBlocks(), 0);
+    // empty pages beyond the high mark went back to the page allocator
+    const std::size_t empty_pages = memory_pool_allocator.getNumEmptyPages();
+    ASSERT_LE(empty_pages, memory::DEFAULT_EMPTY_PAGES_HIGH);
+    ASSERT_EQ(memory_pool_allocator.getNumFreeBlocks(), empty_pages * memory::NUM_BLOCKS_PER_PAGE);
+    ASSERT_EQ(memory_pool_allocator.getNumPages(), empty_pages);
+}
+
+TEST(MemoryPoolAllocatorTest, TestEmptyPagesGoBackWithHysteresis){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+    memory_pool_allocator.setEmptyPageMarks(1, 3);
+    memory_pool_allocator.setSlabPages(1, 1);
+
+    constexpr std::size_t num_pages = 4;
+    std::vector<void *> ptrs;
+    for(std::size_t i{0}; i < num_pages * memory::NUM_BLOCKS_PER_PAGE; ++i) {
+        ptrs.emplace_back(memory_pool_allocator.allocate(1, memory::BLOCK_SIZE));
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumPages(), num_pages);
+
+    // blocks are handed out in the address order of a page, so every 8 frees empty one page
+    auto free_page = [&](const std::size_t page) {
+        for(std::size_t i{0}; i < memory::NUM_BLOCKS_PER_PAGE; ++i) {
+            memory_pool_allocator.deallocate(ptrs[page * memory::NUM_BLOCKS_PER_PAGE + i]);
+        }
+    };
+    free_page(0);
+    free_page(1);
+    free_page(2);
+    // up to the high mark empty pages stay
+    ASSERT_EQ(memory_pool_allocator.getNumEmptyPages(), 3);
+    ASSERT_EQ(page_size_allocator.getPagesFreed(), 0);
+
+    free_page(3);
+    // over the high mark, down to the low mark at once
+    ASSERT_EQ(memory_pool_allocator.getNumEmptyPages(), 1);
+    ASSERT_EQ(memory_pool_allocator.getNumPages(), 1);
+    ASSERT_EQ(page_size_allocator.getPagesFreed(), 3);
+    // the page emptied last stays, the older ones went back
+    ASSERT_TRUE(memory_pool_allocator.ownsBlock(ptrs[3 * memory::NUM_BLOCKS_PER_PAGE]));
+    ASSERT_FALSE(memory_pool_allocator.ownsBlock(ptrs[0]));
+
+    // the empty page is taken by any class before a new page is allocated
+    void *small = memory_pool_allocator.allocate(8, 8);
+    ASSERT_EQ(memory_pool_allocator.getNumEmptyPages(), 0);
+    ASSERT_EQ(page_size_allocator.getPagesAllocated(), num_pages);
+    ASSERT_EQ(memory_pool_allocator.getNumFreeBlocks(), memory::PAGE_SIZE / 16 - 1);
+    memory_pool_allocator.deallocate(small);
+
+    // high 0 gives pages back as soon as they are empty
+    memory_pool_allocator.setEmptyPageMarks(0, 0);
+    ASSERT_EQ(memory_pool_allocator.getNumPages(), 0);
+    ASSERT_EQ(memory_pool_allocator.getNumFreeBlocks(), 0);
+}
+
+TEST(MemoryPoolAllocatorTest, TestSlabsGrowGeometrically){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+    memory_pool_allocator.setSlabPages(1, 4);
+
+    // slabs of 1, 2, 4 and 4 pages
+    constexpr std::size_t num_blocks = 11 * memory::NUM_BLOCKS_PER_PAGE;
+    std::vector<void *> ptrs;
+    for(std::size_t i{0}; i < num_blocks; ++i) {
+        ptrs.emplace_back(memory_pool_allocator.allocate(1, memory::BLOCK_SIZE));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumRefills(), 4);
+    ASSERT_EQ(memory_pool_allocator.getNumPages(), 11);
+    ASSERT_EQ(page_size_allocator.getPagesAllocated(), 11);
+    ASSERT_EQ(memory_pool_allocator.getNumFreeBlocks(), 0);
+
+    // blocks of a slab follow each other across its pages
+    for(std::size_t i{3 * memory::NUM_BLOCKS_PER_PAGE + 1}; i < 7 * memory::NUM_BLOCKS_PER_PAGE; ++i) {
+        ASSERT_EQ(reinterpret_cast<uint64_t>(ptrs[i]) - reinterpret_cast<uint64_t>(ptrs[i - 1]), memory::BLOCK_SIZE);
+        ASSERT_TRUE(memory_pool_allocator.ownsBlock(ptrs[i]));
+    }
+
+    // the next slab is as big as the cap
+    void *ptr = memory_pool_allocator.allocate(1, memory::BLOCK_SIZE);
+    ASSERT_EQ(memory_pool_allocator.getNumRefills(), 5);
+    ASSERT_EQ(memory_pool_allocator.getNumPages(), 15);
+    // carved lazily, the blocks of the new slab are all free
+    ASSERT_EQ(memory_pool_allocator.getNumFreeBlocks(), 4 * memory::NUM_BLOCKS_PER_PAGE - 1);
+
+    memory_pool_allocator.deallocate(ptr);
+    for(void *block: ptrs) {
+        memory_pool_allocator.deallocate(block);
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumUsedBlocks(), 0);
+}
+
+TEST(MemoryPoolAllocatorTest, TestEmptySlabIsCarvedAgainForOtherClass){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+    memory_pool_allocator.setSlabPages(2, 2);
+
+    std::vector<void *> big;
+    for(std::size_t i{0}; i < 3; ++i) {
+        big.emplace_back(memory_pool_allocator.allocate(1, memory::BLOCK_SIZE));
+    }
+    for(void *ptr: big) {
+        memory_pool_allocator.deallocate(ptr);
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumEmptyPages(), 2);
+
+    // the two pages of the slab are cut into 16 byte blocks from the start, over the freed 512 byte blocks
+    std::vector<void *> small;
+    for(std::size_t i{0}; i < 2 * memory::PAGE_SIZE / 16; ++i) {
+        small.emplace_back(memory_pool_allocator.allocate(8, 8));
+        ASSERT_EQ(reinterpret_cast<uint64_t>(small[i]) - reinterpret_cast<uint64_t>(small[0]), i * 16);
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumRefills(), 1);
+    ASSERT_EQ(memory_pool_allocator.getNumFreeBlocks(), 0);
+    ASSERT_TRUE(memory_pool_allocator.ownsBlock(static_cast<char *>(small[0]) + 16));
+
+    for(void *ptr: small) {
+        memory_pool_allocator.deallocate(ptr);
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumFreeBlocks(), 2 * memory::PAGE_SIZE / 16);
+}
+
+TEST(MemoryPoolAllocatorTest, TestOwnership){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+
+    void *ptr = memory_pool_allocator.allocate(1, memory::BLOCK_SIZE);
+    ASSERT_TRUE(memory_pool_allocator.ownsBlock(ptr));
+    ASSERT_FALSE(memory_pool_allocator.ownsBlock(static_cast<char *>(ptr) + 16));
+    int not_from_pool{0};
+    ASSERT_FALSE(memory_pool_allocator.ownsBlock(&not_from_pool));
+    EXPECT_DEBUG_DEATH(memory_pool_allocator.deallocate(&not_from_pool), "ownsBlock");
+    memory_pool_allocator.deallocate(ptr);
+}
+
+TEST(MemoryPoolAllocatorTest, TestSizeClassesCarveOwnPages){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator};
+
+    // small requests take the smallest class they fit, 256 of them share a page
+    std::vector<void *> small;
+    for(std::size_t i{0}; i < memory::PAGE_SIZE / 16; ++i) {
+        small.emplace_back(memory_pool_allocator.allocate(8, 8));
+    }
+    ASSERT_EQ(page_size_allocator.getPagesAllocated(), 1);
+    ASSERT_EQ(reinterpret_cast<uint64_t>(small[1]) - reinterpret_cast<uint64_t>(small[0]), 16);
+
+    // every class has pages of its own
+    void *medium = memory_pool_allocator.allocate(8, 100);
+    ASSERT_EQ(page_size_allocator.getPagesAllocated(), 2);
+    ASSERT_EQ(memory_pool_allocator.getBlockSize(8, 100), 128);
+    ASSERT_EQ(memory_pool_allocator.getNumFreeBlocks(), memory::PAGE_SIZE / 128 - 1);
+
+    // alignment of a block is the biggest power of two which divides its size
+    void *aligned = memory_pool_allocator.allocate(256, 16);
+    ASSERT_EQ(reinterpret_cast<uint64_t>(aligned) % 256, 0);
+    ASSERT_EQ(memory_pool_allocator.getBlockSize(256, 16), 256);
+    ASSERT_EQ(memory_pool_allocator.allocate(1024, 16), nullptr);
+    ASSERT_EQ(memory_pool_allocator.allocate(1, memory::BLOCK_SIZE + 1), nullptr);
+
+    memory_pool_allocator.deallocate(medium);
+    memory_pool_allocator.deallocate(aligned);
+    for(void *ptr: small) {
+        memory_pool_allocator.deallocate(ptr);
+    }
+    ASSERT_EQ(memory_pool_allocator.getNumUsedBlocks(), 0);
+    ASSERT_EQ(memory_pool_allocator.getNumEmptyPages(), 3);
+    // empty pages are carved again for whichever class needs one
+    void *big = memory_pool_allocator.allocate(8, memory::BLOCK_SIZE);
+    ASSERT_EQ(page_size_allocator.getPagesAllocated(), 3);
+    memory_pool_allocator.deallocate(big);
+}
+
+TEST(MemoryPoolAllocatorTest, TestCustomSizeClasses){
+    memory::PageSizeAllocator page_size_allocator{};
+    constexpr std::array<std::size_t, 3> size_classes{40, 72, 200};
+    memory::MemoryPoolAllocator memory_pool_allocator{page_size_allocator, size_classes};
 
+    ASSERT_EQ(memory_pool_allocator.getBlockSize(8, 41), 72);
+    // 40 is aligned only on 8, 200 on 8 too
+    ASSERT_EQ(memory_pool_allocator.getBlockSize(16, 8), 0);
+    void *ptr = memory_pool_allocator.allocate(8, 200);
+    ASSERT_TRUE(memory_pool_allocator.ownsBlock(ptr));
+    // the tail of the page after the last 200 byte block
+    ASSERT_FALSE(memory_pool_allocator.ownsBlock(static_cast<char *>(ptr) + 200 * (memory::PAGE_SIZE / 200)));
+    memory_pool_allocator.deallocate(ptr);
 }
 
 TEST(MemoryPoolAllocatorTest, TestMemoryIsAllocatable){
@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "object_pool.hpp"
+#include "page_size_allocator.hpp"
+
+
+struct TestingStruct {
+    explicit TestingStruct(std::string my_string, const double d, const int i): my_string_(std::move(my_string)), d_(d), i_(i) {}
+    std::string my_string_;
+    double d_;
+    int i_;
+};
+
+struct alignas(64) AlignedStruct {
+    char c;
+};
+
+struct CountedStruct {
+    explicit CountedStruct(int &alive) : alive_(alive) {
+        alive_ += 1;
+    }
+    ~CountedStruct() {
+        alive_ -= 1;
+    }
+    int &alive_;
+};
+
+struct ThrowingStruct {
+    ThrowingStruct() {
+        throw std::runtime_error{"constructor"};
+    }
+};
+
+// free slot holds the pointer to the next one, so even a char takes a pointer
+static_assert(memory::ObjectPool<char>::BLOCK_SIZE == sizeof(void *));
+static_assert(memory::ObjectPool<TestingStruct>::BLOCK_SIZE == sizeof(TestingStruct));
+static_assert(memory::ObjectPool<AlignedStruct>::BLOCK_SIZE == 64);
+static_assert(memory::ObjectPool<AlignedStruct>::ALIGNMENT == 64);
+
+TEST(ObjectPoolTest, TestCreateAndDestroy){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::ObjectPool<TestingStruct> pool{page_size_allocator};
+
+    auto object = pool.create("session", 1.5, 7);
+    ASSERT_TRUE(object);
+    ASSERT_EQ(object->my_string_, "session");
+    ASSERT_EQ(object->d_, 1.5);
+    ASSERT_EQ((*object).i_, 7);
+    ASSERT_EQ(pool.getNumObjects(), 1);
+    ASSERT_EQ(pool.getNumFreeSlots(), memory::ObjectPool<TestingStruct>::REFILL_SLOTS - 1);
+
+    TestingStruct *raw = object.release();
+    ASSERT_FALSE(object);
+    pool.destroy(raw);
+    ASSERT_EQ(pool.getNumObjects(), 0);
+
+    // the slot of the last destroyed object is the first one taken again
+    auto again = pool.create("order", 2.5, 8);
+    ASSERT_EQ(again.get(), raw);
+}
+
+TEST(ObjectPoolTest, TestHandlesDestroyObjects){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::ObjectPool<CountedStruct> pool{page_size_allocator};
+
+    int alive{0};
+    {
+        auto first = pool.create(alive);
+        auto second = pool.create(alive);
+        ASSERT_EQ(alive, 2);
+
+        // moved to handle is the owner now, assigning over a handle destroys its object
+        memory::ObjectPool<CountedStruct>::Handle moved{std::move(first)};
+        ASSERT_FALSE(first);
+        moved = std::move(second);
+        ASSERT_EQ(alive, 1);
+        ASSERT_EQ(pool.getNumObjects(), 1);
+    }
+    ASSERT_EQ(alive, 0);
+    ASSERT_EQ(pool.getNumObjects(), 0);
+}
+
+TEST(ObjectPoolTest, TestThrowingConstructorFreesSlot){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::ObjectPool<ThrowingStruct> pool{page_size_allocator};
+
+    ASSERT_THROW((void)pool.create(), std::runtime_error);
+    ASSERT_EQ(pool.getNumObjects(), 0);
+    ASSERT_EQ(pool.getNumFreeSlots(), memory::ObjectPool<ThrowingStruct>::REFILL_SLOTS);
+}
+
+TEST(ObjectPoolTest, TestRefillsFromPoolPages){
+    memory::PageSizeAllocator page_size_allocator{};
+    memory::ObjectPool<AlignedStruct> pool{page_size_allocator};
+    constexpr std::size_t per_page = memory::PAGE_SIZE / 64;
+
+    std::vector<memory::ObjectPool<AlignedStruct>::Handle> objects;
+    for(std::size_t i{0}; i < 3 * per_page; ++i) {
+        objects.emplace_back(pool.create());
+        ASSERT_EQ(reinterpret_cast<std::uintptr_t>(objects.back().get()) % 64, 0);
+    }
+    ASSERT_EQ(pool.getNumFreeSlots(), 0);
+    ASSERT_EQ(pool.getPool().getNumUsedBlocks(), 3 * per_page);
+    // slots of one refill follow each other
+    ASSERT_EQ(reinterpret_cast<std::uintptr_t>(objects[1].get()) - reinterpret_cast<std::uintptr_t>(objects[0].get()), 64);
+
+    objects.clear();
+    ASSERT_EQ(pool.getNumFreeSlots(), 3 * per_page);
+    // free slots stay in the object pool until shrink
+    ASSERT_EQ(pool.getPool().getNumUsedBlocks(), 3 * per_page);
+    pool.shrink();
+    ASSERT_EQ(pool.getNumFreeSlots(), 0);
+    ASSERT_EQ(pool.getPool().getNumUsedBlocks(), 0);
+}